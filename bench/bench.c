@@ -0,0 +1,505 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * samd-bench: microbenchmarks on deterministic synthetic signals.  Results are written as JSON, one
+ * result per line, and can be compared against a previous run.
+ */
+
+#include <simpleamd.h>
+#include <samd_classifier.h>
+#include "synth.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#define MAX_RESULTS 512
+#define MAX_NAME 128
+#define SIGNAL_MS 4000
+#define PACKET_MS 20
+#define SESSION_MS 10000
+#define SEED 1234
+
+/** one measurement */
+struct result {
+	char name[MAX_NAME];
+	const char *unit;
+	double value;
+	int have_baseline;
+	double baseline;
+};
+
+/** recorded frame features */
+struct features {
+	uint32_t num_frames;
+	uint32_t time_ms[SIGNAL_MS];
+	double energy[SIGNAL_MS];
+	uint32_t zero_crossings[SIGNAL_MS];
+};
+
+static struct {
+	double min_ns;
+	const char *filter;
+	struct result results[MAX_RESULTS];
+	int num_results;
+} bench;
+
+static const uint32_t sample_rates[] = { 8000, 16000, 48000 };
+static const uint32_t frame_sizes[] = { 5, 10, 20, 40 };
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int selected(const char *name)
+{
+	return !bench.filter || strstr(name, bench.filter);
+}
+
+static void add_result(const char *name, const char *unit, double value)
+{
+	struct result *result;
+	if (bench.num_results >= MAX_RESULTS) {
+		return;
+	}
+	result = &bench.results[bench.num_results++];
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->unit = unit;
+	result->value = value;
+	fprintf(stderr, "%-40s %12.3f %s\n", name, value, unit);
+}
+
+static void null_frame_cb(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+}
+
+static void record_frame_cb(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	struct features *features = (struct features *)user_data;
+	if (features->num_frames < SIGNAL_MS) {
+		features->time_ms[features->num_frames] = time_ms;
+		features->energy[features->num_frames] = energy;
+		features->zero_crossings[features->num_frames] = zero_crossings;
+		features->num_frames++;
+	}
+}
+
+/**
+ * Analyzer cost per sample, fed in packet sized buffers
+ */
+static void bench_analyzer(synth_signal_t signal, uint32_t sample_rate, uint32_t channels)
+{
+	samd_frame_analyzer_t *analyzer = NULL;
+	char name[MAX_NAME];
+	uint32_t num_samples;
+	uint32_t packet = sample_rate * PACKET_MS / 1000 * channels;
+	int16_t *samples;
+	double start, elapsed;
+	uint64_t processed = 0;
+
+	snprintf(name, sizeof(name), "analyzer/%s/%u/%s", synth_signal_name(signal), sample_rate, channels == 1 ? "mono" : "stereo");
+	if (!selected(name)) {
+		return;
+	}
+	samples = synth_generate(signal, sample_rate, channels, SIGNAL_MS, SEED, &num_samples);
+	samd_frame_analyzer_init(&analyzer);
+	samd_frame_analyzer_set_sample_rate(analyzer, sample_rate);
+	samd_frame_analyzer_subscribe(analyzer, null_frame_cb, NULL);
+
+	start = now_ns();
+	do {
+		uint32_t pos;
+		for (pos = 0; pos + packet <= num_samples; pos += packet) {
+			samd_frame_analyzer_process_buffer(analyzer, samples + pos, packet, channels);
+		}
+		processed += pos;
+		elapsed = now_ns() - start;
+	} while (elapsed < bench.min_ns);
+
+	add_result(name, "ns/sample", elapsed / processed);
+	samd_frame_analyzer_destroy(&analyzer);
+	free(samples);
+}
+
+static void spectral_frame_cb(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	samd_spectral_features_t features;
+	samd_frame_analyzer_get_spectral_features(analyzer, &features);
+}
+
+/**
+ * Spectral feature cost per frame when a subscriber asks for every frame, the worst case.  AMDs
+ * only ask for voice frames while detecting.
+ */
+static void bench_spectral(synth_signal_t signal, uint32_t sample_rate)
+{
+	samd_frame_analyzer_t *analyzer = NULL;
+	char name[MAX_NAME];
+	uint32_t num_samples;
+	uint32_t packet = sample_rate * PACKET_MS / 1000;
+	int16_t *samples;
+	double start, elapsed;
+	uint64_t frames = 0;
+
+	snprintf(name, sizeof(name), "spectral/%s/%u", synth_signal_name(signal), sample_rate);
+	if (!selected(name)) {
+		return;
+	}
+	samples = synth_generate(signal, sample_rate, 1, SIGNAL_MS, SEED, &num_samples);
+	samd_frame_analyzer_init(&analyzer);
+	samd_frame_analyzer_set_sample_rate(analyzer, sample_rate);
+	samd_frame_analyzer_set_spectral(analyzer, 1);
+	samd_frame_analyzer_subscribe(analyzer, spectral_frame_cb, NULL);
+
+	start = now_ns();
+	do {
+		uint32_t pos;
+		for (pos = 0; pos + packet <= num_samples; pos += packet) {
+			samd_frame_analyzer_process_buffer(analyzer, samples + pos, packet, 1);
+		}
+		frames += pos / (sample_rate / 100);
+		elapsed = now_ns() - start;
+	} while (elapsed < bench.min_ns);
+
+	add_result(name, "ns/frame", elapsed / frames);
+	samd_frame_analyzer_destroy(&analyzer);
+	free(samples);
+}
+
+static void get_features(struct features *features, synth_signal_t signal, uint32_t frame_ms)
+{
+	samd_frame_analyzer_t *analyzer = NULL;
+	uint32_t num_samples;
+	int16_t *samples = synth_generate(signal, 8000, 1, SIGNAL_MS, SEED, &num_samples);
+
+	features->num_frames = 0;
+	samd_frame_analyzer_init(&analyzer);
+	samd_frame_analyzer_set_frame_ms(analyzer, frame_ms);
+	samd_frame_analyzer_subscribe(analyzer, record_frame_cb, features);
+	samd_frame_analyzer_process_buffer(analyzer, samples, num_samples, 1);
+	samd_frame_analyzer_destroy(&analyzer);
+	free(samples);
+}
+
+/**
+ * VAD, beep and AMD cost per frame, replaying recorded features so the analyzer isn't measured.
+ * Each pass uses a new detector so every pass covers the same detection window.
+ */
+static void bench_detectors(synth_signal_t signal, uint32_t frame_ms)
+{
+	static struct features features;
+	char name[MAX_NAME];
+	const char *detector;
+	int d;
+
+	get_features(&features, signal, frame_ms);
+
+	for (d = 0; d < 3; d++) {
+		double elapsed = 0.0;
+		uint64_t frames = 0;
+		detector = d == 0 ? "vad" : d == 1 ? "beep" : "amd";
+		snprintf(name, sizeof(name), "%s/%s/%ums", detector, synth_signal_name(signal), frame_ms);
+		if (!selected(name)) {
+			continue;
+		}
+		do {
+			samd_vad_t *vad = NULL;
+			samd_beep_t *beep = NULL;
+			samd_t *amd = NULL;
+			double start;
+			uint32_t i;
+			if (d == 0) {
+				samd_vad_init(&vad);
+				samd_vad_set_frame_ms(vad, frame_ms);
+			} else if (d == 1) {
+				samd_beep_init(&beep);
+				samd_beep_set_frame_ms(beep, frame_ms);
+			} else {
+				samd_init(&amd);
+				samd_set_frame_ms(amd, frame_ms);
+			}
+			start = now_ns();
+			if (vad) {
+				for (i = 0; i < features.num_frames; i++) {
+					samd_vad_process_frame_features(vad, features.time_ms[i], features.energy[i], features.zero_crossings[i]);
+				}
+			} else if (beep) {
+				for (i = 0; i < features.num_frames; i++) {
+					samd_beep_process_frame_features(beep, features.time_ms[i], features.energy[i], features.zero_crossings[i]);
+				}
+			} else {
+				for (i = 0; i < features.num_frames; i++) {
+					samd_process_frame_features(amd, features.time_ms[i], features.energy[i], features.zero_crossings[i]);
+				}
+			}
+			elapsed += now_ns() - start;
+			frames += features.num_frames;
+			samd_vad_destroy(&vad);
+			samd_beep_destroy(&beep);
+			samd_destroy(&amd);
+		} while (elapsed < bench.min_ns);
+		add_result(name, "ns/frame", elapsed / frames);
+	}
+}
+
+/**
+ * Cost of creating and destroying each detector
+ */
+static void bench_init_destroy(void)
+{
+	const char *names[] = { "init/analyzer", "init/vad", "init/beep", "init/amd" };
+	int d;
+
+	for (d = 0; d < 4; d++) {
+		double start, elapsed;
+		uint64_t count = 0;
+		if (!selected(names[d])) {
+			continue;
+		}
+		start = now_ns();
+		do {
+			int i;
+			for (i = 0; i < 1000; i++) {
+				if (d == 0) {
+					samd_frame_analyzer_t *analyzer = NULL;
+					samd_frame_analyzer_init(&analyzer);
+					samd_frame_analyzer_destroy(&analyzer);
+				} else if (d == 1) {
+					samd_vad_t *vad = NULL;
+					samd_vad_init(&vad);
+					samd_vad_destroy(&vad);
+				} else if (d == 2) {
+					samd_beep_t *beep = NULL;
+					samd_beep_init(&beep);
+					samd_beep_destroy(&beep);
+				} else {
+					samd_t *amd = NULL;
+					samd_init(&amd);
+					samd_destroy(&amd);
+				}
+			}
+			count += 1000;
+			elapsed = now_ns() - start;
+		} while (elapsed < bench.min_ns);
+		add_result(names[d], "ns/init+destroy", elapsed / count);
+	}
+}
+
+/**
+ * Cost of asking the default classifier about an ambiguous call
+ */
+static void bench_classifier(void)
+{
+	const samd_classifier_model_t *model = samd_classifier_get_default_model();
+	double features[SAMD_CLASSIFIER_FEATURES];
+	double start, elapsed;
+	/* keeps predictions from being optimized away */
+	volatile double machine;
+	uint64_t count = 0;
+	int f;
+
+	if (!selected("classifier/predict")) {
+		return;
+	}
+	for (f = 0; f < SAMD_CLASSIFIER_FEATURES; f++) {
+		features[f] = model->mean[f];
+	}
+	start = now_ns();
+	do {
+		int i;
+		for (i = 0; i < 1000; i++) {
+			features[i % SAMD_CLASSIFIER_FEATURES] += 1e-6;
+			machine = samd_classifier_predict(model, features);
+		}
+		count += 1000;
+		elapsed = now_ns() - start;
+	} while (elapsed < bench.min_ns);
+	add_result("classifier/predict", "ns/call", elapsed / count);
+}
+
+/**
+ * Complete AMD sessions on synthetic speech fed in 20 ms packets, including init and destroy.
+ * Sessions per core is how many calls one core could analyze in real time.
+ */
+static void bench_sessions(uint32_t sample_rate, uint32_t channels, uint32_t frame_ms, int spectral)
+{
+	char name[MAX_NAME];
+	uint32_t num_samples;
+	uint32_t packet = sample_rate * PACKET_MS / 1000 * channels;
+	int16_t *samples;
+	double start, elapsed;
+	uint64_t sessions = 0;
+
+	snprintf(name, sizeof(name), "sessions/%u/%s/%ums%s", sample_rate, channels == 1 ? "mono" : "stereo", frame_ms, spectral ? "/spectral" : "");
+	if (!selected(name)) {
+		return;
+	}
+	samples = synth_generate(SYNTH_SPEECH, sample_rate, channels, SESSION_MS, SEED, &num_samples);
+
+	start = now_ns();
+	do {
+		samd_t *amd = NULL;
+		uint32_t pos;
+		samd_init(&amd);
+		samd_set_sample_rate(amd, sample_rate);
+		samd_set_frame_ms(amd, frame_ms);
+		samd_set_spectral(amd, spectral);
+		for (pos = 0; pos + packet <= num_samples; pos += packet) {
+			samd_process_buffer(amd, samples + pos, packet, channels);
+		}
+		samd_destroy(&amd);
+		sessions++;
+		elapsed = now_ns() - start;
+	} while (elapsed < bench.min_ns);
+
+	add_result(name, "sessions/core", SESSION_MS * 1e6 / (elapsed / sessions));
+	free(samples);
+}
+
+static void load_baseline(const char *file_name)
+{
+	char line[512];
+	FILE *file = fopen(file_name, "r");
+	if (!file) {
+		perror(file_name);
+		exit(EXIT_FAILURE);
+	}
+	while (fgets(line, sizeof(line), file)) {
+		char name[MAX_NAME];
+		double value;
+		char *entry = strstr(line, "{\"name\":\"");
+		int i;
+		if (!entry || sscanf(entry, "{\"name\":\"%127[^\"]\",\"unit\":\"%*[^\"]\",\"value\":%lf", name, &value) != 2) {
+			continue;
+		}
+		for (i = 0; i < bench.num_results; i++) {
+			if (!strcmp(bench.results[i].name, name)) {
+				bench.results[i].have_baseline = 1;
+				bench.results[i].baseline = value;
+				break;
+			}
+		}
+	}
+	fclose(file);
+}
+
+/**
+ * Print change relative to baseline.  Positive is an improvement.
+ */
+static void print_comparison(void)
+{
+	int i;
+	fprintf(stderr, "\n%-40s %12s %12s %8s\n", "benchmark", "baseline", "current", "change");
+	for (i = 0; i < bench.num_results; i++) {
+		struct result *result = &bench.results[i];
+		double change;
+		if (!result->have_baseline || result->baseline == 0.0) {
+			continue;
+		}
+		change = (result->value - result->baseline) / result->baseline * 100.0;
+		if (strcmp(result->unit, "sessions/core")) {
+			/* lower is better for costs */
+			change = -change;
+		}
+		fprintf(stderr, "%-40s %12.3f %12.3f %+7.1f%%\n", result->name, result->baseline, result->value, change);
+	}
+}
+
+static void write_results(FILE *out)
+{
+	int i;
+	fprintf(out, "{\n\"results\": [\n");
+	for (i = 0; i < bench.num_results; i++) {
+		struct result *result = &bench.results[i];
+		fprintf(out, "{\"name\":\"%s\",\"unit\":\"%s\",\"value\":%.4f", result->name, result->unit, result->value);
+		if (result->have_baseline) {
+			fprintf(out, ",\"baseline\":%.4f", result->baseline);
+		}
+		fprintf(out, "}%s\n", i + 1 < bench.num_results ? "," : "");
+	}
+	fprintf(out, "]\n}\n");
+}
+
+#define USAGE "samd-bench [options]"
+#define HELP USAGE"\n" \
+	"\t-t <ms> Minimum time per benchmark (default 200)\n" \
+	"\t-f <filter> Only run benchmarks whose name contains this string\n" \
+	"\t-b <baseline json> Compare against a previous run\n" \
+	"\t-o <json file> Write results here instead of stdout\n"
+
+int main(int argc, char **argv)
+{
+	const char *baseline_file_name = NULL;
+	const char *output_file_name = NULL;
+	FILE *out = stdout;
+	uint32_t r, c, f;
+	int s;
+	int opt;
+
+	bench.min_ns = 200e6;
+	while ((opt = getopt(argc, argv, "t:f:b:o:h")) != -1) {
+		switch (opt) {
+			case 't': bench.min_ns = atof(optarg) * 1e6; break;
+			case 'f': bench.filter = optarg; break;
+			case 'b': baseline_file_name = optarg; break;
+			case 'o': output_file_name = optarg; break;
+			default:
+				printf("%s", HELP);
+				exit(EXIT_SUCCESS);
+		}
+	}
+
+	for (s = 0; s < SYNTH_NUM_SIGNALS; s++) {
+		for (r = 0; r < sizeof(sample_rates) / sizeof(sample_rates[0]); r++) {
+			for (c = 1; c <= 2; c++) {
+				bench_analyzer((synth_signal_t)s, sample_rates[r], c);
+			}
+		}
+	}
+	for (s = 0; s < SYNTH_NUM_SIGNALS; s++) {
+		for (f = 0; f < sizeof(frame_sizes) / sizeof(frame_sizes[0]); f++) {
+			bench_detectors((synth_signal_t)s, frame_sizes[f]);
+		}
+	}
+	bench_init_destroy();
+	bench_classifier();
+	for (r = 0; r < sizeof(sample_rates) / sizeof(sample_rates[0]); r++) {
+		for (c = 1; c <= 2; c++) {
+			bench_sessions(sample_rates[r], c, 10, 0);
+		}
+	}
+	for (f = 0; f < sizeof(frame_sizes) / sizeof(frame_sizes[0]); f++) {
+		if (frame_sizes[f] != 10) {
+			bench_sessions(8000, 1, frame_sizes[f], 0);
+		}
+	}
+	for (s = 0; s < SYNTH_NUM_SIGNALS; s++) {
+		for (r = 0; r < sizeof(sample_rates) / sizeof(sample_rates[0]); r++) {
+			bench_spectral((synth_signal_t)s, sample_rates[r]);
+		}
+	}
+	bench_sessions(8000, 1, 10, 1);
+
+	if (baseline_file_name) {
+		load_baseline(baseline_file_name);
+		print_comparison();
+	}
+	if (output_file_name && !(out = fopen(output_file_name, "w"))) {
+		perror(output_file_name);
+		exit(EXIT_FAILURE);
+	}
+	write_results(out);
+	if (out != stdout) {
+		fclose(out);
+	}
+	return EXIT_SUCCESS;
+}
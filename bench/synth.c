@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include "synth.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/** talk spurt and pause lengths of synthetic speech */
+#define SPEECH_TALK_MS 1500
+#define SPEECH_PAUSE_MS 700
+#define SPEECH_F0 120.0
+#define SPEECH_HARMONICS 10
+#define SPEECH_SYLLABLE_HZ 4.0
+
+/** DTMF '5' */
+#define DTMF_LOW_HZ 770.0
+#define DTMF_HIGH_HZ 1336.0
+#define DTMF_ON_MS 100
+#define DTMF_OFF_MS 100
+
+static uint32_t xorshift(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/**
+ * @return uniform noise in [-amplitude, amplitude]
+ */
+static double noise(uint32_t *state, double amplitude)
+{
+	return ((double)(xorshift(state) & 0xffff) / 32767.5 - 1.0) * amplitude;
+}
+
+static int16_t clip(double value)
+{
+	if (value > 32767.0) {
+		return 32767;
+	}
+	if (value < -32768.0) {
+		return -32768;
+	}
+	return (int16_t)lrint(value);
+}
+
+const char *synth_signal_name(synth_signal_t signal)
+{
+	switch (signal) {
+		case SYNTH_SILENCE: return "silence";
+		case SYNTH_NOISE: return "noise";
+		case SYNTH_SPEECH: return "speech";
+		case SYNTH_BEEP_440: return "beep440";
+		case SYNTH_BEEP_1000: return "beep1000";
+		case SYNTH_DTMF: return "dtmf";
+		case SYNTH_NUM_SIGNALS: break;
+	}
+	return "";
+}
+
+/**
+ * Generate one channel of a signal
+ * @param samples (output)
+ * @param signal to generate
+ * @param sample_rate
+ * @param num_samples to generate
+ * @param seed for noise, the same seed always gives the same samples
+ */
+void synth_generate_mono(int16_t *samples, synth_signal_t signal, uint32_t sample_rate, uint32_t num_samples, uint32_t seed)
+{
+	uint32_t state = seed ? seed : 1;
+	uint32_t i;
+
+	for (i = 0; i < num_samples; i++) {
+		double t = (double)i / sample_rate;
+		uint32_t ms = (uint64_t)i * 1000 / sample_rate;
+		double value = 0.0;
+		switch (signal) {
+			case SYNTH_SILENCE:
+				break;
+			case SYNTH_NOISE:
+				value = noise(&state, 1000.0);
+				break;
+			case SYNTH_SPEECH: {
+				/* voiced harmonics, amplitude modulated at syllable rate, in talk spurts over a low noise floor */
+				value = noise(&state, 30.0);
+				if (ms % (SPEECH_TALK_MS + SPEECH_PAUSE_MS) < SPEECH_TALK_MS) {
+					double envelope = sin(M_PI * SPEECH_SYLLABLE_HZ * t);
+					double voiced = 0.0;
+					int k;
+					for (k = 1; k <= SPEECH_HARMONICS && k * SPEECH_F0 < sample_rate / 2; k++) {
+						voiced += sin(2.0 * M_PI * k * SPEECH_F0 * t) / k;
+					}
+					value += 4000.0 * envelope * envelope * voiced;
+				}
+				break;
+			}
+			case SYNTH_BEEP_440:
+				value = 8000.0 * sin(2.0 * M_PI * 440.0 * t);
+				break;
+			case SYNTH_BEEP_1000:
+				value = 8000.0 * sin(2.0 * M_PI * 1000.0 * t);
+				break;
+			case SYNTH_DTMF:
+				if (ms % (DTMF_ON_MS + DTMF_OFF_MS) < DTMF_ON_MS) {
+					value = 4000.0 * (sin(2.0 * M_PI * DTMF_LOW_HZ * t) + sin(2.0 * M_PI * DTMF_HIGH_HZ * t));
+				}
+				break;
+			case SYNTH_NUM_SIGNALS:
+				break;
+		}
+		samples[i] = clip(value);
+	}
+}
+
+/**
+ * Generate an interleaved signal.  Each channel uses its own noise seed.
+ * @param signal to generate
+ * @param sample_rate
+ * @param channels
+ * @param ms duration
+ * @param seed for noise
+ * @param num_samples total samples, all channels (output)
+ * @return the samples, free() when done
+ */
+int16_t *synth_generate(synth_signal_t signal, uint32_t sample_rate, uint32_t channels, uint32_t ms, uint32_t seed, uint32_t *num_samples)
+{
+	uint32_t frames = (uint64_t)sample_rate * ms / 1000;
+	int16_t *samples = (int16_t *)malloc(sizeof(int16_t) * frames * channels);
+	int16_t *channel_samples = (int16_t *)malloc(sizeof(int16_t) * frames);
+	uint32_t c, i;
+
+	for (c = 0; c < channels; c++) {
+		synth_generate_mono(channel_samples, signal, sample_rate, frames, seed + c);
+		for (i = 0; i < frames; i++) {
+			samples[i * channels + c] = channel_samples[i];
+		}
+	}
+	free(channel_samples);
+	*num_samples = frames * channels;
+	return samples;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#ifndef SAMD_SYNTH_H
+#define SAMD_SYNTH_H
+
+#include <stdint.h>
+
+/* Deterministic synthetic signals for benchmarks and tests */
+typedef enum synth_signal {
+	SYNTH_SILENCE,
+	SYNTH_NOISE,
+	SYNTH_SPEECH,
+	SYNTH_BEEP_440,
+	SYNTH_BEEP_1000,
+	SYNTH_DTMF,
+	SYNTH_NUM_SIGNALS
+} synth_signal_t;
+
+const char *synth_signal_name(synth_signal_t signal);
+void synth_generate_mono(int16_t *samples, synth_signal_t signal, uint32_t sample_rate, uint32_t num_samples, uint32_t seed);
+int16_t *synth_generate(synth_signal_t signal, uint32_t sample_rate, uint32_t channels, uint32_t ms, uint32_t seed, uint32_t *num_samples);
+
+#endif
@@ -5,8 +5,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <simpleamd.h>
 #include <samd_private.h>
+#include <samd_metrics.h>
+#include <samd_fingerprint.h>
+#include <samd_classifier.h>
 
 static void amd_state_wait_for_voice(samd_t *amd, samd_vad_event_t event, int beep);
 static void amd_state_detect(samd_t *amd, samd_vad_event_t event, int beep);
@@ -30,6 +35,171 @@ static void null_event_handler(samd_event_t event, uint32_t samples, void *user_
 	/* ignore */
 }
 
+/**
+ * Deliver an AMD event to the event handler or the caller's event array
+ * @param amd
+ * @param event
+ */
+static void amd_event(samd_t *amd, samd_event_t event)
+{
+	samd_frame_analyzer_t *analyzer = amd->frame_analyzer;
+	samd_event_info_t info;
+	uint64_t frame_end = analyzer->buffer_start_sample + analyzer->buffer_offset;
+	/* a beep is placed at its end, which was one or more frames ago */
+	uint32_t position_ms = event == SAMD_MACHINE_BEEP && amd->beep_end_ms ? amd->beep_end_ms : amd->time_ms;
+	uint64_t before = (uint64_t)(uint32_t)(analyzer->time_ms - position_ms) * analyzer->sample_rate / 1000;
+
+	info.event = event;
+	info.sample = frame_end > before ? frame_end - before : 0;
+	info.offset = (int64_t)info.sample - (int64_t)analyzer->buffer_start_sample;
+	info.time_ms = info.sample * 1000 / analyzer->sample_rate;
+
+	SAMD_PROBE3(amd_event, amd, amd->time_ms, (int)event);
+	samd_metrics_add(SAMD_METRIC_EVENTS + event, 1);
+	if (!amd->decided && event != SAMD_LIKELY_HUMAN && event != SAMD_LIKELY_MACHINE) {
+		amd->decided = 1;
+		samd_metrics_observe_decision_ms(amd->time_ms);
+	}
+	if (amd->collect_events) {
+		if (amd->num_event_records < amd->max_event_records) {
+			samd_event_record_t *record = &amd->event_records[amd->num_event_records];
+			record->event = event;
+			record->time_ms = info.time_ms;
+			record->sample = info.sample;
+			record->offset = info.offset;
+		}
+		amd->num_event_records++;
+	} else if (amd->event_info_handler) {
+		amd->event_info_handler(&info, amd->user_event_data);
+	} else {
+		amd->event_handler(event, amd->time_ms, amd->user_event_data);
+	}
+}
+
+/**
+ * @return state for the flight recorder
+ */
+static samd_recorder_amd_state_t amd_state_id(samd_state_fn state)
+{
+	if (state == amd_state_wait_for_voice) {
+		return SAMD_RECORDER_AMD_WAIT_FOR_VOICE;
+	} else if (state == amd_state_detect) {
+		return SAMD_RECORDER_AMD_DETECT;
+	} else if (state == amd_state_human_detected) {
+		return SAMD_RECORDER_AMD_HUMAN;
+	} else if (state == amd_state_machine_detected) {
+		return SAMD_RECORDER_AMD_MACHINE;
+	}
+	return SAMD_RECORDER_AMD_DONE;
+}
+
+#ifdef SAMD_USDT
+/**
+ * @return name of state for probes
+ */
+static const char *amd_state_name(samd_state_fn state)
+{
+	if (state == amd_state_wait_for_voice) {
+		return "wait_for_voice";
+	} else if (state == amd_state_detect) {
+		return "detect";
+	} else if (state == amd_state_human_detected) {
+		return "human_detected";
+	} else if (state == amd_state_machine_detected) {
+		return "machine_detected";
+	}
+	return "done";
+}
+#endif
+
+/**
+ * Enter a new detection state
+ * @param amd
+ * @param state
+ */
+static void amd_set_state(samd_t *amd, samd_state_fn state)
+{
+	SAMD_PROBE4(amd_state, amd, amd->time_ms, amd_state_name(amd->state), amd_state_name(state));
+	amd->state_begin_ms = amd->time_ms;
+	amd->state = state;
+	amd->transitions++;
+	if (state == amd_state_human_detected) {
+		amd->likelihood = 0.0;
+	} else if (state == amd_state_machine_detected) {
+		amd->likelihood = 1.0;
+	}
+}
+
+/**
+ * Update the machine likelihood while detecting.  It stays at 0.5 while the voice heard could be
+ * any hello: voice only counts as machine evidence past machine_ms / 2, rising to 1 at machine_ms
+ * (squared, so a hello that runs a little long barely moves it).  The current pause lowers that
+ * toward 0 as a fraction of voice_end_ms.  Sends each provisional event at most once, when the
+ * likelihood of either first reaches the configured confidence.
+ * @param amd
+ * @param voice_ms voice since detection began, minus the current pause
+ */
+static void amd_update_likelihood(samd_t *amd, uint32_t voice_ms)
+{
+	double hello_ms = amd->machine_ms / 2.0;
+	double machine = hello_ms > 0.0 ? fmin(fmax((voice_ms - hello_ms) / hello_ms, 0.0), 1.0) : 1.0;
+	double human = fmin((double)amd->transition_ms / (amd->vad->voice_end_ms ? amd->vad->voice_end_ms : 1), 1.0);
+	samd_event_t provisional = SAMD_NO_VOICE;
+
+	amd->likelihood = (0.5 + 0.5 * machine * machine) * (1.0 - human);
+	if (!amd->provisional_confidence) {
+		return;
+	}
+	if (amd->likelihood >= amd->provisional_confidence) {
+		provisional = SAMD_LIKELY_MACHINE;
+	} else if (1.0 - amd->likelihood >= amd->provisional_confidence) {
+		provisional = SAMD_LIKELY_HUMAN;
+	}
+	/* the other event needs the opposite confidence, and neither repeats */
+	if (provisional != SAMD_NO_VOICE && !(amd->provisional_sent & (1 << provisional))) {
+		samd_log_printf(amd, SAMD_LOG_INFO, "%d: %s, likelihood = %f\n", amd->time_ms, provisional == SAMD_LIKELY_MACHINE ? "LIKELY MACHINE" : "LIKELY HUMAN", amd->likelihood);
+		amd->provisional_sent |= 1 << provisional;
+		amd_event(amd, provisional);
+	}
+}
+
+/**
+ * Ask the classifier about an ambiguous call
+ * @param amd
+ * @param voice_ms voice since detection began, minus the current pause
+ * @return true if the call is a machine
+ */
+static int amd_classify(samd_t *amd, uint32_t voice_ms)
+{
+	double features[SAMD_CLASSIFIER_FEATURES];
+	double machine;
+
+	samd_classifier_state_features(&amd->classifier_state, features);
+	if (!amd->have_classifier_features) {
+		memcpy(amd->classifier_features, features, sizeof(features));
+		amd->have_classifier_features = 1;
+	}
+	machine = samd_classifier_predict(amd->classifier, features);
+	samd_log_printf(amd, SAMD_LOG_INFO, "%d: AMBIGUOUS, voice ms = %d, classifier machine probability = %f\n", amd->time_ms, voice_ms, machine);
+	return machine >= 0.5;
+}
+
+/**
+ * @return voice below which a pause means human without asking the classifier
+ */
+static uint32_t amd_classifier_min_ms(samd_t *amd)
+{
+	return amd->classifier_min_ms ? amd->classifier_min_ms : amd->machine_ms / 2;
+}
+
+/**
+ * @return voice above which the call is a machine without asking the classifier
+ */
+static uint32_t amd_classifier_max_ms(samd_t *amd)
+{
+	return amd->classifier_max_ms ? amd->classifier_max_ms : amd->machine_ms * 2;
+}
+
 /**
  * Process VAD events in the wait_for_voice state
  * @param amd
@@ -40,9 +210,8 @@ static void amd_state_wait_for_voice(samd_t *amd, samd_vad_event_t event, int be
 {
 	if (beep) {
 		samd_log_printf(amd, SAMD_LOG_INFO, "%d: BEEP, transition to MACHINE DETECTED\n", amd->time_ms);
-		amd->state_begin_ms = amd->time_ms;
-		amd->state = amd_state_machine_detected;
-		amd->event_handler(SAMD_MACHINE_BEEP, amd->time_ms, amd->user_event_data);
+		amd_set_state(amd, amd_state_machine_detected);
+		amd_event(amd, SAMD_MACHINE_BEEP);
 		return;
 	}
 
@@ -51,16 +220,14 @@ static void amd_state_wait_for_voice(samd_t *amd, samd_vad_event_t event, int be
 		case SAMD_VAD_SILENCE:
 			if (amd->time_ms - amd->state_begin_ms >= amd->wait_for_voice_ms) {
 				samd_log_printf(amd, SAMD_LOG_INFO, "%d: NO VOICE, transition to DONE\n", amd->time_ms);
-				amd->state_begin_ms = amd->time_ms;
-				amd->state = amd_state_done;
-				amd->event_handler(SAMD_NO_VOICE, amd->time_ms, amd->user_event_data);
+				amd_set_state(amd, amd_state_done);
+				amd_event(amd, SAMD_NO_VOICE);
 			}
 			break;
 		case SAMD_VAD_VOICE_BEGIN:
 		case SAMD_VAD_VOICE:
 			samd_log_printf(amd, SAMD_LOG_INFO, "%d: Start of VOICE, transition to DETECT\n", amd->time_ms);
-			amd->state_begin_ms = amd->time_ms;
-			amd->state = amd_state_detect;
+			amd_set_state(amd, amd_state_detect);
 			break;
 	}
 }
@@ -73,11 +240,12 @@ static void amd_state_wait_for_voice(samd_t *amd, samd_vad_event_t event, int be
  */
 static void amd_state_detect(samd_t *amd, samd_vad_event_t event, int beep)
 {
+	uint32_t voice_ms;
+
 	if (beep) {
 		samd_log_printf(amd, SAMD_LOG_INFO, "%d: BEEP, transition to MACHINE DETECTED\n", amd->time_ms);
-		amd->state_begin_ms = amd->time_ms;
-		amd->state = amd_state_machine_detected;
-		amd->event_handler(SAMD_MACHINE_BEEP, amd->time_ms, amd->user_event_data);
+		amd_set_state(amd, amd_state_machine_detected);
+		amd_event(amd, SAMD_MACHINE_BEEP);
 		return;
 	}
 
@@ -86,19 +254,39 @@ static void amd_state_detect(samd_t *amd, samd_vad_event_t event, int beep)
 			break;
 		case SAMD_VAD_SILENCE_BEGIN:
 		case SAMD_VAD_SILENCE:
+			voice_ms = amd->time_ms - amd->state_begin_ms - amd->transition_ms;
+			if (amd->classifier && voice_ms >= amd_classifier_min_ms(amd) && amd_classify(amd, voice_ms)) {
+				samd_log_printf(amd, SAMD_LOG_INFO, "%d: SILENCE, total voice ms = %d, classified, transition to MACHINE DETECTED\n", amd->time_ms, amd->total_voice_ms);
+				amd_set_state(amd, amd_state_machine_detected);
+				amd_event(amd, SAMD_MACHINE_VOICE);
+				break;
+			}
 			samd_log_printf(amd, SAMD_LOG_INFO, "%d: SILENCE, total voice ms = %d, transition to HUMAN DETECTED\n", amd->time_ms, amd->total_voice_ms);
-			amd->state_begin_ms = amd->time_ms;
-			amd->state = amd_state_human_detected;
-			amd->event_handler(SAMD_HUMAN_SILENCE, amd->time_ms, amd->user_event_data);
+			amd_set_state(amd, amd_state_human_detected);
+			amd_event(amd, SAMD_HUMAN_SILENCE);
 			break;
 		case SAMD_VAD_VOICE_BEGIN:
 		case SAMD_VAD_VOICE:
 			/* calculate time in voice minus any current silence (transition ms) we are hearing */
-			if (amd->time_ms - amd->state_begin_ms - amd->transition_ms >= amd->machine_ms) {
+			voice_ms = amd->time_ms - amd->state_begin_ms - amd->transition_ms;
+			if (amd->classifier && voice_ms >= amd->machine_ms && voice_ms < amd_classifier_max_ms(amd)) {
+				/* ambiguous: keep listening unless the classifier says machine, asking only once */
+				if (!amd->classifier_asked) {
+					amd->classifier_asked = 1;
+					if (amd_classify(amd, voice_ms)) {
+						samd_log_printf(amd, SAMD_LOG_INFO, "%d: total voice ms = %d, classified, transition to MACHINE DETECTED\n", amd->time_ms, amd->total_voice_ms);
+						amd_set_state(amd, amd_state_machine_detected);
+						amd_event(amd, SAMD_MACHINE_VOICE);
+						break;
+					}
+				}
+				amd_update_likelihood(amd, voice_ms);
+			} else if (voice_ms >= amd->machine_ms) {
 				samd_log_printf(amd, SAMD_LOG_INFO, "%d: total voice ms = %d, Exceeded machine_ms, transition to MACHINE DETECTED\n", amd->time_ms, amd->total_voice_ms, amd->total_voice_ms);
-				amd->state_begin_ms = amd->time_ms;
-				amd->state = amd_state_machine_detected;
-				amd->event_handler(SAMD_MACHINE_VOICE, amd->time_ms, amd->user_event_data);
+				amd_set_state(amd, amd_state_machine_detected);
+				amd_event(amd, SAMD_MACHINE_VOICE);
+			} else {
+				amd_update_likelihood(amd, voice_ms);
 			}
 			break;
 	}
@@ -114,9 +302,8 @@ static void amd_state_human_detected(samd_t *amd, samd_vad_event_t event, int be
 {
 	if (beep) {
 		samd_log_printf(amd, SAMD_LOG_INFO, "%d: BEEP, transition to MACHINE DETECTED\n", amd->time_ms);
-		amd->state_begin_ms = amd->time_ms;
-		amd->state = amd_state_machine_detected;
-		amd->event_handler(SAMD_MACHINE_BEEP, amd->time_ms, amd->user_event_data);
+		amd_set_state(amd, amd_state_machine_detected);
+		amd_event(amd, SAMD_MACHINE_BEEP);
 		return;
 	}
 
@@ -124,12 +311,12 @@ static void amd_state_human_detected(samd_t *amd, samd_vad_event_t event, int be
 		case SAMD_VAD_NONE:
 			break;
 		case SAMD_VAD_SILENCE_BEGIN:
-			amd->event_handler(SAMD_HUMAN_SILENCE, amd->time_ms, amd->user_event_data);
+			amd_event(amd, SAMD_HUMAN_SILENCE);
 			break;
 		case SAMD_VAD_SILENCE:
 			break;
 		case SAMD_VAD_VOICE_BEGIN:
-			amd->event_handler(SAMD_HUMAN_VOICE, amd->time_ms, amd->user_event_data);
+			amd_event(amd, SAMD_HUMAN_VOICE);
 			break;
 		case SAMD_VAD_VOICE:
 			break;
@@ -148,12 +335,12 @@ static void amd_state_machine_detected(samd_t *amd, samd_vad_event_t event, int
 		case SAMD_VAD_NONE:
 			break;
 		case SAMD_VAD_SILENCE_BEGIN:
-			amd->event_handler(SAMD_MACHINE_SILENCE, amd->time_ms, amd->user_event_data);
+			amd_event(amd, SAMD_MACHINE_SILENCE);
 			break;
 		case SAMD_VAD_SILENCE:
 			break;
 		case SAMD_VAD_VOICE_BEGIN:
-			amd->event_handler(SAMD_MACHINE_VOICE, amd->time_ms, amd->user_event_data);
+			amd_event(amd, SAMD_MACHINE_VOICE);
 			break;
 		case SAMD_VAD_VOICE:
 			break;
@@ -188,21 +375,143 @@ void samd_set_machine_ms(samd_t *amd, uint32_t ms)
 }
 
 /**
- * Process VAD events
- * @param event VAD event
- * @param time_ms time this event occurred, relative to start of detector
- * @param total_voice_ms how much voice has been heard in total
- * @param transition_ms duration spent in voice/silence while in opposite state
- * @param user_event_data the AMD
+ * Send SAMD_LIKELY_HUMAN or SAMD_LIKELY_MACHINE as soon as the machine likelihood reaches
+ * confidence (or 1 - confidence for human), before the final decision.  Off by default.
+ * @param amd
+ * @param confidence 0.5 - 1, or 0 to disable
  */
-static void vad_event_handler(samd_vad_event_t event, uint32_t time_ms, uint32_t total_voice_ms, uint32_t transition_ms, void *user_event_data)
+void samd_set_provisional_confidence(samd_t *amd, double confidence)
 {
-	/* forward event to state machine */
-	samd_t *amd = (samd_t *)user_event_data;
-	amd->time_ms = time_ms;
-	amd->total_voice_ms = total_voice_ms;
-	amd->transition_ms = transition_ms;
-	amd->state(amd, event, 0);
+	amd->provisional_confidence = confidence > 0.5 && confidence <= 1.0 ? confidence : 0.0;
+}
+
+/**
+ * Get the likelihood the call is a machine, updated every frame while detecting.  0.5 until the
+ * voice heard is longer than a hello, then up with voice and down with pauses by the evidence a
+ * final decision needs, then 0 or 1 once decided.
+ * @param amd
+ * @return 0 (human) - 1 (machine)
+ */
+double samd_get_machine_likelihood(samd_t *amd)
+{
+	return amd->likelihood;
+}
+
+/**
+ * Compute spectral features of voice frames while detecting.  Off by default.  Only frames the VAD
+ * marks as voice before the decision are transformed.
+ * @param amd
+ * @param spectral true to enable
+ */
+void samd_set_spectral(samd_t *amd, int spectral)
+{
+	samd_frame_analyzer_set_spectral(amd->analyzer, spectral);
+}
+
+/**
+ * Get the mean spectral features of voice frames while detecting.  May be called from the event
+ * handler.
+ * @param amd
+ * @param features (output) zero if no frames
+ * @return number of frames averaged
+ */
+uint32_t samd_get_spectral_features(samd_t *amd, samd_spectral_features_t *features)
+{
+	uint32_t i;
+	memset(features, 0, sizeof(*features));
+	if (amd->spectral_frames) {
+		features->centroid_hz = amd->spectral_sum.centroid_hz / amd->spectral_frames;
+		features->flatness = amd->spectral_sum.flatness / amd->spectral_frames;
+		for (i = 0; i < SAMD_SPECTRAL_BANDS; i++) {
+			features->bands[i] = amd->spectral_sum.bands[i] / amd->spectral_frames;
+		}
+	}
+	return amd->spectral_frames;
+}
+
+/**
+ * Add the spectral features of a voice frame to the detection window
+ * @param amd
+ * @param analyzer
+ */
+static void amd_spectral_frame(samd_t *amd, samd_frame_analyzer_t *analyzer)
+{
+	samd_spectral_features_t features;
+	uint32_t i;
+	if (!samd_frame_analyzer_get_spectral_features(analyzer, &features)) {
+		return;
+	}
+	amd->spectral_sum.centroid_hz += features.centroid_hz;
+	amd->spectral_sum.flatness += features.flatness;
+	for (i = 0; i < SAMD_SPECTRAL_BANDS; i++) {
+		amd->spectral_sum.bands[i] += features.bands[i];
+	}
+	amd->spectral_frames++;
+}
+
+/**
+ * Decide ambiguous calls with a classifier.  Off by default.  Silence after at least the window's
+ * min_ms of voice, and voice reaching machine_ms but not the window's max_ms, are ambiguous.
+ * @param amd
+ * @param model from samd_classifier_get_default_model() or a header written by
+ *        samd_classifier_write().  NULL to decide by duration alone.
+ */
+void samd_set_classifier(samd_t *amd, const samd_classifier_model_t *model)
+{
+	amd->classifier = model;
+}
+
+/**
+ * Set the voice durations the classifier decides between
+ * @param amd
+ * @param min_ms shorter voice followed by silence is human, 0 for machine_ms / 2 (default)
+ * @param max_ms longer voice is machine, 0 for machine_ms * 2 (default)
+ */
+void samd_set_classifier_window_ms(samd_t *amd, uint32_t min_ms, uint32_t max_ms)
+{
+	amd->classifier_min_ms = min_ms;
+	amd->classifier_max_ms = max_ms;
+}
+
+/**
+ * Get the features the classifier was first asked about this call with, for training.  The first
+ * question doesn't depend on the model.
+ * @param amd
+ * @param features (output) SAMD_CLASSIFIER_FEATURES values
+ * @return 1 if the classifier was asked, 0 if the call was a clear case
+ */
+int samd_get_classifier_features(samd_t *amd, double *features)
+{
+	if (!amd->have_classifier_features) {
+		return 0;
+	}
+	memcpy(features, amd->classifier_features, sizeof(amd->classifier_features));
+	return 1;
+}
+
+/**
+ * Match the call against known greetings until the AMD decides.  Off by default.  The frame
+ * duration must divide the index's step (20 ms), or the AMD logs a warning and doesn't fingerprint.
+ * @param amd
+ * @param index opened with samd_fingerprint_index_open(), may be shared by any number of AMDs.
+ *        NULL to disable.
+ */
+void samd_set_fingerprint_index(samd_t *amd, samd_fingerprint_index_t *index)
+{
+	amd->fingerprint_index = index;
+	samd_fingerprinter_reset(&amd->fingerprinter, 0, 0);
+}
+
+/**
+ * @param amd
+ * @return name of the greeting that sent SAMD_MACHINE_FINGERPRINT, or NULL if none
+ */
+const char *samd_get_fingerprint_match(samd_t *amd)
+{
+	if (!amd->fingerprint_index) {
+		return NULL;
+	}
+	return samd_fingerprint_index_get_name(amd->fingerprint_index, amd->fingerprinter.match);
 }
 
 /**
@@ -215,7 +524,9 @@ static void beep_event_handler(uint32_t time_ms, void *user_event_data)
 	/* forward event to state machine */
 	samd_t *amd = (samd_t *)user_event_data;
 	amd->time_ms = time_ms;
+	amd->beep_end_ms = amd->beep->start_time;
 	amd->state(amd, SAMD_VAD_NONE, 1);
+	amd->beep_end_ms = 0;
 }
 
 /**
@@ -240,18 +551,252 @@ void samd_set_event_handler(samd_t *amd, samd_event_fn event_handler, void *user
 {
 	amd->user_event_data = user_event_data;
 	amd->event_handler = event_handler;
+	amd->event_info_handler = NULL;
+}
+
+/**
+ * Set event handler that gets the 64-bit position of each event in the input, so the caller can
+ * slice the buffers it passed at the decision point.  Replaces the samd_set_event_handler() handler.
+ * @param amd
+ * @param event_info_handler
+ */
+void samd_set_event_info_handler(samd_t *amd, samd_event_info_fn event_info_handler, void *user_event_data)
+{
+	amd->user_event_data = user_event_data;
+	amd->event_info_handler = event_info_handler;
 }
 
 /**
- * Handle the next frame of processed audio
+ * Save a frame in the flight recorder
+ * @param amd
+ * @param time_ms
+ * @param energy
+ * @param zero_crossings
+ * @param in_voice true if the frame was classified as voice
+ */
+static void amd_record_frame(samd_t *amd, uint32_t time_ms, double energy, uint32_t zero_crossings, int in_voice)
+{
+	samd_recorder_frame_t *frame = &amd->recorder[amd->recorder_pos];
+	frame->time_ms = time_ms;
+	frame->energy = energy < UINT16_MAX ? (uint16_t)energy : UINT16_MAX;
+	frame->threshold = amd->vad->threshold < UINT16_MAX ? (uint16_t)amd->vad->threshold : UINT16_MAX;
+	frame->zero_crossings = zero_crossings < UINT8_MAX ? zero_crossings : UINT8_MAX;
+	frame->vad_state = samd_vad_get_recorder_state(amd->vad);
+	frame->amd_state = amd_state_id(amd->state);
+	frame->flags = (in_voice ? SAMD_RECORDER_VOICE : 0) | (amd->beep->start_time ? SAMD_RECORDER_BEEP : 0);
+	if (++amd->recorder_pos == amd->recorder_size) {
+		amd->recorder_pos = 0;
+	}
+	if (amd->recorder_frames < amd->recorder_size) {
+		amd->recorder_frames++;
+	}
+}
+
+/**
+ * Fingerprint a frame and look up each new word in the index of known greetings
+ * @param amd
+ * @param analyzer
+ * @param time_ms
+ * @param energy
+ * @param zero_crossings
+ * @param in_voice true if the frame was classified as voice
+ */
+static void amd_fingerprint_frame(samd_t *amd, samd_frame_analyzer_t *analyzer, uint32_t time_ms, double energy, uint32_t zero_crossings, int in_voice)
+{
+	uint32_t word;
+	int32_t greeting;
+
+	if (!amd->fingerprinter.step_ms) {
+		samd_fingerprinter_reset(&amd->fingerprinter, samd_fingerprint_index_get_step_ms(amd->fingerprint_index), analyzer->frame_ms);
+		if (!amd->fingerprinter.step_frames) {
+			samd_log_printf(amd, SAMD_LOG_WARNING, "%d: frame ms = %d does not divide fingerprint step ms = %d, not fingerprinting\n", time_ms, analyzer->frame_ms, amd->fingerprinter.step_ms);
+			amd->fingerprint_index = NULL;
+			return;
+		}
+	}
+	if (!samd_fingerprinter_process_frame(&amd->fingerprinter, energy, zero_crossings, in_voice, &word)) {
+		return;
+	}
+	greeting = samd_fingerprint_index_match(amd->fingerprint_index, &amd->fingerprinter, word);
+	if (greeting >= 0) {
+		amd->time_ms = time_ms;
+		samd_log_printf(amd, SAMD_LOG_INFO, "%d: FINGERPRINT %s, transition to MACHINE DETECTED\n", amd->time_ms, samd_fingerprint_index_get_name(amd->fingerprint_index, greeting));
+		amd_set_state(amd, amd_state_machine_detected);
+		amd_event(amd, SAMD_MACHINE_FINGERPRINT);
+	}
+}
+
+/**
+ * Handle the next frame of processed audio.  Subscribe to a shared frame analyzer with this function
+ * to run the AMD on audio already being analyzed for other detectors.
  * @param analzyer the frame analyzer
  * @param user_data this detector
  */
-static void process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
+void samd_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
 {
 	samd_t *amd = (samd_t *)user_data;
+	samd_vad_event_t event;
+	uint64_t start = 0, beep_end = 0, vad_end = 0;
+	uint64_t voice_frames = amd->vad->voice_frames;
+
+	amd->frame_analyzer = analyzer;
+	if (amd->measure_cycles) {
+		start = samd_cycles();
+	}
 	samd_beep_process_frame(analyzer, amd->beep, time_ms, energy, zero_crossings);
-	samd_vad_process_frame(analyzer, amd->vad, time_ms, energy, zero_crossings);
+	if (amd->measure_cycles) {
+		beep_end = samd_cycles();
+	}
+
+	/* forward VAD result to state machine */
+	event = samd_vad_process_frame_internal(analyzer, amd->vad, time_ms, energy, zero_crossings);
+	if (amd->measure_cycles) {
+		vad_end = samd_cycles();
+	}
+	if (analyzer->spectral && amd->vad->voice_frames != voice_frames &&
+			(amd->state == amd_state_wait_for_voice || amd->state == amd_state_detect)) {
+		amd_spectral_frame(amd, analyzer);
+	}
+
+	if (amd->classifier && (amd->state == amd_state_wait_for_voice || amd->state == amd_state_detect)) {
+		samd_classifier_state_frame(&amd->classifier_state, analyzer->frame_ms, energy, zero_crossings, amd->vad->voice_frames != voice_frames);
+	}
+
+	if (event != SAMD_VAD_NONE) {
+		amd->time_ms = time_ms;
+		amd->total_voice_ms = amd->vad->total_voice_ms;
+		amd->transition_ms = (event == SAMD_VAD_SILENCE || event == SAMD_VAD_VOICE) ? amd->vad->transition_ms : 0;
+		amd->state(amd, event, 0);
+	}
+
+	/* VAD events for the user, if any */
+	samd_vad_send_event(amd->vad, event);
+
+	/* only until the final decision; a human answering is not a greeting */
+	if (amd->fingerprint_index && (amd->state == amd_state_wait_for_voice || amd->state == amd_state_detect)) {
+		amd_fingerprint_frame(amd, analyzer, time_ms, energy, zero_crossings, amd->vad->voice_frames != voice_frames);
+	}
+
+	if (amd->recorder) {
+		amd_record_frame(amd, time_ms, energy, zero_crossings, amd->vad->voice_frames != voice_frames);
+	}
+
+	if (amd->measure_cycles) {
+		/* beep events run the AMD state machine, so those count as beep detection */
+		amd->beep_cycles += beep_end - start;
+		amd->vad_cycles += vad_end - beep_end;
+		amd->amd_cycles += samd_cycles() - vad_end;
+	}
+}
+
+/**
+ * Count cycles spent in the frame analyzer, VAD, beep detector and AMD state machine.
+ * Off by default.
+ * @param amd
+ * @param measure_cycles true to enable
+ */
+void samd_set_measure_cycles(samd_t *amd, int measure_cycles)
+{
+	amd->measure_cycles = measure_cycles;
+}
+
+/**
+ * Keep the features, VAD and AMD state of recent frames in a ring, for samd_dump_recorder().
+ * Off by default.  The ring is sized for the current frame duration, so set this after
+ * samd_set_frame_ms().  Recorded frames are discarded.
+ * @param amd
+ * @param ms duration of audio to keep, 0 to disable
+ */
+void samd_set_recorder_ms(samd_t *amd, uint32_t ms)
+{
+	uint32_t frame_ms = amd->analyzer->frame_ms;
+	free(amd->recorder);
+	amd->recorder = NULL;
+	amd->recorder_size = (ms + frame_ms - 1) / frame_ms;
+	amd->recorder_pos = 0;
+	amd->recorder_frames = 0;
+	if (amd->recorder_size) {
+		amd->recorder = (samd_recorder_frame_t *)malloc(sizeof(samd_recorder_frame_t) * amd->recorder_size);
+	}
+}
+
+/**
+ * Copy recorded frames, oldest first.  Energy and threshold are truncated to integers.
+ * @param amd
+ * @param frames array to store frames, or NULL to get the number of frames recorded
+ * @param max_frames size of frames array.  If fewer than recorded, the most recent are copied.
+ * @return number of frames copied
+ */
+size_t samd_dump_recorder(samd_t *amd, samd_recorder_frame_t *frames, size_t max_frames)
+{
+	uint32_t count = amd->recorder_frames;
+	uint32_t first;
+	uint32_t i;
+
+	if (!frames) {
+		return count;
+	}
+	if (count > max_frames) {
+		count = max_frames;
+	}
+	first = (amd->recorder_pos + amd->recorder_size - count) % (amd->recorder_size ? amd->recorder_size : 1);
+	for (i = 0; i < count; i++) {
+		frames[i] = amd->recorder[(first + i) % amd->recorder_size];
+	}
+	return count;
+}
+
+/**
+ * Get the counters of this AMD and its VAD and beep detector
+ * @param amd
+ * @param stats (output)
+ */
+void samd_get_stats(samd_t *amd, samd_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	samd_frame_analyzer_add_stats(amd->analyzer, stats);
+	samd_vad_add_stats(amd->vad, stats);
+	samd_beep_add_stats(amd->beep, stats);
+	stats->amd_transitions = amd->transitions;
+	stats->analyzer_cycles = amd->analyzer_cycles;
+	stats->vad_cycles = amd->vad_cycles;
+	stats->beep_cycles = amd->beep_cycles;
+	stats->amd_cycles = amd->amd_cycles;
+}
+
+/**
+ * Add new counts to the global stats
+ * @param amd
+ */
+static void amd_stats_flush(samd_t *amd)
+{
+	samd_stats_t stats;
+	samd_get_stats(amd, &stats);
+	samd_metrics_add(SAMD_METRIC_FRAMES, stats.frames - amd->flushed_stats.frames);
+	samd_stats_flush(&stats, &amd->flushed_stats);
+}
+
+/**
+ * Run a buffer through the frame analyzer and detectors
+ * @param amd
+ * @param samples
+ * @param num_samples
+ * @param channels
+ */
+static void amd_process_buffer(samd_t *amd, int16_t *samples, uint32_t num_samples, uint32_t channels)
+{
+	SAMD_PROBE3(buffer, amd, num_samples, channels);
+	if (amd->measure_cycles) {
+		/* analyzer cycles are what's left after the detector stages */
+		uint64_t stage_cycles = amd->vad_cycles + amd->beep_cycles + amd->amd_cycles;
+		uint64_t start = samd_cycles();
+		samd_frame_analyzer_process_buffer(amd->analyzer, samples, num_samples, channels);
+		amd->analyzer_cycles += samd_cycles() - start - (amd->vad_cycles + amd->beep_cycles + amd->amd_cycles - stage_cycles);
+	} else {
+		samd_frame_analyzer_process_buffer(amd->analyzer, samples, num_samples, channels);
+	}
+	amd_stats_flush(amd);
+	SAMD_PROBE2(buffer_done, amd, amd->analyzer->time_ms);
 }
 
 /**
@@ -263,7 +808,65 @@ static void process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint
  */
 void samd_process_buffer(samd_t *amd, int16_t *samples, uint32_t num_samples, uint32_t channels)
 {
-	samd_frame_analyzer_process_buffer(amd->analyzer, samples, num_samples, channels);
+	amd_process_buffer(amd, samples, num_samples, channels);
+}
+
+/**
+ * Process the next buffer of samples, returning events instead of calling the event handler
+ * @param amd
+ * @param samples
+ * @param num_samples
+ * @param channels
+ * @param events array to store events detected in this buffer
+ * @param max_events size of events array
+ * @return number of events detected.  If more than max_events, only the first max_events are stored.
+ */
+size_t samd_process_buffer_events(samd_t *amd, int16_t *samples, uint32_t num_samples, uint32_t channels, samd_event_record_t *events, size_t max_events)
+{
+	size_t num_events;
+	amd->collect_events = 1;
+	amd->event_records = events;
+	amd->max_event_records = max_events;
+	amd->num_event_records = 0;
+	amd_process_buffer(amd, samples, num_samples, channels);
+	num_events = amd->num_event_records;
+	amd->collect_events = 0;
+	amd->event_records = NULL;
+	amd->max_event_records = 0;
+	amd->num_event_records = 0;
+	return num_events;
+}
+
+/**
+ * Advance through a gap in the audio, such as RTP silence suppression, DTX or lost packets, without
+ * buffers of silence.  wait_for_voice_ms and voice end still expire, in time proportional to the
+ * frames in the gap.  Buffers of all zero samples passed to samd_process_buffer() are skipped the
+ * same way.
+ * @param amd
+ * @param ms duration of the gap
+ * @param energy average absolute sample value to treat the gap as, 0 for digital silence or the
+ *        level of comfort noise
+ */
+void samd_process_gap(samd_t *amd, uint32_t ms, double energy)
+{
+	SAMD_PROBE3(gap, amd, ms, (uint32_t)energy);
+	samd_frame_analyzer_process_gap(amd->analyzer, ms, energy);
+	amd_stats_flush(amd);
+	SAMD_PROBE2(buffer_done, amd, amd->analyzer->time_ms);
+}
+
+/**
+ * Process the next frame of features computed by the caller, bypassing sample analysis.
+ * Decisions are identical to samd_process_buffer() when the features match.
+ * @param amd
+ * @param time_ms end time of this frame, relative to start of detection
+ * @param energy average absolute sample value in the frame, normalized to 8000 Hz
+ * @param zero_crossings number of negative to positive zero crossings in the frame
+ */
+void samd_process_frame_features(samd_t *amd, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	samd_frame_analyzer_process_frame_features(amd->analyzer, time_ms, energy, zero_crossings);
+	amd_stats_flush(amd);
 }
 
 /**
@@ -276,21 +879,54 @@ void samd_init(samd_t **amd)
 
 	/* Link to common frame analyzer for VAD and beep */
 	samd_frame_analyzer_init(&new_amd->analyzer);
-	samd_frame_analyzer_set_callback(new_amd->analyzer, process_frame, new_amd);
+	samd_frame_analyzer_subscribe(new_amd->analyzer, samd_process_frame, new_amd);
 
 	/* link to VAD and beep detectors */
 	samd_vad_init_internal(&new_amd->vad);
-	samd_vad_set_event_handler(new_amd->vad, vad_event_handler, new_amd);
+	samd_vad_set_event_mode(new_amd->vad, SAMD_VAD_EVENT_MODE_EDGE); /* AMD gets every frame directly */
 	samd_beep_init_internal(&new_amd->beep);
 	samd_beep_set_event_handler(new_amd->beep, beep_event_handler, new_amd);
 
 	samd_set_log_handler(new_amd, null_log_handler, NULL);
 	samd_set_event_handler(new_amd, null_event_handler, NULL);
+	new_amd->frame_analyzer = new_amd->analyzer;
 
 	/* reset AMD state */
 	new_amd->state = amd_state_wait_for_voice;
 	new_amd->state_begin_ms = 0;
 	new_amd->time_ms = 0;
+	new_amd->beep_end_ms = 0;
+	new_amd->collect_events = 0;
+	new_amd->event_records = NULL;
+	new_amd->max_event_records = 0;
+	new_amd->num_event_records = 0;
+	new_amd->transitions = 0;
+	new_amd->measure_cycles = 0;
+	new_amd->analyzer_cycles = 0;
+	new_amd->vad_cycles = 0;
+	new_amd->beep_cycles = 0;
+	new_amd->amd_cycles = 0;
+	memset(&new_amd->flushed_stats, 0, sizeof(new_amd->flushed_stats));
+	new_amd->decided = 0;
+	new_amd->likelihood = 0.5;
+	new_amd->provisional_confidence = 0.0;
+	new_amd->provisional_sent = 0;
+	new_amd->recorder = NULL;
+	new_amd->recorder_size = 0;
+	new_amd->recorder_pos = 0;
+	new_amd->recorder_frames = 0;
+	new_amd->fingerprint_index = NULL;
+	memset(&new_amd->spectral_sum, 0, sizeof(new_amd->spectral_sum));
+	new_amd->spectral_frames = 0;
+	new_amd->classifier = NULL;
+	new_amd->classifier_min_ms = 0;
+	new_amd->classifier_max_ms = 0;
+	samd_classifier_state_reset(&new_amd->classifier_state);
+	new_amd->classifier_asked = 0;
+	new_amd->have_classifier_features = 0;
+	samd_fingerprinter_reset(&new_amd->fingerprinter, 0, 0);
+
+	samd_metrics_add(SAMD_METRIC_ACTIVE_DETECTORS, 1);
 
 	/* set detection defaults */
 	samd_set_wait_for_voice_ms(new_amd, 2000); /* wait 2 seconds for start of speech */
@@ -308,6 +944,8 @@ void samd_destroy(samd_t **amd)
 	if (amd && *amd) {
 		samd_t *a = *amd;
 		samd_log_printf(a, SAMD_LOG_DEBUG, "%d: DESTROY AMD\n", a->time_ms);
+		amd_stats_flush(a);
+		samd_metrics_add(SAMD_METRIC_ACTIVE_DETECTORS, -1);
 		if (a->analyzer) {
 			samd_frame_analyzer_destroy(&a->analyzer);
 		}
@@ -317,6 +955,7 @@ void samd_destroy(samd_t **amd)
 		if (a->vad) {
 			samd_vad_destroy(&a->vad);
 		}
+		free(a->recorder);
 		free(a);
 		*amd = NULL;
 	}
@@ -331,6 +970,9 @@ const char *samd_event_to_string(samd_event_t event)
 		case SAMD_MACHINE_BEEP: return "AMD MACHINE BEEP";
 		case SAMD_HUMAN_VOICE: return "AMD HUMAN VOICE";
 		case SAMD_HUMAN_SILENCE: return "AMD HUMAN SILENCE";
+		case SAMD_LIKELY_HUMAN: return "AMD LIKELY HUMAN";
+		case SAMD_LIKELY_MACHINE: return "AMD LIKELY MACHINE";
+		case SAMD_MACHINE_FINGERPRINT: return "AMD MACHINE FINGERPRINT";
 	}
 	return "";
 }
@@ -340,6 +982,16 @@ void samd_set_sample_rate(samd_t *amd, uint32_t sample_rate)
 	samd_frame_analyzer_set_sample_rate(amd->analyzer, sample_rate);
 }
 
+/**
+ * Set the duration of each analysis frame.  VAD, beep and AMD timing scale with the frame duration.
+ * @param amd
+ * @param ms 5, 10 (default), 20 or 40
+ */
+void samd_set_frame_ms(samd_t *amd, uint32_t ms)
+{
+	samd_frame_analyzer_set_frame_ms(amd->analyzer, ms);
+}
+
 samd_vad_t *samd_get_vad(samd_t *amd)
 {
 	return amd->vad;
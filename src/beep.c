@@ -5,6 +5,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "samd_private.h"
 
@@ -63,6 +64,16 @@ void samd_beep_set_sample_rate(samd_beep_t *beep, uint32_t sample_rate)
 	samd_frame_analyzer_set_sample_rate(beep->analyzer, sample_rate);
 }
 
+/**
+ * Set the duration of each analysis frame
+ * @param beep
+ * @param ms 5, 10 (default), 20 or 40
+ */
+void samd_beep_set_frame_ms(samd_beep_t *beep, uint32_t ms)
+{
+	samd_frame_analyzer_set_frame_ms(beep->analyzer, ms);
+}
+
 static void beep_reset(samd_beep_t *beep)
 {
 	beep->start_time = 0;
@@ -103,6 +114,8 @@ static void beep_state_wait_for_start(samd_beep_t *beep, uint32_t time_ms, doubl
 		beep->min_energy = energy;
 		beep->start_time = time_ms;
 		process_zero_crossings(beep, zero_crossings);
+		SAMD_PROBE4(beep_start, beep, time_ms, (uint32_t)energy, zero_crossings);
+		beep->candidates++;
 		beep->state = beep_state_collect;
 	} else {
 		samd_log_printf(beep, SAMD_LOG_DEBUG, "%d: (wait for start) energy = %f, zero crossings = %d\n", time_ms, energy, zero_crossings);
@@ -159,6 +172,8 @@ static void beep_state_collect(samd_beep_t *beep, uint32_t time_ms, double energ
 			beep->state = beep_state_wait_for_end;
 			beep->start_time = time_ms; /* start counting time from here */
 		} else {
+			SAMD_PROBE4(beep_end, beep, time_ms, 0, duration);
+			beep->rejected++;
 			beep_reset(beep);
 			beep->state = beep_state_wait_for_start;
 		}
@@ -171,6 +186,8 @@ static void beep_state_wait_for_end(samd_beep_t *beep, uint32_t time_ms, double
 	if (energy < beep->min_energy * 0.6 || energy < 200) {
 		if (time_ms - beep->start_time >= 200) {
 			samd_log_printf(beep, SAMD_LOG_INFO, "%d: (end) BEEP DETECTED\n", time_ms);
+			SAMD_PROBE4(beep_end, beep, time_ms, 1, time_ms - beep->start_time);
+			beep->accepted++;
 			beep->event_handler(time_ms, beep->user_event_data);
 			beep_reset(beep);
 			beep->state = beep_state_done;
@@ -181,6 +198,8 @@ static void beep_state_wait_for_end(samd_beep_t *beep, uint32_t time_ms, double
 	} else {
 		/* not a beep */
 		samd_log_printf(beep, SAMD_LOG_INFO, "%d: (end) NOT A BEEP, energy = %f\n", time_ms, energy);
+		SAMD_PROBE4(beep_end, beep, time_ms, 0, time_ms - beep->start_time);
+		beep->rejected++;
 		beep_reset(beep);
 		beep->state = beep_state_wait_for_start;
 	}
@@ -191,17 +210,79 @@ static void beep_state_done(samd_beep_t *beep, uint32_t time_ms, double energy,
 }
 
 /**
- * Handle the next frame of processed audio
+ * Handle the next frame of processed audio.  Subscribe to a shared frame analyzer with this function
+ * to run this beep detector on audio already being analyzed for other detectors.
  * @param analzyer the frame analyzer
  * @param user_data this beep detector
  */
 void samd_beep_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
 {
 	samd_beep_t *beep = (samd_beep_t *)user_data;
+	uint32_t frame_ms = analyzer->frame_ms;
 	beep->time_ms = time_ms;
+
+	/* beep frequencies are matched by zero crossings per BEEP_MS_PER_FRAME */
+	if (frame_ms < BEEP_MS_PER_FRAME) {
+		/* combine short frames */
+		beep->window_energy += energy;
+		beep->window_zero_crossings += zero_crossings;
+		beep->window_frames++;
+		beep->window_ms += frame_ms;
+		if (beep->window_ms < BEEP_MS_PER_FRAME) {
+			return;
+		}
+		energy = beep->window_energy / beep->window_frames;
+		zero_crossings = beep->window_zero_crossings;
+		beep->window_energy = 0.0;
+		beep->window_zero_crossings = 0;
+		beep->window_frames = 0;
+		beep->window_ms = 0;
+	} else if (frame_ms > BEEP_MS_PER_FRAME) {
+		/* scale long frames */
+		zero_crossings = (zero_crossings * BEEP_MS_PER_FRAME + frame_ms / 2) / frame_ms;
+	}
+
 	beep->state(beep, time_ms, energy, zero_crossings);
 }
 
+/**
+ * Add beep candidate counts to stats
+ * @param beep
+ * @param stats
+ */
+void samd_beep_add_stats(samd_beep_t *beep, samd_stats_t *stats)
+{
+	stats->beep_candidates += beep->candidates;
+	stats->beep_rejected += beep->rejected;
+	stats->beep_accepted += beep->accepted;
+}
+
+/**
+ * Get the counters of this beep detector.  Frames, samples and average energy are from the
+ * detector's own frame analyzer, so they are 0 if frames are from a shared analyzer.
+ * @param beep
+ * @param stats (output)
+ */
+void samd_beep_get_stats(samd_beep_t *beep, samd_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (beep->analyzer) {
+		samd_frame_analyzer_add_stats(beep->analyzer, stats);
+	}
+	samd_beep_add_stats(beep, stats);
+}
+
+/**
+ * Add new counts of a standalone beep detector to the global stats
+ * @param beep
+ */
+static void beep_stats_flush(samd_beep_t *beep)
+{
+	samd_stats_t stats;
+	samd_beep_get_stats(beep, &stats);
+	samd_stats_flush(&stats, &beep->flushed_stats);
+}
+
 /**
  * Process the next buffer of samples
  * @param vad
@@ -212,6 +293,32 @@ void samd_beep_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, u
 void samd_beep_process_buffer(samd_beep_t *beep, int16_t *samples, uint32_t num_samples, uint32_t channels)
 {
 	samd_frame_analyzer_process_buffer(beep->analyzer, samples, num_samples, channels);
+	beep_stats_flush(beep);
+}
+
+/**
+ * Advance through a gap in the audio without buffers of silence, see samd_frame_analyzer_process_gap()
+ * @param beep
+ * @param ms duration of the gap
+ * @param energy average absolute sample value to treat the gap as
+ */
+void samd_beep_process_gap(samd_beep_t *beep, uint32_t ms, double energy)
+{
+	samd_frame_analyzer_process_gap(beep->analyzer, ms, energy);
+	beep_stats_flush(beep);
+}
+
+/**
+ * Process the next frame of features computed by the caller, bypassing sample analysis
+ * @param beep
+ * @param time_ms end time of this frame, relative to start of detection
+ * @param energy average absolute sample value in the frame, normalized to 8000 Hz
+ * @param zero_crossings number of negative to positive zero crossings in the frame
+ */
+void samd_beep_process_frame_features(samd_beep_t *beep, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	samd_frame_analyzer_process_frame_features(beep->analyzer, time_ms, energy, zero_crossings);
+	beep_stats_flush(beep);
 }
 
 /**
@@ -229,6 +336,14 @@ void samd_beep_init_internal(samd_beep_t **beep)
 	new_beep->time_ms = 0;
 	new_beep->analyzer = NULL;
 	new_beep->state = beep_state_wait_for_start;
+	new_beep->window_energy = 0.0;
+	new_beep->window_zero_crossings = 0;
+	new_beep->window_frames = 0;
+	new_beep->window_ms = 0;
+	new_beep->candidates = 0;
+	new_beep->rejected = 0;
+	new_beep->accepted = 0;
+	memset(&new_beep->flushed_stats, 0, sizeof(new_beep->flushed_stats));
 	beep_reset(new_beep);
 
 	*beep = new_beep;
@@ -246,7 +361,7 @@ void samd_beep_init(samd_beep_t **beep)
 	samd_beep_t *new_beep;
 	samd_beep_init_internal(&new_beep);
 	samd_frame_analyzer_init(&new_beep->analyzer);
-	samd_frame_analyzer_set_callback(new_beep->analyzer, samd_beep_process_frame, new_beep);
+	samd_frame_analyzer_subscribe(new_beep->analyzer, samd_beep_process_frame, new_beep);
 	*beep = new_beep;
 }
 
@@ -260,6 +375,8 @@ void samd_beep_destroy(samd_beep_t **beep)
 		samd_frame_analyzer_t *analyzer = (*beep)->analyzer;
 		samd_log_printf((*beep), SAMD_LOG_DEBUG, "%d: DESTROY BEEP\n", (*beep)->time_ms);
 		if (analyzer) {
+			/* counts of a beep detector inside an AMD are flushed by the AMD */
+			beep_stats_flush(*beep);
 			samd_frame_analyzer_destroy(&analyzer);
 		}
 		free(*beep);
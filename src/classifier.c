@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * Logistic regression for ambiguous calls.  Features summarize the voice heard since detection
+ * began and are updated every frame in constant time, so asking the model costs a dot product.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "samd_classifier.h"
+#include "samd_private.h"
+
+/* the default model, generated by samd_classifier_write() */
+#include "classifier_model.h"
+
+/** gradient descent passes over the training set */
+#define TRAIN_ITERATIONS 4000
+
+/** gradient descent step */
+#define TRAIN_RATE 0.2
+
+/** L2 penalty on weights */
+#define TRAIN_L2 0.001
+
+/** labeled features */
+struct samd_classifier_trainer {
+	double *features;
+	int *machine;
+	uint32_t num_samples;
+	uint32_t max_samples;
+};
+
+static const char *feature_names[SAMD_CLASSIFIER_FEATURES] = {
+	"voice_s",
+	"utterances",
+	"first_utterance_s",
+	"longest_pause_s",
+	"pause_fraction",
+	"energy_cv",
+	"zero_crossings",
+	"zero_crossings_sd"
+};
+
+/**
+ * @return the model compiled into the library
+ */
+const samd_classifier_model_t *samd_classifier_get_default_model(void)
+{
+	return &samd_classifier_model;
+}
+
+/**
+ * @param feature
+ * @return name of the feature, "" if invalid
+ */
+const char *samd_classifier_feature_name(int feature)
+{
+	if (feature < 0 || feature >= SAMD_CLASSIFIER_FEATURES) {
+		return "";
+	}
+	return feature_names[feature];
+}
+
+/**
+ * @param model
+ * @param features SAMD_CLASSIFIER_FEATURES values
+ * @return probability the call is a machine
+ */
+double samd_classifier_predict(const samd_classifier_model_t *model, const double *features)
+{
+	double z = model->bias;
+	int i;
+	for (i = 0; i < SAMD_CLASSIFIER_FEATURES; i++) {
+		z += model->weights[i] * (features[i] - model->mean[i]) / model->scale[i];
+	}
+	return 1.0 / (1.0 + exp(-z));
+}
+
+/**
+ * Forget all voice heard
+ * @param state
+ */
+void samd_classifier_state_reset(samd_classifier_state_t *state)
+{
+	memset(state, 0, sizeof(*state));
+}
+
+/**
+ * Add a frame.  Frames before the first voice frame are ignored.
+ * @param state
+ * @param frame_ms
+ * @param energy
+ * @param zero_crossings
+ * @param in_voice true if the VAD heard voice in this frame
+ */
+void samd_classifier_state_frame(samd_classifier_state_t *state, uint32_t frame_ms, double energy, uint32_t zero_crossings, int in_voice)
+{
+	double zc;
+
+	if (!state->frames && !in_voice) {
+		return;
+	}
+	state->frame_ms = frame_ms;
+	state->frames++;
+	if (!in_voice) {
+		state->silence_frames++;
+		return;
+	}
+
+	if (!state->utterances) {
+		state->utterances = 1;
+	} else if (state->silence_frames * frame_ms >= CLASSIFIER_PAUSE_MS) {
+		if (state->utterances == 1) {
+			state->first_utterance_frames = state->last_voice_frame;
+		}
+		if (state->silence_frames > state->longest_pause_frames) {
+			state->longest_pause_frames = state->silence_frames;
+		}
+		state->utterances++;
+	}
+	state->silence_frames = 0;
+	state->voice_frames++;
+	state->last_voice_frame = state->frames;
+
+	/* zero crossings per 10 ms, so frame duration doesn't matter */
+	zc = zero_crossings * 10.0 / frame_ms;
+	state->energy_sum += energy;
+	state->energy_squares += energy * energy;
+	state->zero_crossings_sum += zc;
+	state->zero_crossings_squares += zc * zc;
+}
+
+/**
+ * @param sum
+ * @param squares
+ * @param n
+ * @return standard deviation
+ */
+static double standard_deviation(double sum, double squares, uint32_t n)
+{
+	double mean = sum / n;
+	double variance = squares / n - mean * mean;
+	return variance > 0.0 ? sqrt(variance) : 0.0;
+}
+
+/**
+ * Compute the features of the voice heard so far
+ * @param state
+ * @param features (output) SAMD_CLASSIFIER_FEATURES values, all 0 if no voice
+ */
+void samd_classifier_state_features(const samd_classifier_state_t *state, double *features)
+{
+	double s = state->frame_ms / 1000.0;
+	uint32_t n = state->voice_frames;
+
+	memset(features, 0, sizeof(double) * SAMD_CLASSIFIER_FEATURES);
+	if (!n) {
+		return;
+	}
+	features[SAMD_CLASSIFIER_VOICE_S] = n * s;
+	features[SAMD_CLASSIFIER_UTTERANCES] = state->utterances;
+	features[SAMD_CLASSIFIER_FIRST_UTTERANCE_S] = (state->utterances == 1 ? state->last_voice_frame : state->first_utterance_frames) * s;
+	features[SAMD_CLASSIFIER_LONGEST_PAUSE_S] = state->longest_pause_frames * s;
+	features[SAMD_CLASSIFIER_PAUSE_FRACTION] = (double)(state->last_voice_frame - n) / state->last_voice_frame;
+	if (state->energy_sum > 0.0) {
+		features[SAMD_CLASSIFIER_ENERGY_CV] = standard_deviation(state->energy_sum, state->energy_squares, n) / (state->energy_sum / n);
+	}
+	features[SAMD_CLASSIFIER_ZERO_CROSSINGS] = state->zero_crossings_sum / n;
+	features[SAMD_CLASSIFIER_ZERO_CROSSINGS_SD] = standard_deviation(state->zero_crossings_sum, state->zero_crossings_squares, n);
+}
+
+/**
+ * Create a trainer
+ * @param trainer (output) - free with samd_classifier_trainer_destroy()
+ */
+void samd_classifier_trainer_init(samd_classifier_trainer_t **trainer)
+{
+	*trainer = (samd_classifier_trainer_t *)calloc(1, sizeof(**trainer));
+}
+
+/**
+ * Add a labeled call
+ * @param trainer
+ * @param features SAMD_CLASSIFIER_FEATURES values, from samd_get_classifier_features()
+ * @param machine true if the call is a machine
+ * @return 0 on success, -1 if out of memory
+ */
+int samd_classifier_trainer_add(samd_classifier_trainer_t *trainer, const double *features, int machine)
+{
+	if (trainer->num_samples == trainer->max_samples) {
+		uint32_t max_samples = trainer->max_samples ? trainer->max_samples * 2 : 64;
+		double *new_features = (double *)realloc(trainer->features, sizeof(double) * SAMD_CLASSIFIER_FEATURES * max_samples);
+		int *new_machine;
+		if (!new_features) {
+			return -1;
+		}
+		trainer->features = new_features;
+		new_machine = (int *)realloc(trainer->machine, sizeof(int) * max_samples);
+		if (!new_machine) {
+			return -1;
+		}
+		trainer->machine = new_machine;
+		trainer->max_samples = max_samples;
+	}
+	memcpy(trainer->features + trainer->num_samples * SAMD_CLASSIFIER_FEATURES, features, sizeof(double) * SAMD_CLASSIFIER_FEATURES);
+	trainer->machine[trainer->num_samples++] = machine != 0;
+	return 0;
+}
+
+/**
+ * Fit a model to the calls added.  Features are standardized, and humans and machines weighted
+ * equally however many of each there are.  The result is deterministic.
+ * @param trainer
+ * @param model (output)
+ * @return 0 on success, -1 unless there is at least one human and one machine
+ */
+int samd_classifier_trainer_fit(samd_classifier_trainer_t *trainer, samd_classifier_model_t *model)
+{
+	double class_weight[2] = { 0.0, 0.0 };
+	uint32_t n = trainer->num_samples;
+	uint32_t i, iteration;
+	int f;
+
+	for (i = 0; i < n; i++) {
+		class_weight[trainer->machine[i]]++;
+	}
+	if (!class_weight[0] || !class_weight[1]) {
+		return -1;
+	}
+	class_weight[0] = n / (2.0 * class_weight[0]);
+	class_weight[1] = n / (2.0 * class_weight[1]);
+
+	memset(model, 0, sizeof(*model));
+	for (f = 0; f < SAMD_CLASSIFIER_FEATURES; f++) {
+		double sum = 0.0, squares = 0.0;
+		for (i = 0; i < n; i++) {
+			double x = trainer->features[i * SAMD_CLASSIFIER_FEATURES + f];
+			sum += x;
+			squares += x * x;
+		}
+		model->mean[f] = sum / n;
+		model->scale[f] = standard_deviation(sum, squares, n);
+		if (model->scale[f] < 1e-9) {
+			/* constant feature */
+			model->scale[f] = 1.0;
+		}
+	}
+
+	for (iteration = 0; iteration < TRAIN_ITERATIONS; iteration++) {
+		double gradient[SAMD_CLASSIFIER_FEATURES] = { 0.0 };
+		double bias_gradient = 0.0;
+		for (i = 0; i < n; i++) {
+			const double *x = trainer->features + i * SAMD_CLASSIFIER_FEATURES;
+			double error = (samd_classifier_predict(model, x) - trainer->machine[i]) * class_weight[trainer->machine[i]];
+			for (f = 0; f < SAMD_CLASSIFIER_FEATURES; f++) {
+				gradient[f] += error * (x[f] - model->mean[f]) / model->scale[f];
+			}
+			bias_gradient += error;
+		}
+		for (f = 0; f < SAMD_CLASSIFIER_FEATURES; f++) {
+			model->weights[f] -= TRAIN_RATE * (gradient[f] / n + TRAIN_L2 * model->weights[f]);
+		}
+		model->bias -= TRAIN_RATE * bias_gradient / n;
+	}
+	return 0;
+}
+
+/**
+ * @param out
+ * @param label
+ * @param values SAMD_CLASSIFIER_FEATURES values
+ */
+static void write_values(FILE *out, const char *label, const double *values)
+{
+	int f;
+	fprintf(out, "\t/* %s */\n\t{", label);
+	for (f = 0; f < SAMD_CLASSIFIER_FEATURES; f++) {
+		fprintf(out, "%s%.17g", f ? ", " : " ", values[f]);
+	}
+	fprintf(out, " },\n");
+}
+
+/**
+ * Write a model as a C header defining a constant samd_classifier_model_t.  Include it after
+ * samd_classifier.h and pass the model to samd_set_classifier().
+ * @param model
+ * @param path of the header, replaced atomically
+ * @param name of the variable to define
+ * @return 0 on success, -1 on failure
+ */
+int samd_classifier_write(const samd_classifier_model_t *model, const char *path, const char *name)
+{
+	char tmp_path[1024];
+	FILE *out;
+	int f;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	if (!(out = fopen(tmp_path, "w"))) {
+		return -1;
+	}
+	fprintf(out, "/* Generated by samd_classifier_write(), do not edit.  Features:");
+	for (f = 0; f < SAMD_CLASSIFIER_FEATURES; f++) {
+		fprintf(out, " %s", feature_names[f]);
+	}
+	fprintf(out, " */\n\nstatic const samd_classifier_model_t %s = {\n", name);
+	write_values(out, "mean", model->mean);
+	write_values(out, "scale", model->scale);
+	write_values(out, "weights", model->weights);
+	fprintf(out, "\t/* bias */\n\t%.17g\n};\n", model->bias);
+	if (fclose(out) || rename(tmp_path, path)) {
+		remove(tmp_path);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Destroy a trainer
+ * @param trainer
+ */
+void samd_classifier_trainer_destroy(samd_classifier_trainer_t **trainer)
+{
+	if (trainer && *trainer) {
+		free((*trainer)->features);
+		free((*trainer)->machine);
+		free(*trainer);
+		*trainer = NULL;
+	}
+}
@@ -0,0 +1,12 @@
+/* Generated by samd_classifier_write(), do not edit.  Features: voice_s utterances first_utterance_s longest_pause_s pause_fraction energy_cv zero_crossings zero_crossings_sd */
+
+static const samd_classifier_model_t samd_classifier_model = {
+	/* mean */
+	{ 0.91333333333333322, 1.9166666666666667, 0.56149999999999989, 0.17583333333333329, 0.1581880999678523, 0.38210289248690271, 4.6500964681738983, 3.3505979064156333 },
+	/* scale */
+	{ 0.2603597937897143, 0.64009547898905006, 0.19597895295158643, 0.12337330433372619, 0.11075371743763508, 0.057619121797330315, 1.6570956959195682, 0.7609644217924596 },
+	/* weights */
+	{ 0.68986004108320242, 0.28336255452645531, 1.4856094533047852, 1.7550992627192818, 1.1970145193530484, -2.222164691061427, -3.4654192568292856, 0.4695289746855601 },
+	/* bias */
+	-1.2395705226832874
+};
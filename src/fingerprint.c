@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * Greeting fingerprints: computing words from frame features, building an index of known
+ * greetings, and matching a call's words against it.  The index is mapped read only, so one copy
+ * is shared by every AMD and process using it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "samd_fingerprint.h"
+#include "samd_private.h"
+
+/** bits of each feature in a word */
+#define FINGERPRINT_WORD_MASK ((1u << SAMD_FINGERPRINT_WORD_STEPS) - 1)
+
+/** steps of voice needed in a word's window, so silence and noise aren't fingerprinted */
+#define FINGERPRINT_MIN_VOICE_STEPS 9
+
+/** hits on a greeting at a consistent offset needed for a match */
+#define FINGERPRINT_MATCH_HITS 4
+
+/** steps without a hit before a candidate starts over */
+#define FINGERPRINT_STALE_STEPS 25
+
+/** words in more index entries than this don't tell greetings apart and are left out */
+#define FINGERPRINT_MAX_WORD_ENTRIES 8
+
+/** frame duration greetings are analyzed with when building */
+#define FINGERPRINT_BUILD_FRAME_MS 10
+
+/** process's handle to an index */
+struct samd_fingerprint_index {
+	const samd_fingerprint_header_t *header;
+	const char *names;
+	const samd_fingerprint_entry_t *entries;
+	size_t size;
+};
+
+/** greetings being fingerprinted for an index */
+struct samd_fingerprint_builder {
+	uint32_t sample_rate;
+	char *names;
+	uint32_t num_greetings;
+	samd_fingerprint_entry_t *entries;
+	uint32_t num_entries;
+	uint32_t max_entries;
+
+	/** state of the greeting being added */
+	samd_vad_t *vad;
+	uint64_t voice_frames;
+	samd_fingerprinter_t fingerprinter;
+};
+
+/**
+ * Start a new fingerprint
+ * @param fingerprinter
+ * @param step_ms duration of each step
+ * @param frame_ms duration of frames.  Must divide step_ms, or step_frames is 0 and no words are
+ *        computed.  Callers check step_frames to catch that.
+ */
+void samd_fingerprinter_reset(samd_fingerprinter_t *fingerprinter, uint32_t step_ms, uint32_t frame_ms)
+{
+	uint32_t i;
+	memset(fingerprinter, 0, sizeof(*fingerprinter));
+	fingerprinter->step_ms = step_ms;
+	fingerprinter->step_frames = frame_ms && frame_ms <= step_ms && step_ms % frame_ms == 0 ? step_ms / frame_ms : 0;
+	for (i = 0; i < FINGERPRINT_CANDIDATES; i++) {
+		fingerprinter->candidates[i].greeting = -1;
+	}
+	fingerprinter->match = -1;
+}
+
+/**
+ * Add the next frame's features
+ * @param fingerprinter
+ * @param energy
+ * @param zero_crossings
+ * @param in_voice true if the VAD classified the frame as voice
+ * @param word (output) the new word
+ * @return 1 if this frame completed a word
+ */
+int samd_fingerprinter_process_frame(samd_fingerprinter_t *fingerprinter, double energy, uint32_t zero_crossings, int in_voice, uint32_t *word)
+{
+	if (!fingerprinter->step_frames) {
+		return 0;
+	}
+	fingerprinter->energy += energy;
+	fingerprinter->zero_crossings += zero_crossings;
+	fingerprinter->voice_frames += in_voice ? 1 : 0;
+	if (++fingerprinter->frames < fingerprinter->step_frames) {
+		return 0;
+	}
+
+	/* only the direction each feature moved is kept */
+	fingerprinter->energy_bits = (fingerprinter->energy_bits << 1) | (fingerprinter->energy > fingerprinter->last_energy);
+	fingerprinter->zero_crossing_bits = (fingerprinter->zero_crossing_bits << 1) | (fingerprinter->zero_crossings > fingerprinter->last_zero_crossings);
+	fingerprinter->voice_bits = (fingerprinter->voice_bits << 1) | (fingerprinter->voice_frames * 2 > fingerprinter->frames);
+	fingerprinter->last_energy = fingerprinter->energy;
+	fingerprinter->last_zero_crossings = fingerprinter->zero_crossings;
+	fingerprinter->energy = 0.0;
+	fingerprinter->zero_crossings = 0;
+	fingerprinter->voice_frames = 0;
+	fingerprinter->frames = 0;
+	fingerprinter->steps++;
+
+	/* the first step has nothing to compare with */
+	if (fingerprinter->steps <= SAMD_FINGERPRINT_WORD_STEPS || __builtin_popcount(fingerprinter->voice_bits & FINGERPRINT_WORD_MASK) < FINGERPRINT_MIN_VOICE_STEPS) {
+		return 0;
+	}
+	*word = ((fingerprinter->energy_bits & FINGERPRINT_WORD_MASK) << SAMD_FINGERPRINT_WORD_STEPS) | (fingerprinter->zero_crossing_bits & FINGERPRINT_WORD_MASK);
+	return 1;
+}
+
+/**
+ * Open an index built by samd_fingerprint_builder_write()
+ * @param index the index (output)
+ * @param path of the file
+ * @return 0 on success, -1 on failure
+ */
+int samd_fingerprint_index_open(samd_fingerprint_index_t **index, const char *path)
+{
+	samd_fingerprint_index_t *new_index;
+	const samd_fingerprint_header_t *header;
+	struct stat st;
+	void *mem;
+	int fd;
+
+	*index = NULL;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return -1;
+	}
+	mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		return -1;
+	}
+	header = (const samd_fingerprint_header_t *)mem;
+	if (header->magic != SAMD_FINGERPRINT_MAGIC || header->version != SAMD_FINGERPRINT_VERSION || header->step_ms == 0 ||
+		(size_t)st.st_size < sizeof(*header) + (size_t)header->num_greetings * SAMD_FINGERPRINT_NAME_LEN + (size_t)header->num_entries * sizeof(samd_fingerprint_entry_t)) {
+		munmap(mem, st.st_size);
+		return -1;
+	}
+
+	new_index = (samd_fingerprint_index_t *)calloc(1, sizeof(*new_index));
+	if (!new_index) {
+		munmap(mem, st.st_size);
+		return -1;
+	}
+	new_index->header = header;
+	new_index->names = (const char *)(header + 1);
+	new_index->entries = (const samd_fingerprint_entry_t *)(new_index->names + (size_t)header->num_greetings * SAMD_FINGERPRINT_NAME_LEN);
+	new_index->size = st.st_size;
+	*index = new_index;
+	return 0;
+}
+
+/**
+ * @param index
+ * @return number of greetings in the index
+ */
+uint32_t samd_fingerprint_index_get_num_greetings(samd_fingerprint_index_t *index)
+{
+	return index->header->num_greetings;
+}
+
+/**
+ * @return step duration words in the index were computed with
+ */
+uint32_t samd_fingerprint_index_get_step_ms(samd_fingerprint_index_t *index)
+{
+	return index->header->step_ms;
+}
+
+/**
+ * @return name of greeting
+ */
+const char *samd_fingerprint_index_get_name(samd_fingerprint_index_t *index, int32_t greeting)
+{
+	if (greeting < 0 || (uint32_t)greeting >= index->header->num_greetings) {
+		return NULL;
+	}
+	return index->names + (size_t)greeting * SAMD_FINGERPRINT_NAME_LEN;
+}
+
+/**
+ * Count hits of a call's word on the greetings that have it
+ * @param index
+ * @param fingerprinter of the call
+ * @param word just computed
+ * @return the greeting matched, or -1 if none yet
+ */
+int32_t samd_fingerprint_index_match(samd_fingerprint_index_t *index, samd_fingerprinter_t *fingerprinter, uint32_t word)
+{
+	const samd_fingerprint_entry_t *entries = index->entries;
+	uint32_t low = 0;
+	uint32_t high = index->header->num_entries;
+	uint32_t steps = fingerprinter->steps;
+
+	/* first entry of word */
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		if (entries[mid].word < word) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	for (; low < index->header->num_entries && entries[low].word == word; low++) {
+		int32_t offset = (int32_t)steps - entries[low].step;
+		samd_fingerprint_candidate_t *candidate = NULL;
+		uint32_t i;
+
+		for (i = 0; i < FINGERPRINT_CANDIDATES; i++) {
+			samd_fingerprint_candidate_t *c = &fingerprinter->candidates[i];
+			if (c->greeting == entries[low].greeting && abs(offset - c->offset) <= 1 && steps - c->last_step <= FINGERPRINT_STALE_STEPS) {
+				candidate = c;
+				break;
+			}
+		}
+		if (!candidate) {
+			/* replace the unused or least recently hit candidate */
+			candidate = &fingerprinter->candidates[0];
+			for (i = 1; i < FINGERPRINT_CANDIDATES && candidate->greeting >= 0; i++) {
+				if (fingerprinter->candidates[i].greeting < 0 || fingerprinter->candidates[i].last_step < candidate->last_step) {
+					candidate = &fingerprinter->candidates[i];
+				}
+			}
+			candidate->greeting = entries[low].greeting;
+			candidate->offset = offset;
+			candidate->hits = 0;
+			candidate->last_step = 0;
+		}
+		/* the offset stays where the first hit put it, so speech at another pace doesn't drift into a match */
+		if (candidate->hits == 0 || candidate->last_step != steps) {
+			candidate->hits++;
+			candidate->last_step = steps;
+		}
+		if (candidate->hits >= FINGERPRINT_MATCH_HITS) {
+			fingerprinter->match = candidate->greeting;
+			return candidate->greeting;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Close index.  AMDs using it must be destroyed first.
+ * @param index
+ */
+void samd_fingerprint_index_close(samd_fingerprint_index_t **index)
+{
+	if (index && *index) {
+		munmap((void *)(*index)->header, (*index)->size);
+		free(*index);
+		*index = NULL;
+	}
+}
+
+/**
+ * Create a builder for a new index
+ * @param builder (output)
+ * @param sample_rate of the recordings to add
+ */
+void samd_fingerprint_builder_init(samd_fingerprint_builder_t **builder, uint32_t sample_rate)
+{
+	samd_fingerprint_builder_t *new_builder = (samd_fingerprint_builder_t *)calloc(1, sizeof(*new_builder));
+	new_builder->sample_rate = sample_rate;
+	*builder = new_builder;
+}
+
+/**
+ * Fingerprint a frame of the greeting being added
+ * @param analyzer the VAD's analyzer
+ * @param user_data the builder
+ */
+static void builder_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	samd_fingerprint_builder_t *builder = (samd_fingerprint_builder_t *)user_data;
+	int in_voice = builder->vad->voice_frames != builder->voice_frames;
+	uint32_t word;
+
+	(void)analyzer;
+	(void)time_ms;
+	builder->voice_frames = builder->vad->voice_frames;
+	if (!samd_fingerprinter_process_frame(&builder->fingerprinter, energy, zero_crossings, in_voice, &word) || builder->fingerprinter.steps > UINT16_MAX) {
+		return;
+	}
+	if (builder->num_entries == builder->max_entries) {
+		uint32_t max_entries = builder->max_entries ? builder->max_entries * 2 : 4096;
+		samd_fingerprint_entry_t *entries = (samd_fingerprint_entry_t *)realloc(builder->entries, sizeof(*entries) * max_entries);
+		if (!entries) {
+			return;
+		}
+		builder->entries = entries;
+		builder->max_entries = max_entries;
+	}
+	builder->entries[builder->num_entries].word = word;
+	builder->entries[builder->num_entries].greeting = builder->num_greetings;
+	builder->entries[builder->num_entries].step = builder->fingerprinter.steps;
+	builder->num_entries++;
+}
+
+/**
+ * Add a recording of a greeting.  The recording is run through a VAD with default settings, as an
+ * AMD would see it.
+ * @param builder
+ * @param name reported on a match, truncated to SAMD_FINGERPRINT_NAME_LEN - 1
+ * @param samples the recording
+ * @param num_samples
+ * @param channels
+ * @return 0 on success, -1 if the index is full
+ */
+int samd_fingerprint_builder_add(samd_fingerprint_builder_t *builder, const char *name, int16_t *samples, uint32_t num_samples, uint32_t channels)
+{
+	char *names;
+
+	if (builder->num_greetings > UINT16_MAX) {
+		return -1;
+	}
+	names = (char *)realloc(builder->names, (size_t)(builder->num_greetings + 1) * SAMD_FINGERPRINT_NAME_LEN);
+	if (!names) {
+		return -1;
+	}
+	builder->names = names;
+	memset(names + (size_t)builder->num_greetings * SAMD_FINGERPRINT_NAME_LEN, 0, SAMD_FINGERPRINT_NAME_LEN);
+	strncpy(names + (size_t)builder->num_greetings * SAMD_FINGERPRINT_NAME_LEN, name, SAMD_FINGERPRINT_NAME_LEN - 1);
+
+	samd_vad_init(&builder->vad);
+	samd_vad_set_sample_rate(builder->vad, builder->sample_rate);
+	samd_vad_set_frame_ms(builder->vad, FINGERPRINT_BUILD_FRAME_MS);
+	samd_frame_analyzer_subscribe(builder->vad->analyzer, builder_process_frame, builder);
+	builder->voice_frames = 0;
+	samd_fingerprinter_reset(&builder->fingerprinter, SAMD_FINGERPRINT_STEP_MS, FINGERPRINT_BUILD_FRAME_MS);
+	samd_vad_process_buffer(builder->vad, samples, num_samples, channels);
+	samd_vad_destroy(&builder->vad);
+
+	builder->num_greetings++;
+	return 0;
+}
+
+/**
+ * Order entries by word, then greeting and step
+ */
+static int entry_compare(const void *a, const void *b)
+{
+	const samd_fingerprint_entry_t *x = (const samd_fingerprint_entry_t *)a;
+	const samd_fingerprint_entry_t *y = (const samd_fingerprint_entry_t *)b;
+	if (x->word != y->word) {
+		return x->word < y->word ? -1 : 1;
+	}
+	if (x->greeting != y->greeting) {
+		return x->greeting < y->greeting ? -1 : 1;
+	}
+	return x->step < y->step ? -1 : x->step > y->step;
+}
+
+/**
+ * Write the index of the greetings added.  The file is replaced atomically, so processes that
+ * have the old index open keep using it.
+ * @param builder
+ * @param path of the index
+ * @return 0 on success, -1 on failure
+ */
+int samd_fingerprint_builder_write(samd_fingerprint_builder_t *builder, const char *path)
+{
+	samd_fingerprint_header_t header = { 0 };
+	char tmp_path[4096];
+	uint32_t num_entries = 0;
+	uint32_t i, j;
+	FILE *file;
+	int failed;
+
+	/* drop words shared by too many entries, in place */
+	qsort(builder->entries, builder->num_entries, sizeof(samd_fingerprint_entry_t), entry_compare);
+	for (i = 0; i < builder->num_entries; i = j) {
+		for (j = i + 1; j < builder->num_entries && builder->entries[j].word == builder->entries[i].word; j++) {
+		}
+		if (j - i <= FINGERPRINT_MAX_WORD_ENTRIES) {
+			memmove(&builder->entries[num_entries], &builder->entries[i], sizeof(samd_fingerprint_entry_t) * (j - i));
+			num_entries += j - i;
+		}
+	}
+	builder->num_entries = num_entries;
+
+	header.magic = SAMD_FINGERPRINT_MAGIC;
+	header.version = SAMD_FINGERPRINT_VERSION;
+	header.step_ms = SAMD_FINGERPRINT_STEP_MS;
+	header.num_greetings = builder->num_greetings;
+	header.num_entries = num_entries;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	file = fopen(tmp_path, "wb");
+	if (!file) {
+		return -1;
+	}
+	failed = fwrite(&header, sizeof(header), 1, file) != 1 ||
+		(builder->num_greetings && fwrite(builder->names, SAMD_FINGERPRINT_NAME_LEN, builder->num_greetings, file) != builder->num_greetings) ||
+		(num_entries && fwrite(builder->entries, sizeof(samd_fingerprint_entry_t), num_entries, file) != num_entries);
+	failed |= fclose(file) != 0;
+	if (failed || rename(tmp_path, path) < 0) {
+		unlink(tmp_path);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Destroy builder
+ * @param builder
+ */
+void samd_fingerprint_builder_destroy(samd_fingerprint_builder_t **builder)
+{
+	if (builder && *builder) {
+		free((*builder)->names);
+		free((*builder)->entries);
+		free(*builder);
+		*builder = NULL;
+	}
+}
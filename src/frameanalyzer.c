@@ -5,12 +5,30 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "samd_private.h"
 
-#define SAMPLES_PER_FRAME_DIVISOR 100
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define INTERNAL_SAMPLE_RATE 8000
 
+/** max samples per channel deinterleaved at a time in split mode */
+#define BLOCK_SAMPLES 256
+
+
+/**
+ * Reset in progress frame calculations
+ * @param analyzer
+ */
+static void frame_reset(samd_frame_analyzer_t *analyzer)
+{
+	analyzer->samples = 0;
+	memset(analyzer->energy, 0, sizeof(analyzer->energy));
+	memset(analyzer->zero_crossings, 0, sizeof(analyzer->zero_crossings));
+}
 
 /**
  * Set the sample rate of the audio
@@ -19,17 +37,57 @@
  */
 void samd_frame_analyzer_set_sample_rate(samd_frame_analyzer_t *analyzer, uint32_t sample_rate)
 {
-	analyzer->samples_per_frame = sample_rate / SAMPLES_PER_FRAME_DIVISOR;
+	analyzer->sample_rate = sample_rate;
+	analyzer->samples_per_frame = sample_rate * analyzer->frame_ms / 1000;
 	analyzer->downsample_factor = sample_rate / INTERNAL_SAMPLE_RATE;
 	if (analyzer->downsample_factor < 1) {
 		analyzer->downsample_factor = 1;
 	}
 
 	/* reset in progress frame calculations */
-	analyzer->samples = 0;
-	analyzer->energy[0] = 0.0;
-	analyzer->energy[1] = 0.0;
-	analyzer->zero_crossings = 0;
+	frame_reset(analyzer);
+}
+
+/**
+ * Set the duration of each analysis frame.  Shorter frames detect voice onset sooner, longer
+ * frames cost less CPU per second of audio.
+ * @param analyzer
+ * @param ms 5, 10 (default), 20 or 40.  Other values are ignored.
+ */
+void samd_frame_analyzer_set_frame_ms(samd_frame_analyzer_t *analyzer, uint32_t ms)
+{
+	if (ms == 5 || ms == 10 || ms == 20 || ms == 40) {
+		analyzer->frame_ms = ms;
+		samd_frame_analyzer_set_sample_rate(analyzer, analyzer->sample_rate);
+	}
+}
+
+/**
+ * Set how multi-channel audio is analyzed.  In mixed mode (the default), channels are mixed together
+ * and every subscriber receives one frame.  In split mode, each channel (up to SAMD_MAX_CHANNELS) is
+ * analyzed separately and subscribers only receive frames from the channel they subscribed to.
+ * @param analyzer
+ * @param channel_mode
+ */
+void samd_frame_analyzer_set_channel_mode(samd_frame_analyzer_t *analyzer, samd_channel_mode_t channel_mode)
+{
+	analyzer->channel_mode = channel_mode;
+
+	/* reset in progress frame calculations */
+	frame_reset(analyzer);
+	memset(analyzer->last_sample, 0, sizeof(analyzer->last_sample));
+}
+
+/**
+ * Select how samples are analyzed.  All kernels produce identical frames; this exists to test
+ * and benchmark them against each other.
+ * @param analyzer
+ * @param kernel SAMD_KERNEL_AUTO (default) uses SIMD when available, SAMD_KERNEL_SCALAR never uses
+ * SIMD, and SAMD_KERNEL_REFERENCE analyzes mixed mode audio one sample at a time.
+ */
+void samd_frame_analyzer_set_kernel(samd_frame_analyzer_t *analyzer, samd_kernel_t kernel)
+{
+	analyzer->kernel = kernel;
 }
 
 /**
@@ -41,14 +99,22 @@ void samd_frame_analyzer_init(samd_frame_analyzer_t **analyzer)
 {
 	samd_frame_analyzer_t *new_analyzer = (samd_frame_analyzer_t *)malloc(sizeof(*new_analyzer));
 
-	new_analyzer->energy[0] = 0.0;
-	new_analyzer->energy[1] = 0.0;
-	new_analyzer->samples = 0;
 	new_analyzer->time_ms = 0;
-	new_analyzer->last_sample = 0;
-	new_analyzer->zero_crossings = 0;
-	new_analyzer->total_energy = 0.0;
-	new_analyzer->callback = NULL;
+	new_analyzer->frames = 0;
+	new_analyzer->total_samples = 0;
+	new_analyzer->channel = 0;
+	new_analyzer->channels = 1;
+	new_analyzer->buffer_start_sample = 0;
+	new_analyzer->buffer_offset = 0;
+	memset(new_analyzer->last_sample, 0, sizeof(new_analyzer->last_sample));
+	memset(new_analyzer->total_energy, 0, sizeof(new_analyzer->total_energy));
+	new_analyzer->subscribers = NULL;
+	new_analyzer->num_subscribers = 0;
+	new_analyzer->max_subscribers = 0;
+	new_analyzer->channel_mode = SAMD_CHANNEL_MODE_MIXED;
+	new_analyzer->kernel = SAMD_KERNEL_AUTO;
+	new_analyzer->frame_ms = DEFAULT_MS_PER_FRAME;
+	new_analyzer->spectral = NULL;
 
 	samd_frame_analyzer_set_sample_rate(new_analyzer, INTERNAL_SAMPLE_RATE);
 
@@ -56,14 +122,365 @@ void samd_frame_analyzer_init(samd_frame_analyzer_t **analyzer)
 }
 
 /**
- * Set event handler
- * @param vad
- * @param event_handler
+ * Keep recent audio for samd_frame_analyzer_get_spectral_features().  Off by default.  The FFT
+ * is only run for frames a subscriber asks for, so enabling this costs a copy of each sample.
+ * @param analyzer
+ * @param spectral true to enable
+ */
+void samd_frame_analyzer_set_spectral(samd_frame_analyzer_t *analyzer, int spectral)
+{
+	if (spectral && !analyzer->spectral) {
+		analyzer->spectral = samd_spectral_create();
+	} else if (!spectral && analyzer->spectral) {
+		free(analyzer->spectral);
+		analyzer->spectral = NULL;
+	}
+}
+
+/**
+ * Subscribe to frame data from one channel.  Any number of VADs, beep detectors, AMDs and user callbacks may subscribe
+ * to the same analyzer so each buffer of samples is only analyzed once.  Subscribers are called
+ * in the order they subscribed.  Do not subscribe or unsubscribe from within a callback.
+ * @param analyzer
+ * @param channel to receive in split channel mode.  Ignored in mixed mode.
+ * @param cb callback for each frame.  Use samd_vad_process_frame, samd_beep_process_frame or samd_process_frame to attach detectors.
+ * @param user_cb_data user data to send to callback
+ */
+void samd_frame_analyzer_subscribe_channel(samd_frame_analyzer_t *analyzer, uint32_t channel, samd_frame_analyzer_cb_fn cb, void *user_cb_data)
+{
+	if (analyzer->num_subscribers == analyzer->max_subscribers) {
+		analyzer->max_subscribers = analyzer->max_subscribers ? analyzer->max_subscribers * 2 : 2;
+		analyzer->subscribers = (samd_frame_analyzer_subscriber_t *)realloc(analyzer->subscribers, analyzer->max_subscribers * sizeof(*analyzer->subscribers));
+	}
+	analyzer->subscribers[analyzer->num_subscribers].callback = cb;
+	analyzer->subscribers[analyzer->num_subscribers].user_cb_data = user_cb_data;
+	analyzer->subscribers[analyzer->num_subscribers].channel = channel;
+	analyzer->num_subscribers++;
+}
+
+/**
+ * Subscribe to frame data from the first channel.  See samd_frame_analyzer_subscribe_channel()
+ * @param analyzer
+ * @param cb callback for each frame.  Use samd_vad_process_frame, samd_beep_process_frame or samd_process_frame to attach detectors.
+ * @param user_cb_data user data to send to callback
+ */
+void samd_frame_analyzer_subscribe(samd_frame_analyzer_t *analyzer, samd_frame_analyzer_cb_fn cb, void *user_cb_data)
+{
+	samd_frame_analyzer_subscribe_channel(analyzer, 0, cb, user_cb_data);
+}
+
+/**
+ * Remove subscription to frame data.  Detectors subscribed to an analyzer they don't own must be
+ * unsubscribed before they are destroyed.
+ * @param analyzer
+ * @param cb callback passed to samd_frame_analyzer_subscribe()
+ * @param user_cb_data user data passed to samd_frame_analyzer_subscribe()
+ */
+void samd_frame_analyzer_unsubscribe(samd_frame_analyzer_t *analyzer, samd_frame_analyzer_cb_fn cb, void *user_cb_data)
+{
+	uint32_t i;
+	for (i = 0; i < analyzer->num_subscribers; i++) {
+		if (analyzer->subscribers[i].callback == cb && analyzer->subscribers[i].user_cb_data == user_cb_data) {
+			analyzer->num_subscribers--;
+			for (; i < analyzer->num_subscribers; i++) {
+				analyzer->subscribers[i] = analyzer->subscribers[i + 1];
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * Send a frame to subscribers of the channel
+ * @param analyzer
+ * @param channel
+ * @param time_ms
+ * @param energy
+ * @param zero_crossings
+ */
+static void frame_dispatch(samd_frame_analyzer_t *analyzer, uint32_t channel, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	uint32_t i;
+	analyzer->channel = channel;
+	analyzer->total_energy[channel] += energy;
+	SAMD_PROBE5(frame, analyzer, channel, time_ms, (uint32_t)energy, zero_crossings);
+	for (i = 0; i < analyzer->num_subscribers; i++) {
+		if (analyzer->channel_mode == SAMD_CHANNEL_MODE_MIXED || analyzer->subscribers[i].channel == channel) {
+			analyzer->subscribers[i].callback(analyzer, analyzer->subscribers[i].user_cb_data, time_ms, energy, zero_crossings);
+		}
+	}
+	SAMD_PROBE3(frame_done, analyzer, channel, time_ms);
+	analyzer->channel = 0;
+}
+
+/**
+ * Process the next frame of features.  Used directly when the caller has already computed
+ * the frame features, bypassing sample analysis.  Features are sent to subscribers of the first channel.
+ * @param analyzer
+ * @param time_ms end time of this frame, relative to start of analysis
+ * @param energy average absolute sample value in the frame
+ * @param zero_crossings number of negative to positive zero crossings in the frame
+ */
+void samd_frame_analyzer_process_frame_features(samd_frame_analyzer_t *analyzer, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	/* position where the samples would have been */
+	analyzer->buffer_start_sample = (uint64_t)time_ms * analyzer->sample_rate / 1000;
+	analyzer->buffer_offset = 0;
+	analyzer->time_ms = time_ms;
+	analyzer->frames++;
+	frame_dispatch(analyzer, 0, time_ms, energy, zero_crossings);
+}
+
+/**
+ * Analyze a block of deinterleaved samples from one channel.
+ * @param block samples, block[0] is the last sample of the previous block
+ * @param num_samples number of new samples starting at block[1]
+ * @param phase position of block[1] in the current frame
+ * @param downsample_factor only every Nth sample of the frame contributes to energy
+ * @param energy sum of absolute sample values (output)
+ * @param zero_crossings negative to positive zero crossings (output)
+ * @param simd 0 to only use scalar code
  */
-void samd_frame_analyzer_set_callback(samd_frame_analyzer_t *analyzer, samd_frame_analyzer_cb_fn cb, void *user_cb_data)
+static void block_analyze(const int16_t *block, uint32_t num_samples, uint32_t phase, uint32_t downsample_factor, double *energy, uint32_t *zero_crossings, int simd)
 {
-	analyzer->user_cb_data = user_cb_data;
-	analyzer->callback = cb;
+	uint32_t i = 0;
+	uint32_t crossings = 0;
+	uint64_t abs_sum = 0;
+
+#ifdef __SSE2__
+	if (simd) {
+		__m128i zero = _mm_setzero_si128();
+		__m128i crossings_acc = _mm_setzero_si128();
+		__m128i abs_acc = _mm_setzero_si128();
+		uint32_t lanes[4];
+		for (; i + 8 <= num_samples; i += 8) {
+			__m128i prev = _mm_loadu_si128((const __m128i *)&block[i]);
+			__m128i cur = _mm_loadu_si128((const __m128i *)&block[i + 1]);
+			/* prev < 0 && cur >= 0 */
+			__m128i crossing = _mm_andnot_si128(_mm_cmplt_epi16(cur, zero), _mm_cmplt_epi16(prev, zero));
+			crossings_acc = _mm_sub_epi16(crossings_acc, crossing);
+			if (downsample_factor == 1) {
+				/* |cur| as unsigned 16-bit (handles -32768), widened to 32-bit lanes */
+				__m128i sign = _mm_srai_epi16(cur, 15);
+				__m128i abs_cur = _mm_sub_epi16(_mm_xor_si128(cur, sign), sign);
+				abs_acc = _mm_add_epi32(abs_acc, _mm_unpacklo_epi16(abs_cur, zero));
+				abs_acc = _mm_add_epi32(abs_acc, _mm_unpackhi_epi16(abs_cur, zero));
+			}
+		}
+		/* each 16-bit lane counts at most BLOCK_SAMPLES / 8 crossings */
+		crossings_acc = _mm_madd_epi16(crossings_acc, _mm_set1_epi16(1));
+		_mm_storeu_si128((__m128i *)lanes, crossings_acc);
+		crossings += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		_mm_storeu_si128((__m128i *)lanes, abs_acc);
+		abs_sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+#endif
+
+	/* remaining samples, or all samples if no SIMD */
+	for (; i < num_samples; i++) {
+		if (block[i] < 0 && block[i + 1] >= 0) {
+			crossings++;
+		}
+		if (downsample_factor == 1) {
+			abs_sum += abs(block[i + 1]);
+		}
+	}
+
+	if (downsample_factor != 1) {
+		/* naive downsample */
+		uint32_t offset = phase % downsample_factor;
+		for (i = offset ? downsample_factor - offset : 0; i < num_samples; i += downsample_factor) {
+			abs_sum += abs(block[i + 1]);
+		}
+	}
+
+	*energy += abs_sum;
+	*zero_crossings += crossings;
+}
+
+/**
+ * Copy one channel of interleaved samples
+ * @param out
+ * @param in first sample of the channel
+ * @param num_samples number of samples to copy
+ * @param channels
+ * @param channel
+ * @param simd 0 to only use scalar code
+ */
+static void deinterleave(int16_t *out, const int16_t *in, uint32_t num_samples, uint32_t channels, uint32_t channel, int simd)
+{
+	uint32_t i = 0;
+	if (channels == 1) {
+		memcpy(out, in, num_samples * sizeof(int16_t));
+		return;
+	}
+#ifdef __SSE2__
+	if (simd && channels == 2) {
+		/* in is offset by channel, so read from the start of the frame */
+		const int16_t *frame = in - channel;
+		for (; i + 8 <= num_samples; i += 8) {
+			__m128i a = _mm_loadu_si128((const __m128i *)&frame[i * 2]);
+			__m128i b = _mm_loadu_si128((const __m128i *)&frame[i * 2 + 8]);
+			if (channel == 0) {
+				a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+				b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+			} else {
+				a = _mm_srai_epi32(a, 16);
+				b = _mm_srai_epi32(b, 16);
+			}
+			_mm_storeu_si128((__m128i *)&out[i], _mm_packs_epi32(a, b));
+		}
+	}
+#endif
+	for (; i < num_samples; i++) {
+		out[i] = in[i * channels];
+	}
+}
+
+/**
+ * Complete a frame and send it to subscribers
+ * @param analyzer
+ * @param channels number of channels to send
+ */
+static void frame_complete(samd_frame_analyzer_t *analyzer, uint32_t channels)
+{
+	uint32_t c;
+	uint32_t time_ms = analyzer->time_ms + analyzer->frame_ms;
+	analyzer->time_ms = time_ms;
+	analyzer->frames++;
+	for (c = 0; c < channels; c++) {
+		/* final energy calculation for frame */
+		frame_dispatch(analyzer, c, time_ms, analyzer->energy[c] / (analyzer->samples / analyzer->downsample_factor), analyzer->zero_crossings[c]);
+	}
+	frame_reset(analyzer);
+}
+
+/**
+ * Complete a frame of mixed audio and send it to subscribers.  Energy is the louder of the first
+ * two channels.
+ * @param analyzer
+ */
+static void frame_complete_mixed(samd_frame_analyzer_t *analyzer)
+{
+	/* final energy calculation for frame */
+	double energy = fmax(analyzer->energy[0] / (analyzer->samples / analyzer->downsample_factor), analyzer->energy[1] / (analyzer->samples / analyzer->downsample_factor));
+
+	/* send frame information */
+	analyzer->time_ms += analyzer->frame_ms;
+	analyzer->frames++;
+	frame_dispatch(analyzer, 0, analyzer->time_ms, energy, analyzer->zero_crossings[0]);
+
+	/* reset for next frame */
+	frame_reset(analyzer);
+}
+
+/**
+ * Advance through samples of silence without reading any.  Frames and their features are exactly
+ * those of feeding zeros when energy is 0.
+ * @param analyzer
+ * @param num_samples per channel
+ * @param channels
+ * @param energy average absolute sample value of the silence
+ */
+static void process_gap(samd_frame_analyzer_t *analyzer, uint64_t num_samples, uint32_t channels, double energy)
+{
+	int split = analyzer->channel_mode == SAMD_CHANNEL_MODE_SPLIT;
+	uint32_t analyzed_channels = split ? (channels < SAMD_MAX_CHANNELS ? channels : SAMD_MAX_CHANNELS) : 1;
+	uint64_t pos = 0;
+
+	while (num_samples) {
+		uint32_t n = analyzer->samples_per_frame - analyzer->samples;
+		uint32_t c;
+		if (n > num_samples) {
+			n = (uint32_t)num_samples;
+		}
+		for (c = 0; c < analyzed_channels; c++) {
+			/* only the first sample of silence can cross zero */
+			if (analyzer->last_sample[c] < 0) {
+				analyzer->zero_crossings[c]++;
+			}
+			analyzer->last_sample[c] = 0;
+			analyzer->energy[c] += energy * n / analyzer->downsample_factor;
+			if (analyzer->spectral) {
+				samd_spectral_push_silence(analyzer->spectral, c, n, analyzer->downsample_factor);
+			}
+		}
+		num_samples -= n;
+		pos += n;
+		analyzer->samples += n;
+		if (analyzer->samples >= analyzer->samples_per_frame) {
+			analyzer->buffer_offset = (uint32_t)pos;
+			if (split) {
+				frame_complete(analyzer, analyzed_channels);
+			} else {
+				frame_complete_mixed(analyzer);
+			}
+		}
+	}
+}
+
+/**
+ * @return true if all samples are 0
+ */
+static int buffer_is_silent(const int16_t *samples, uint32_t num_samples)
+{
+	uint32_t i = 0;
+	while (i < num_samples) {
+		/* test a block at a time so the compiler can vectorize the OR */
+		uint32_t end = num_samples - i < 64 ? num_samples : i + 64;
+		int16_t any = 0;
+		for (; i < end; i++) {
+			any |= samples[i];
+		}
+		if (any) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Process the next buffer of samples, analyzing each channel separately
+ * @param analyzer
+ * @param samples
+ * @param num_samples
+ * @param channels
+ */
+static void process_buffer_split(samd_frame_analyzer_t *analyzer, int16_t *samples, uint32_t num_samples, uint32_t channels)
+{
+	int16_t block[BLOCK_SAMPLES + 1];
+	uint32_t analyzed_channels = channels < SAMD_MAX_CHANNELS ? channels : SAMD_MAX_CHANNELS;
+	uint32_t num_frames = num_samples / channels;
+	uint32_t pos = 0;
+	int simd = analyzer->kernel == SAMD_KERNEL_AUTO;
+
+	while (pos < num_frames) {
+		uint32_t n = analyzer->samples_per_frame - analyzer->samples;
+		uint32_t c;
+		if (n > num_frames - pos) {
+			n = num_frames - pos;
+		}
+		if (n > BLOCK_SAMPLES) {
+			n = BLOCK_SAMPLES;
+		}
+
+		for (c = 0; c < analyzed_channels; c++) {
+			block[0] = analyzer->last_sample[c];
+			deinterleave(block + 1, samples + pos * channels + c, n, channels, c, simd);
+			block_analyze(block, n, analyzer->samples, analyzer->downsample_factor, &analyzer->energy[c], &analyzer->zero_crossings[c], simd);
+			if (analyzer->spectral) {
+				samd_spectral_push(analyzer->spectral, c, block + 1, n, analyzer->downsample_factor);
+			}
+			analyzer->last_sample[c] = block[n];
+		}
+
+		pos += n;
+		analyzer->samples += n;
+		if (analyzer->samples >= analyzer->samples_per_frame) {
+			analyzer->buffer_offset = pos;
+			frame_complete(analyzer, analyzed_channels);
+		}
+	}
 }
 
 /**
@@ -76,6 +493,24 @@ void samd_frame_analyzer_set_callback(samd_frame_analyzer_t *analyzer, samd_fram
 void samd_frame_analyzer_process_buffer(samd_frame_analyzer_t *analyzer, int16_t *samples, uint32_t num_samples, uint32_t channels)
 {
 	uint32_t i;
+
+	analyzer->buffer_start_sample = analyzer->total_samples;
+	analyzer->total_samples += num_samples / channels;
+	analyzer->channels = channels;
+
+	/* digital silence from DTX or silence suppression is skipped, except by the reference kernel */
+	if (analyzer->kernel != SAMD_KERNEL_REFERENCE && buffer_is_silent(samples, num_samples)) {
+		process_gap(analyzer, num_samples / channels, channels, 0.0);
+		return;
+	}
+
+	/* mono without downsampling is the same in both modes */
+	if (analyzer->channel_mode == SAMD_CHANNEL_MODE_SPLIT ||
+			(channels == 1 && analyzer->downsample_factor == 1 && analyzer->kernel != SAMD_KERNEL_REFERENCE)) {
+		process_buffer_split(analyzer, samples, num_samples, channels);
+		return;
+	}
+
 	for (i = 0; i < num_samples; i += channels) {
 		int32_t mixed_sample = 0;
 		uint32_t c;
@@ -97,37 +532,98 @@ void samd_frame_analyzer_process_buffer(samd_frame_analyzer_t *analyzer, int16_t
 		}
 
 		/* collect zero crossing data - this is a rough measure of frequency and does correlate to voice / unvoiced speech. */
-		if (analyzer->last_sample < 0 && mixed_sample >= 0) {
-			analyzer->zero_crossings++;
+		if (analyzer->last_sample[0] < 0 && mixed_sample >= 0) {
+			analyzer->zero_crossings[0]++;
+		}
+		analyzer->last_sample[0] = mixed_sample;
+		if (analyzer->spectral) {
+			int16_t s = mixed_sample;
+			samd_spectral_push(analyzer->spectral, 0, &s, 1, analyzer->downsample_factor);
 		}
-		analyzer->last_sample = mixed_sample;
 
 		if (analyzer->samples >= analyzer->samples_per_frame) {
-			double energy;
+			analyzer->buffer_offset = i / channels + 1;
+			frame_complete_mixed(analyzer);
+		}
+	}
+}
 
-			analyzer->time_ms += MS_PER_FRAME;
+/**
+ * Advance through a gap in the audio, such as RTP silence suppression, DTX or lost packets, without
+ * buffers of silence.  Subscribers get the frames of the gap, so timeouts still expire, but no
+ * samples are read.  A gap at energy 0 gives exactly the frames of feeding zeros.
+ * @param analyzer
+ * @param ms duration of the gap
+ * @param energy average absolute sample value to treat the gap as, 0 for digital silence or the
+ *        level of comfort noise
+ */
+void samd_frame_analyzer_process_gap(samd_frame_analyzer_t *analyzer, uint32_t ms, double energy)
+{
+	uint64_t num_samples = (uint64_t)ms * analyzer->sample_rate / 1000;
+	analyzer->buffer_start_sample = analyzer->total_samples;
+	analyzer->total_samples += num_samples;
+	process_gap(analyzer, num_samples, analyzer->channels, energy);
+}
 
-			/* final energy calculation for frame */
-			analyzer->energy[0] = analyzer->energy[0] / (analyzer->samples / analyzer->downsample_factor);
-			analyzer->energy[1] = analyzer->energy[1] / (analyzer->samples / analyzer->downsample_factor);
-			energy = fmax(analyzer->energy[0], analyzer->energy[1]);
-			analyzer->total_energy += energy;
+/**
+ * @param analyzer
+ * @return average frame energy since analysis started.  In split mode, this is the average of the
+ * channel currently being sent to subscribers, or the first channel otherwise.
+ */
+double samd_frame_analyzer_get_average_energy(samd_frame_analyzer_t *analyzer)
+{
+	return samd_frame_analyzer_get_channel_average_energy(analyzer, analyzer->channel);
+}
 
-			/* send frame information */
-			analyzer->callback(analyzer, analyzer->user_cb_data, analyzer->time_ms, energy, analyzer->zero_crossings);
+/**
+ * @param analyzer
+ * @param channel
+ * @return average frame energy of channel since analysis started
+ */
+double samd_frame_analyzer_get_channel_average_energy(samd_frame_analyzer_t *analyzer, uint32_t channel)
+{
+	if (analyzer->frames == 0 || channel >= SAMD_MAX_CHANNELS) {
+		return 0.0;
+	}
+	return analyzer->total_energy[channel] / analyzer->frames;
+}
 
-			/* reset for next frame */
-			analyzer->energy[0] = 0.0;
-			analyzer->energy[1] = 0.0;
-			analyzer->samples = 0;
-			analyzer->zero_crossings = 0;
-		}
+/**
+ * Get the spectral features of the frame being sent to subscribers.  Features are computed on the
+ * first request for a frame and shared by all subscribers of its channel.
+ * @param analyzer
+ * @param features (output)
+ * @return 1 if computed, 0 if spectral features are disabled or no audio has been analyzed
+ */
+int samd_frame_analyzer_get_spectral_features(samd_frame_analyzer_t *analyzer, samd_spectral_features_t *features)
+{
+	samd_spectral_t *spectral = analyzer->spectral;
+	uint32_t channel = analyzer->channel;
+
+	if (!spectral || !spectral->pushed[channel]) {
+		return 0;
+	}
+	if (spectral->frame[channel] != analyzer->frames + 1) {
+		samd_spectral_compute(spectral, channel, analyzer->sample_rate / analyzer->downsample_factor, analyzer->samples_per_frame / analyzer->downsample_factor, &spectral->features[channel]);
+		spectral->frame[channel] = analyzer->frames + 1;
 	}
+	*features = spectral->features[channel];
+	return 1;
 }
 
-double samd_frame_analyzer_get_average_energy(samd_frame_analyzer_t *analyzer)
+/**
+ * Add frame and sample counts and the average energy to stats
+ * @param analyzer
+ * @param stats
+ */
+void samd_frame_analyzer_add_stats(samd_frame_analyzer_t *analyzer, samd_stats_t *stats)
 {
-	return analyzer->total_energy / (analyzer->time_ms / MS_PER_FRAME);
+	stats->frames += analyzer->frames;
+	stats->samples += analyzer->total_samples;
+	stats->average_energy = samd_frame_analyzer_get_average_energy(analyzer);
+	if (analyzer->spectral) {
+		stats->spectral_frames += analyzer->spectral->computed;
+	}
 }
 
 /**
@@ -137,8 +633,9 @@ double samd_frame_analyzer_get_average_energy(samd_frame_analyzer_t *analyzer)
 void samd_frame_analyzer_destroy(samd_frame_analyzer_t **analyzer)
 {
 	if (analyzer && *analyzer) {
+		free((*analyzer)->subscribers);
+		free((*analyzer)->spectral);
 		free(*analyzer);
 		*analyzer = NULL;
 	}
 }
-
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#include "g711.h"
+
+#define ULAW_BIAS 0x84
+#define ULAW_CLIP 32635
+
+static int16_t ulaw_table[256];
+static int16_t alaw_table[256];
+
+static int16_t ulaw_decode_sample(uint8_t u)
+{
+	int t;
+	u = ~u;
+	t = ((u & 0x0f) << 3) + ULAW_BIAS;
+	t <<= (u & 0x70) >> 4;
+	return (u & 0x80) ? (ULAW_BIAS - t) : (t - ULAW_BIAS);
+}
+
+static int16_t alaw_decode_sample(uint8_t a)
+{
+	int t;
+	int seg;
+	a ^= 0x55;
+	t = (a & 0x0f) << 4;
+	seg = (a & 0x70) >> 4;
+	switch (seg) {
+		case 0:
+			t += 8;
+			break;
+		case 1:
+			t += 0x108;
+			break;
+		default:
+			t += 0x108;
+			t <<= seg - 1;
+			break;
+	}
+	return (a & 0x80) ? t : -t;
+}
+
+/**
+ * Build decode tables.  Call once before decoding.
+ */
+void g711_init(void)
+{
+	int i;
+	for (i = 0; i < 256; i++) {
+		ulaw_table[i] = ulaw_decode_sample(i);
+		alaw_table[i] = alaw_decode_sample(i);
+	}
+}
+
+void g711_ulaw_decode(int16_t *out, const uint8_t *in, uint32_t len)
+{
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		out[i] = ulaw_table[in[i]];
+	}
+}
+
+void g711_alaw_decode(int16_t *out, const uint8_t *in, uint32_t len)
+{
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		out[i] = alaw_table[in[i]];
+	}
+}
+
+uint8_t g711_ulaw_encode_sample(int16_t sample)
+{
+	int sign = (sample >> 8) & 0x80;
+	int value = sample;
+	int exponent = 7;
+	int mask;
+	int mantissa;
+	if (sign) {
+		value = -value;
+	}
+	if (value > ULAW_CLIP) {
+		value = ULAW_CLIP;
+	}
+	value += ULAW_BIAS;
+	for (mask = 0x4000; !(value & mask) && exponent > 0; exponent--, mask >>= 1) {
+	}
+	mantissa = (value >> (exponent + 3)) & 0x0f;
+	return ~(sign | (exponent << 4) | mantissa);
+}
+
+uint8_t g711_alaw_encode_sample(int16_t sample)
+{
+	int sign = (~sample >> 8) & 0x80;
+	int value = sample;
+	int exponent = 7;
+	int mask;
+	int mantissa;
+	if (!sign) {
+		value = -value;
+	}
+	if (value > 32767) {
+		value = 32767;
+	}
+	if (value >= 256) {
+		for (mask = 0x4000; !(value & mask) && exponent > 1; exponent--, mask >>= 1) {
+		}
+		mantissa = (value >> (exponent + 3)) & 0x0f;
+		return (sign | (exponent << 4) | mantissa) ^ 0x55;
+	}
+	return (sign | (value >> 4)) ^ 0x55;
+}
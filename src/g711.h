@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#ifndef SAMD_G711_H
+#define SAMD_G711_H
+
+#include <stdint.h>
+
+/** RTP payload types */
+#define RTP_PT_PCMU 0
+#define RTP_PT_PCMA 8
+
+void g711_init(void);
+void g711_ulaw_decode(int16_t *out, const uint8_t *in, uint32_t len);
+void g711_alaw_decode(int16_t *out, const uint8_t *in, uint32_t len);
+uint8_t g711_ulaw_encode_sample(int16_t sample);
+uint8_t g711_alaw_encode_sample(int16_t sample);
+
+#endif
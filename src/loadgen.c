@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * simpleamd-load: replays a corpus of raw audio files as concurrent simulated calls.  Each call
+ * receives a 20 ms packet every 20 ms through samd_process_buffer(), with calls spread evenly
+ * over the packet interval like independent RTP streams.  Calls are divided between worker
+ * threads, one per core by default.
+ *
+ * Latency is measured from when a packet is due until samd_process_buffer() returns, so it includes
+ * time spent waiting behind other calls on the same thread.  A packet misses its deadline if it
+ * isn't processed before the next packet of the call is due.
+ */
+
+#define _GNU_SOURCE
+#include <simpleamd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#define PACKET_MS 20
+#define PACKET_NS (PACKET_MS * 1000000LL)
+#define MAX_FILES 100000
+
+/** latency histogram: 32 linear sub-buckets per power of two */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+enum result {
+	RESULT_UNKNOWN = 0,
+	RESULT_HUMAN,
+	RESULT_MACHINE,
+	RESULT_NO_VOICE
+};
+
+/** corpus file */
+struct file {
+	char *name;
+	int16_t *samples;
+	uint32_t num_samples;
+	enum result expected;
+};
+
+/** one simulated call */
+struct call {
+	samd_t *amd;
+	struct file *file;
+	uint32_t file_index;
+	uint32_t pos;
+	enum result result;
+	/** offset of packet arrival within the packet interval */
+	int64_t phase_ns;
+	/** due time of next packet */
+	int64_t due_ns;
+};
+
+/** per thread results, merged at the end */
+struct stats {
+	uint64_t packets;
+	uint64_t missed_deadlines;
+	uint64_t calls;
+	/* calls whose file name says machine or human, the only ones that can be scored */
+	uint64_t labeled;
+	uint64_t correct;
+	uint64_t humans_as_machine;
+	uint64_t machines_as_human;
+	uint64_t undecided;
+	uint64_t max_latency_ns;
+	uint64_t latency[HISTOGRAM_BUCKETS];
+};
+
+struct worker {
+	int id;
+	pthread_t thread;
+	struct call *calls;
+	uint32_t num_calls;
+	struct stats stats;
+};
+
+static struct {
+	struct file files[MAX_FILES];
+	uint32_t num_files;
+	uint32_t num_calls;
+	uint32_t num_workers;
+	uint32_t duration_s;
+	uint32_t sample_rate;
+	uint32_t channels;
+	uint32_t budget_pct;
+	uint32_t machine_ms;
+	uint32_t wait_for_voice_ms;
+	int64_t deadline_ns;
+	int64_t start_ns;
+	int64_t end_ns;
+} load = { .num_calls = 100, .duration_s = 30, .sample_rate = 8000, .channels = 1, .budget_pct = 80, .machine_ms = 1100, .wait_for_voice_ms = 2000, .deadline_ns = PACKET_NS };
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(int64_t ns)
+{
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000LL;
+	ts.tv_nsec = ns % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+	}
+}
+
+static uint32_t histogram_index(uint64_t ns)
+{
+	int msb;
+	int shift;
+	if (ns < HISTOGRAM_SUB_BUCKETS * 2) {
+		return ns;
+	}
+	msb = 63 - __builtin_clzll(ns);
+	shift = msb - HISTOGRAM_SUB_BITS;
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((ns >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * @return upper bound of the bucket
+ */
+static uint64_t histogram_value(uint32_t index)
+{
+	uint32_t shift;
+	if (index < HISTOGRAM_SUB_BUCKETS * 2) {
+		return index;
+	}
+	shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+	return ((uint64_t)(HISTOGRAM_SUB_BUCKETS + index % HISTOGRAM_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+static uint64_t histogram_percentile(const uint64_t *histogram, uint64_t count, double percentile)
+{
+	uint64_t target = (uint64_t)(count * percentile / 100.0);
+	uint64_t seen = 0;
+	uint32_t i;
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += histogram[i];
+		if (seen > target) {
+			return histogram_value(i);
+		}
+	}
+	return 0;
+}
+
+static enum result get_expected_result(const char *name)
+{
+	if (strcasestr(name, "machine") || strcasestr(name, "beep")) {
+		return RESULT_MACHINE;
+	} else if (strcasestr(name, "human") || strcasestr(name, "person")) {
+		return RESULT_HUMAN;
+	}
+	return RESULT_UNKNOWN;
+}
+
+static void amd_event_handler(samd_event_t event, uint32_t time_ms, void *user_event_data)
+{
+	struct call *call = (struct call *)user_event_data;
+	if (call->result != RESULT_UNKNOWN) {
+		return;
+	}
+	if (event == SAMD_MACHINE_VOICE || event == SAMD_MACHINE_SILENCE || event == SAMD_MACHINE_BEEP || event == SAMD_MACHINE_FINGERPRINT) {
+		call->result = RESULT_MACHINE;
+	} else if (event == SAMD_HUMAN_SILENCE || event == SAMD_HUMAN_VOICE) {
+		call->result = RESULT_HUMAN;
+	} else if (event == SAMD_NO_VOICE) {
+		call->result = RESULT_NO_VOICE;
+	}
+}
+
+static void call_start(struct call *call, uint32_t file_index)
+{
+	call->file_index = file_index % load.num_files;
+	call->file = &load.files[call->file_index];
+	call->pos = 0;
+	call->result = RESULT_UNKNOWN;
+	samd_init(&call->amd);
+	samd_set_sample_rate(call->amd, load.sample_rate);
+	samd_set_machine_ms(call->amd, load.machine_ms);
+	samd_set_wait_for_voice_ms(call->amd, load.wait_for_voice_ms);
+	samd_set_event_handler(call->amd, amd_event_handler, call);
+}
+
+/**
+ * Score a finished call.  Dead air counts as correct for humans, as in simpleamd -R.  Calls from
+ * files with no expected result are not scored.
+ */
+static void call_finish(struct call *call, struct stats *stats)
+{
+	enum result expected = call->file->expected;
+	samd_destroy(&call->amd);
+	stats->calls++;
+	if (call->result == RESULT_UNKNOWN) {
+		stats->undecided++;
+	}
+	if (expected != RESULT_UNKNOWN) {
+		stats->labeled++;
+	}
+	if (expected == RESULT_MACHINE) {
+		if (call->result == RESULT_MACHINE) {
+			stats->correct++;
+		} else if (call->result == RESULT_HUMAN) {
+			stats->machines_as_human++;
+		}
+	} else if (expected == RESULT_HUMAN) {
+		if (call->result == RESULT_HUMAN || call->result == RESULT_NO_VOICE) {
+			stats->correct++;
+		} else if (call->result == RESULT_MACHINE) {
+			stats->humans_as_machine++;
+		}
+	}
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *worker = (struct worker *)arg;
+	uint32_t packet_samples = load.sample_rate * PACKET_MS / 1000 * load.channels;
+	cpu_set_t cpus;
+	uint32_t i;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(worker->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	for (;;) {
+		/* next due call; calls are in phase order so this is round robin */
+		for (i = 0; i < worker->num_calls; i++) {
+			struct call *call = &worker->calls[i];
+			struct file *file = call->file;
+			uint32_t len;
+			uint64_t latency;
+			int64_t done;
+
+			if (call->due_ns >= load.end_ns) {
+				return NULL;
+			}
+			sleep_until_ns(call->due_ns);
+
+			len = file->num_samples - call->pos;
+			if (len > packet_samples) {
+				len = packet_samples;
+			}
+			samd_process_buffer(call->amd, file->samples + call->pos, len, load.channels);
+			done = now_ns();
+
+			latency = done > call->due_ns ? done - call->due_ns : 0;
+			worker->stats.latency[histogram_index(latency)]++;
+			worker->stats.packets++;
+			if (latency > worker->stats.max_latency_ns) {
+				worker->stats.max_latency_ns = latency;
+			}
+			if ((int64_t)latency > load.deadline_ns) {
+				worker->stats.missed_deadlines++;
+			}
+
+			call->pos += len;
+			call->due_ns += PACKET_NS;
+			if (call->pos >= file->num_samples) {
+				/* hang up and place the next call from the corpus */
+				call_finish(call, &worker->stats);
+				call_start(call, call->file_index + load.num_calls);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void load_file(const char *name)
+{
+	struct file *file;
+	FILE *raw_file;
+	long size;
+
+	if (load.num_files >= MAX_FILES) {
+		return;
+	}
+	raw_file = fopen(name, "rb");
+	if (!raw_file) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	file = &load.files[load.num_files];
+	fseek(raw_file, 0, SEEK_END);
+	size = ftell(raw_file);
+	fseek(raw_file, 0, SEEK_SET);
+	file->samples = (int16_t *)malloc(size > 0 ? size : 1);
+	file->num_samples = fread(file->samples, sizeof(int16_t), size / sizeof(int16_t), raw_file);
+	fclose(raw_file);
+	/* whole sample frames only */
+	file->num_samples -= file->num_samples % load.channels;
+	if (file->num_samples == 0) {
+		free(file->samples);
+		return;
+	}
+	file->name = strdup(name);
+	file->expected = get_expected_result(name);
+	load.num_files++;
+}
+
+static void load_list(const char *list_file_name)
+{
+	char line[1024];
+	FILE *list_file = fopen(list_file_name, "r");
+	if (!list_file) {
+		perror(list_file_name);
+		exit(EXIT_FAILURE);
+	}
+	while (fgets(line, sizeof(line), list_file)) {
+		char *newline = strrchr(line, '\n');
+		if (newline) {
+			*newline = '\0';
+		}
+		if (line[0] != '\0' && line[0] != '#') {
+			load_file(line);
+		}
+	}
+	fclose(list_file);
+}
+
+static double cpu_seconds(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+#define USAGE "simpleamd-load [options] <-l <list file>|<raw audio file>...>"
+#define HELP USAGE"\n" \
+	"\t-l <list file> Text file listing raw audio files to replay\n" \
+	"\t-n <calls> Concurrent calls (default 100)\n" \
+	"\t-t <threads> Worker threads (default one per core)\n" \
+	"\t-T <seconds> Test duration (default 30)\n" \
+	"\t-D <ms> Packet deadline (default 20)\n" \
+	"\t-b <percent> CPU budget per core for sessions per core (default 80)\n" \
+	"\t-r <sample rate> Sample rate of files (default 8000)\n" \
+	"\t-c <channels> Channels in files (default 1)\n" \
+	"\t-m <amd machine ms> Voice longer than this time is classified as machine (default 1100)\n" \
+	"\t-w <amd wait for voice ms> How long to wait for voice to begin (default 2000)\n" \
+	"\t-j Print results as JSON\n"
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	struct stats total = { 0 };
+	double cpu_start, cpu_used, wall, cores_used, sessions_per_core;
+	uint32_t call_index = 0;
+	int json = 0;
+	int opt;
+	uint32_t i, j;
+
+	while ((opt = getopt(argc, argv, "l:n:t:T:D:b:r:c:m:w:jh")) != -1) {
+		switch (opt) {
+			case 'l': load_list(optarg); break;
+			case 'n': load.num_calls = atoi(optarg); break;
+			case 't': load.num_workers = atoi(optarg); break;
+			case 'T': load.duration_s = atoi(optarg); break;
+			case 'D': load.deadline_ns = atoi(optarg) * 1000000LL; break;
+			case 'b': load.budget_pct = atoi(optarg); break;
+			case 'r': load.sample_rate = atoi(optarg); break;
+			case 'c': load.channels = atoi(optarg); break;
+			case 'm': load.machine_ms = atoi(optarg); break;
+			case 'w': load.wait_for_voice_ms = atoi(optarg); break;
+			case 'j': json = 1; break;
+			default:
+				printf("%s", HELP);
+				exit(EXIT_SUCCESS);
+		}
+	}
+	for (; optind < argc; optind++) {
+		load_file(argv[optind]);
+	}
+	if (load.num_files == 0 || load.num_calls == 0 || load.sample_rate < 8000 || load.channels == 0 ||
+			load.budget_pct == 0 || load.budget_pct > 100 || load.deadline_ns <= 0) {
+		fprintf(stderr, USAGE"\n");
+		exit(EXIT_FAILURE);
+	}
+	if (load.num_workers == 0) {
+		load.num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (load.num_workers > load.num_calls) {
+		load.num_workers = load.num_calls;
+	}
+
+	/* spread calls over workers, and each worker's calls over the packet interval */
+	load.start_ns = now_ns() + PACKET_NS;
+	load.end_ns = load.start_ns + load.duration_s * 1000000000LL;
+	workers = (struct worker *)calloc(load.num_workers, sizeof(*workers));
+	for (i = 0; i < load.num_workers; i++) {
+		struct worker *worker = &workers[i];
+		worker->id = i;
+		worker->num_calls = load.num_calls / load.num_workers + (i < load.num_calls % load.num_workers);
+		worker->calls = (struct call *)calloc(worker->num_calls, sizeof(struct call));
+		for (j = 0; j < worker->num_calls; j++) {
+			struct call *call = &worker->calls[j];
+			call->phase_ns = PACKET_NS * j / worker->num_calls;
+			call->due_ns = load.start_ns + call->phase_ns;
+			call_start(call, call_index++);
+		}
+	}
+
+	cpu_start = cpu_seconds();
+	for (i = 0; i < load.num_workers; i++) {
+		pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+	}
+	for (i = 0; i < load.num_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	cpu_used = cpu_seconds() - cpu_start;
+	wall = (now_ns() - load.start_ns) / 1e9;
+
+	for (i = 0; i < load.num_workers; i++) {
+		struct stats *stats = &workers[i].stats;
+		total.packets += stats->packets;
+		total.missed_deadlines += stats->missed_deadlines;
+		total.calls += stats->calls;
+		total.labeled += stats->labeled;
+		total.correct += stats->correct;
+		total.humans_as_machine += stats->humans_as_machine;
+		total.machines_as_human += stats->machines_as_human;
+		total.undecided += stats->undecided;
+		if (stats->max_latency_ns > total.max_latency_ns) {
+			total.max_latency_ns = stats->max_latency_ns;
+		}
+		for (j = 0; j < HISTOGRAM_BUCKETS; j++) {
+			total.latency[j] += stats->latency[j];
+		}
+		for (j = 0; j < workers[i].num_calls; j++) {
+			samd_destroy(&workers[i].calls[j].amd);
+		}
+		free(workers[i].calls);
+	}
+	free(workers);
+
+	/* calls one core can carry while staying within the CPU budget */
+	cores_used = wall > 0.0 ? cpu_used / wall : 0.0;
+	sessions_per_core = cores_used > 0.0 ? load.num_calls * (load.budget_pct / 100.0) / cores_used : 0.0;
+
+	if (json) {
+		printf("{\"calls\":%u,\"workers\":%u,\"duration_s\":%.1f,\"cpu_s\":%.3f,\"cores_used\":%.4f,\"budget_pct\":%u,\"sessions_per_core\":%.0f,"
+			"\"packets\":%llu,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"missed_deadlines\":%llu,"
+			"\"completed_calls\":%llu,\"unlabeled\":%llu,\"correct\":%llu,\"accuracy\":%.2f,\"humans_as_machine\":%llu,\"machines_as_human\":%llu,\"undecided\":%llu}\n",
+			load.num_calls, load.num_workers, wall, cpu_used, cores_used, load.budget_pct, sessions_per_core,
+			(unsigned long long)total.packets,
+			histogram_percentile(total.latency, total.packets, 50.0) / 1000.0,
+			histogram_percentile(total.latency, total.packets, 99.0) / 1000.0,
+			histogram_percentile(total.latency, total.packets, 99.9) / 1000.0,
+			total.max_latency_ns / 1000.0,
+			(unsigned long long)total.missed_deadlines, (unsigned long long)total.calls, (unsigned long long)(total.calls - total.labeled),
+			(unsigned long long)total.correct, total.labeled ? total.correct * 100.0 / total.labeled : 0.0,
+			(unsigned long long)total.humans_as_machine, (unsigned long long)total.machines_as_human, (unsigned long long)total.undecided);
+	} else {
+		printf("calls = %u on %u workers for %.1f s\n", load.num_calls, load.num_workers, wall);
+		printf("cpu = %.3f s, %.4f cores\n", cpu_used, cores_used);
+		printf("sessions per core at %u%% cpu = %.0f\n", load.budget_pct, sessions_per_core);
+		printf("packets = %llu, missed deadlines = %llu\n", (unsigned long long)total.packets, (unsigned long long)total.missed_deadlines);
+		printf("latency us: p50 = %.1f, p99 = %.1f, p999 = %.1f, max = %.1f\n",
+			histogram_percentile(total.latency, total.packets, 50.0) / 1000.0,
+			histogram_percentile(total.latency, total.packets, 99.0) / 1000.0,
+			histogram_percentile(total.latency, total.packets, 99.9) / 1000.0,
+			total.max_latency_ns / 1000.0);
+		printf("completed calls = %llu, unlabeled = %llu, correct = %llu (%.2f%% of labeled), humans as machine = %llu, machines as human = %llu, undecided = %llu\n",
+			(unsigned long long)total.calls, (unsigned long long)(total.calls - total.labeled), (unsigned long long)total.correct,
+			total.labeled ? total.correct * 100.0 / total.labeled : 0.0,
+			(unsigned long long)total.humans_as_machine, (unsigned long long)total.machines_as_human, (unsigned long long)total.undecided);
+	}
+
+	for (i = 0; i < load.num_files; i++) {
+		free(load.files[i].name);
+		free(load.files[i].samples);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "samd_metrics.h"
+#include "samd_private.h"
+
+/** upper bounds of decision time histogram buckets */
+static const uint32_t decision_buckets_ms[SAMD_DECISION_BUCKETS] = { 250, 500, 1000, 1500, 2000, 2500, 3000, 4000, 6000 };
+
+/**
+ * Registered metric
+ */
+typedef struct samd_metric {
+	const char *name;
+	const char *labels;
+	const char *help;
+	samd_metric_type_t type;
+
+	/** computes the value when scraped instead of summing shards */
+	samd_metric_fn fn;
+	void *user_data;
+
+	/** true once the other fields may be read */
+	int ready;
+} samd_metric_t;
+
+static samd_metric_t metrics[SAMD_METRICS_MAX] = {
+	{ "simpleamd_frames_total", "", "Frames analyzed by AMDs.", SAMD_METRIC_COUNTER, NULL, NULL, 1 },
+	{ "simpleamd_active_detectors", "", "AMDs created and not yet destroyed.", SAMD_METRIC_GAUGE, NULL, NULL, 1 },
+	{ "simpleamd_events_total", "event=\"no_voice\"", "AMD events by type.", SAMD_METRIC_COUNTER, NULL, NULL, 1 },
+	{ "simpleamd_events_total", "event=\"machine_voice\"", NULL, SAMD_METRIC_COUNTER, NULL, NULL, 1 },
+	{ "simpleamd_events_total", "event=\"machine_silence\"", NULL, SAMD_METRIC_COUNTER, NULL, NULL, 1 },
+	{ "simpleamd_events_total", "event=\"machine_beep\"", NULL, SAMD_METRIC_COUNTER, NULL, NULL, 1 },
+	{ "simpleamd_events_total", "event=\"human_voice\"", NULL, SAMD_METRIC_COUNTER, NULL, NULL, 1 },
+	{ "simpleamd_events_total", "event=\"human_silence\"", NULL, SAMD_METRIC_COUNTER, NULL, NULL, 1 },
+	{ "simpleamd_events_total", "event=\"likely_human\"", NULL, SAMD_METRIC_COUNTER, NULL, NULL, 1 },
+	{ "simpleamd_events_total", "event=\"likely_machine\"", NULL, SAMD_METRIC_COUNTER, NULL, NULL, 1 },
+	{ "simpleamd_events_total", "event=\"machine_fingerprint\"", NULL, SAMD_METRIC_COUNTER, NULL, NULL, 1 }
+};
+
+/** number of metric slots taken */
+static int num_metrics = SAMD_METRIC_EVENTS + SAMD_MACHINE_FINGERPRINT + 1;
+
+/**
+ * Fold an exiting thread's counts into the retired shard, with shards locked
+ * @param retired
+ * @param shard of the exiting thread
+ */
+void samd_metrics_retire(samd_shard_t *retired, const samd_shard_t *shard)
+{
+	int i;
+	for (i = 0; i < SAMD_METRICS_MAX; i++) {
+		__atomic_fetch_add(&retired->metrics[i], shard->metrics[i], __ATOMIC_RELAXED);
+	}
+	for (i = 0; i <= SAMD_DECISION_BUCKETS; i++) {
+		__atomic_fetch_add(&retired->decisions[i], shard->decisions[i], __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_add(&retired->decision_ms, shard->decision_ms, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add a metric.  Metrics with the same name must be registered one after another, with the help
+ * text on the first.
+ * @param name metric name
+ * @param labels for example worker="1", or "" for none.  Must remain valid.
+ * @param help description, or NULL if the previous metric has the same name
+ * @param type
+ * @param fn computes the value when scraped, or NULL to use samd_metrics_add()
+ * @param user_data sent to fn
+ * @return the metric, or -1 if SAMD_METRICS_MAX metrics are registered
+ */
+int samd_metrics_register_fn(const char *name, const char *labels, const char *help, samd_metric_type_t type, samd_metric_fn fn, void *user_data)
+{
+	int metric = __atomic_fetch_add(&num_metrics, 1, __ATOMIC_RELAXED);
+	if (metric >= SAMD_METRICS_MAX) {
+		__atomic_store_n(&num_metrics, SAMD_METRICS_MAX, __ATOMIC_RELAXED);
+		return -1;
+	}
+	metrics[metric].name = name;
+	metrics[metric].labels = labels ? labels : "";
+	metrics[metric].help = help;
+	metrics[metric].type = type;
+	metrics[metric].fn = fn;
+	metrics[metric].user_data = user_data;
+	__atomic_store_n(&metrics[metric].ready, 1, __ATOMIC_RELEASE);
+	return metric;
+}
+
+/**
+ * Add a metric updated with samd_metrics_add()
+ * @return the metric, or -1 if SAMD_METRICS_MAX metrics are registered
+ */
+int samd_metrics_register(const char *name, const char *labels, const char *help, samd_metric_type_t type)
+{
+	return samd_metrics_register_fn(name, labels, help, type, NULL, NULL);
+}
+
+/**
+ * Add to a counter or gauge in this thread's shard
+ * @param metric
+ * @param value to add, negative to decrease a gauge
+ */
+void samd_metrics_add(int metric, int64_t value)
+{
+	samd_shard_t *shard;
+	if (metric < 0 || metric >= SAMD_METRICS_MAX || !value) {
+		return;
+	}
+	shard = samd_shard();
+	if (!shard) {
+		__atomic_fetch_add(&samd_shard_retired()->metrics[metric], value, __ATOMIC_RELAXED);
+		return;
+	}
+	/* only this thread writes the shard */
+	__atomic_store_n(&shard->metrics[metric], shard->metrics[metric] + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Count an AMD decision in the decision time histogram
+ * @param ms audio time from the start of the call
+ */
+void samd_metrics_observe_decision_ms(uint32_t ms)
+{
+	samd_shard_t *shard = samd_shard();
+	uint32_t i;
+	for (i = 0; i < SAMD_DECISION_BUCKETS && ms > decision_buckets_ms[i]; i++) {
+	}
+	if (!shard) {
+		shard = samd_shard_retired();
+		__atomic_fetch_add(&shard->decisions[i], 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&shard->decision_ms, ms, __ATOMIC_RELAXED);
+		return;
+	}
+	__atomic_store_n(&shard->decisions[i], shard->decisions[i] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&shard->decision_ms, shard->decision_ms + ms, __ATOMIC_RELAXED);
+}
+
+/** a metric summed over shards */
+struct metric_sum {
+	int metric;
+	int64_t value;
+};
+
+static void metric_sum(const samd_shard_t *shard, void *user_data)
+{
+	struct metric_sum *sum = (struct metric_sum *)user_data;
+	sum->value += __atomic_load_n(&shard->metrics[sum->metric], __ATOMIC_RELAXED);
+}
+
+/** the decision time histogram summed over shards */
+struct decisions_sum {
+	uint64_t decisions[SAMD_DECISION_BUCKETS + 1];
+	uint64_t decision_ms;
+};
+
+static void decisions_sum(const samd_shard_t *shard, void *user_data)
+{
+	struct decisions_sum *sum = (struct decisions_sum *)user_data;
+	int i;
+	for (i = 0; i <= SAMD_DECISION_BUCKETS; i++) {
+		sum->decisions[i] += __atomic_load_n(&shard->decisions[i], __ATOMIC_RELAXED);
+	}
+	sum->decision_ms += __atomic_load_n(&shard->decision_ms, __ATOMIC_RELAXED);
+}
+
+/**
+ * @param metric
+ * @return the current value of a metric, summed over all threads
+ */
+double samd_metrics_get(int metric)
+{
+	struct metric_sum sum = { metric, 0 };
+	if (metric < 0 || metric >= SAMD_METRICS_MAX || !__atomic_load_n(&metrics[metric].ready, __ATOMIC_ACQUIRE)) {
+		return 0.0;
+	}
+	if (metrics[metric].fn) {
+		return metrics[metric].fn(metrics[metric].user_data);
+	}
+	samd_shard_for_each(metric_sum, &sum);
+	return (double)sum.value;
+}
+
+/**
+ * Append to the rendered text, counting what doesn't fit
+ */
+static void render_printf(char *buf, size_t size, size_t *len, const char *format, ...)
+{
+	va_list ap;
+	int n;
+	va_start(ap, format);
+	n = vsnprintf(*len < size ? buf + *len : NULL, *len < size ? size - *len : 0, format, ap);
+	va_end(ap);
+	if (n > 0) {
+		*len += n;
+	}
+}
+
+/**
+ * Render all metrics in Prometheus text exposition format
+ * @param buf (output)
+ * @param size of buf
+ * @return length of the text.  If size or more, the text was truncated and a buffer of the
+ * returned length + 1 is needed.
+ */
+size_t samd_metrics_render(char *buf, size_t size)
+{
+	struct decisions_sum sum = { { 0 }, 0 };
+	uint64_t count = 0;
+	const char *last_name = NULL;
+	size_t len = 0;
+	int n = __atomic_load_n(&num_metrics, __ATOMIC_RELAXED);
+	int i;
+
+	if (size) {
+		buf[0] = '\0';
+	}
+	for (i = 0; i < n && i < SAMD_METRICS_MAX; i++) {
+		samd_metric_t *metric = &metrics[i];
+		double value;
+		if (!__atomic_load_n(&metric->ready, __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		if (!last_name || strcmp(last_name, metric->name)) {
+			if (metric->help) {
+				render_printf(buf, size, &len, "# HELP %s %s\n", metric->name, metric->help);
+			}
+			render_printf(buf, size, &len, "# TYPE %s %s\n", metric->name, metric->type == SAMD_METRIC_COUNTER ? "counter" : "gauge");
+			last_name = metric->name;
+		}
+		value = samd_metrics_get(i);
+		if (metric->labels[0]) {
+			render_printf(buf, size, &len, "%s{%s} %.15g\n", metric->name, metric->labels, value);
+		} else {
+			render_printf(buf, size, &len, "%s %.15g\n", metric->name, value);
+		}
+	}
+
+	samd_shard_for_each(decisions_sum, &sum);
+	render_printf(buf, size, &len, "# HELP simpleamd_decision_seconds Audio time from the start of a call to its first AMD event.\n");
+	render_printf(buf, size, &len, "# TYPE simpleamd_decision_seconds histogram\n");
+	for (i = 0; i < SAMD_DECISION_BUCKETS; i++) {
+		count += sum.decisions[i];
+		render_printf(buf, size, &len, "simpleamd_decision_seconds_bucket{le=\"%g\"} %llu\n", decision_buckets_ms[i] / 1000.0, (unsigned long long)count);
+	}
+	count += sum.decisions[SAMD_DECISION_BUCKETS];
+	render_printf(buf, size, &len, "simpleamd_decision_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)count);
+	render_printf(buf, size, &len, "simpleamd_decision_seconds_sum %.15g\n", sum.decision_ms / 1000.0);
+	render_printf(buf, size, &len, "simpleamd_decision_seconds_count %llu\n", (unsigned long long)count);
+	return len;
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * Noise floor priors in a shared file mapping.  Any number of threads and processes may read and
+ * update the same file.  Keys are claimed once by moving a free slot's seq from 0 to 1 and are
+ * never changed after, so lookups compare keys without locking; values are read under the slot's
+ * seqlock.  A process that dies while writing leaves a slot's seq odd, so waits for a writer are
+ * bounded and give up as if there were no prior.  Every process holds a shared flock on the file
+ * while it has it open; the first to open it takes it exclusively to initialize the file and
+ * release slots left odd by processes that died.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "samd_priors.h"
+#include "samd_private.h"
+
+/** loads of a slot's seq to wait for a writer before giving up */
+#define PRIORS_MAX_SPINS 1000000
+
+/** process's handle to a priors file */
+struct samd_priors {
+	samd_priors_header_t *header;
+	samd_priors_slot_t *slots;
+	size_t size;
+	/** holds the shared flock */
+	int fd;
+};
+
+/**
+ * @return FNV-1a hash of key
+ */
+static uint32_t priors_hash(const char *key)
+{
+	uint32_t hash = 2166136261u;
+	for (; *key; key++) {
+		hash = (hash ^ (uint8_t)*key) * 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Wait until a slot's seq isn't busy
+ * @param slot
+ * @param busy 1 to wait for a claim, or 0 to wait for any writer (odd seq)
+ * @return the last seq loaded, still busy if the writer didn't finish in PRIORS_MAX_SPINS loads
+ */
+static uint32_t priors_wait(samd_priors_slot_t *slot, int busy)
+{
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	uint32_t spins;
+	for (spins = 0; spins < PRIORS_MAX_SPINS && (busy ? seq == 1 : (seq & 1)); spins++) {
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	}
+	return seq;
+}
+
+/**
+ * Release slots left busy by processes that died while writing.  Only called while no other
+ * process has the file open.  A slot whose key was never written keeps an empty key, so probe
+ * chains through it stay intact; a slot whose values were being updated forgets them.
+ * @param priors
+ */
+static void priors_recover(samd_priors_t *priors)
+{
+	uint32_t i;
+	for (i = 0; i < priors->header->num_slots; i++) {
+		samd_priors_slot_t *slot = &priors->slots[i];
+		if (slot->seq & 1) {
+			if (slot->seq == 1) {
+				memset(slot->key, 0, SAMD_PRIORS_KEY_LEN);
+			}
+			slot->calls = 0;
+			slot->noise_floor = 0.0;
+			slot->threshold = 0.0;
+			slot->seq++;
+		}
+	}
+}
+
+/**
+ * Find the slot of key
+ * @param priors
+ * @param key truncated to SAMD_PRIORS_KEY_LEN - 1
+ * @param create claim a free slot if key is not found
+ * @return the slot or NULL if not found, the table is full or a claim of a slot didn't finish
+ */
+static samd_priors_slot_t *priors_find(samd_priors_t *priors, const char *key, int create)
+{
+	char k[SAMD_PRIORS_KEY_LEN] = { 0 };
+	uint32_t num_slots = priors->header->num_slots;
+	uint32_t start;
+	uint32_t i;
+
+	strncpy(k, key, SAMD_PRIORS_KEY_LEN - 1);
+	start = priors_hash(k) % num_slots;
+	for (i = 0; i < num_slots; i++) {
+		samd_priors_slot_t *slot = &priors->slots[(start + i) % num_slots];
+		uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == 0) {
+			if (!create) {
+				return NULL;
+			}
+			if (__atomic_compare_exchange_n(&slot->seq, &seq, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+				memcpy(slot->key, k, SAMD_PRIORS_KEY_LEN);
+				slot->calls = 0;
+				slot->noise_floor = 0.0;
+				slot->threshold = 0.0;
+				__atomic_store_n(&slot->seq, 2, __ATOMIC_RELEASE);
+				return slot;
+			}
+		}
+		/* wait for another claim of this slot to write its key */
+		if (seq == 1 && (seq = priors_wait(slot, 1)) == 1) {
+			return NULL;
+		}
+		if (!memcmp(slot->key, k, SAMD_PRIORS_KEY_LEN)) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Open a priors file, creating it if it doesn't exist
+ * @param priors the store (output)
+ * @param path of the file
+ * @param num_slots max keys if the file is created, ignored otherwise
+ * @return 0 on success, -1 on failure
+ */
+int samd_priors_open(samd_priors_t **priors, const char *path, uint32_t num_slots)
+{
+	samd_priors_header_t header;
+	samd_priors_t *new_priors;
+	struct stat st;
+	int exclusive;
+	int fd;
+
+	*priors = NULL;
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	/* the first process initializes and repairs the file, the rest wait for it to finish */
+	exclusive = flock(fd, LOCK_EX | LOCK_NB) == 0;
+	if ((!exclusive && flock(fd, LOCK_SH) < 0) || fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		if (!exclusive || num_slots == 0 || ftruncate(fd, sizeof(header) + (size_t)num_slots * sizeof(samd_priors_slot_t)) < 0) {
+			close(fd);
+			return -1;
+		}
+	} else if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != SAMD_PRIORS_MAGIC ||
+		header.version != SAMD_PRIORS_VERSION || header.num_slots == 0 ||
+		(size_t)st.st_size < sizeof(header) + (size_t)header.num_slots * sizeof(samd_priors_slot_t)) {
+		close(fd);
+		return -1;
+	} else {
+		num_slots = header.num_slots;
+	}
+
+	new_priors = (samd_priors_t *)calloc(1, sizeof(*new_priors));
+	if (!new_priors) {
+		close(fd);
+		return -1;
+	}
+	new_priors->fd = fd;
+	new_priors->size = sizeof(header) + (size_t)num_slots * sizeof(samd_priors_slot_t);
+	new_priors->header = (samd_priors_header_t *)mmap(NULL, new_priors->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (new_priors->header == MAP_FAILED) {
+		free(new_priors);
+		close(fd);
+		return -1;
+	}
+	new_priors->slots = (samd_priors_slot_t *)(new_priors->header + 1);
+
+	if (exclusive) {
+		/* new file is zero filled, so all slots start free */
+		if (new_priors->header->magic != SAMD_PRIORS_MAGIC) {
+			new_priors->header->version = SAMD_PRIORS_VERSION;
+			new_priors->header->num_slots = num_slots;
+			__atomic_store_n(&new_priors->header->magic, SAMD_PRIORS_MAGIC, __ATOMIC_RELEASE);
+		} else {
+			priors_recover(new_priors);
+		}
+		if (flock(fd, LOCK_SH) < 0) {
+			samd_priors_close(&new_priors);
+			return -1;
+		}
+	}
+
+	*priors = new_priors;
+	return 0;
+}
+
+/**
+ * Get the prior of key
+ * @param priors
+ * @param key
+ * @param noise_floor (output)
+ * @param threshold (output)
+ * @param calls (output) number of calls learned from.  May be NULL.
+ * @return 1 if found, 0 if not or if a writer of the slot didn't finish
+ */
+int samd_priors_get(samd_priors_t *priors, const char *key, double *noise_floor, double *threshold, uint32_t *calls)
+{
+	samd_priors_slot_t *slot = priors_find(priors, key, 0);
+	uint32_t seq;
+	uint32_t slot_calls;
+
+	if (!slot) {
+		return 0;
+	}
+	do {
+		if ((seq = priors_wait(slot, 0)) & 1) {
+			return 0;
+		}
+		*noise_floor = slot->noise_floor;
+		*threshold = slot->threshold;
+		slot_calls = slot->calls;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq);
+
+	if (calls) {
+		*calls = slot_calls;
+	}
+	return slot_calls > 0;
+}
+
+/**
+ * Learn from a completed call: move the prior of key toward noise_floor and threshold.  The first
+ * calls are averaged, after SAMD_PRIORS_HISTORY calls each moves it by 1 / SAMD_PRIORS_HISTORY.
+ * @param priors
+ * @param key
+ * @param noise_floor measured in the call
+ * @param threshold energy threshold calibrated to that noise floor
+ * @return 0 on success, -1 if the file has no free slot for a new key or another writer of the
+ * slot didn't finish
+ */
+int samd_priors_put(samd_priors_t *priors, const char *key, double noise_floor, double threshold)
+{
+	samd_priors_slot_t *slot = priors_find(priors, key, 1);
+	uint32_t seq;
+	double weight;
+
+	if (!slot) {
+		return -1;
+	}
+	do {
+		if ((seq = priors_wait(slot, 0)) & 1) {
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	weight = 1.0 / (slot->calls < SAMD_PRIORS_HISTORY ? slot->calls + 1 : SAMD_PRIORS_HISTORY);
+	slot->noise_floor += (noise_floor - slot->noise_floor) * weight;
+	slot->threshold += (threshold - slot->threshold) * weight;
+	slot->calls++;
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Seed the VAD of a new call with the prior of key, if there is one.  Call after the VAD's energy
+ * thresholds are set.
+ * @param priors
+ * @param key
+ * @param vad
+ * @return 1 if the prior was applied, 0 if key has none
+ */
+int samd_priors_apply(samd_priors_t *priors, const char *key, samd_vad_t *vad)
+{
+	double noise_floor;
+	double threshold;
+
+	if (!samd_priors_get(priors, key, &noise_floor, &threshold, NULL)) {
+		return 0;
+	}
+	samd_vad_set_prior(vad, noise_floor, fmax(fmin(threshold, vad->max_threshold), vad->initial_threshold));
+	return 1;
+}
+
+/**
+ * Learn from the VAD of a completed call
+ * @param priors
+ * @param key
+ * @param vad
+ * @return 0 on success, -1 if the VAD has not measured the noise floor or the file is full
+ */
+int samd_priors_update(samd_priors_t *priors, const char *key, samd_vad_t *vad)
+{
+	double noise_floor;
+
+	if (!samd_vad_get_noise_floor(vad, &noise_floor)) {
+		return -1;
+	}
+	/* the threshold of the noise floor, not as raised by voice at voice_adjust_ms */
+	return samd_priors_put(priors, key, noise_floor, vad->measured_threshold);
+}
+
+/**
+ * Close priors file
+ * @param priors
+ */
+void samd_priors_close(samd_priors_t **priors)
+{
+	if (priors && *priors) {
+		munmap((*priors)->header, (*priors)->size);
+		close((*priors)->fd);
+		free(*priors);
+		*priors = NULL;
+	}
+}
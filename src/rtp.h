@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#ifndef SAMD_RTP_H
+#define SAMD_RTP_H
+
+#include <stdint.h>
+
+#define RTP_HEADER_SIZE 12
+#define RTP_VERSION 2
+
+/** RTP header fields needed for demultiplexing and reordering */
+typedef struct rtp_header {
+	uint8_t payload_type;
+	uint16_t seq;
+	uint32_t timestamp;
+	uint32_t ssrc;
+} rtp_header_t;
+
+/**
+ * Parse RTP header
+ * @param packet
+ * @param len of packet
+ * @param header parsed header (output)
+ * @param payload start of payload (output)
+ * @param payload_len length of payload (output)
+ * @return 1 if a valid RTP packet
+ */
+static inline int rtp_parse(const uint8_t *packet, uint32_t len, rtp_header_t *header, const uint8_t **payload, uint32_t *payload_len)
+{
+	uint32_t offset = RTP_HEADER_SIZE;
+	uint32_t padding = 0;
+	if (len < RTP_HEADER_SIZE || (packet[0] >> 6) != RTP_VERSION) {
+		return 0;
+	}
+	offset += (packet[0] & 0x0f) * 4; /* CSRCs */
+	if (packet[0] & 0x10) {
+		/* header extension */
+		if (len < offset + 4) {
+			return 0;
+		}
+		offset += 4 + ((packet[offset + 2] << 8 | packet[offset + 3]) * 4);
+	}
+	if (packet[0] & 0x20) {
+		padding = packet[len - 1];
+	}
+	if (len < offset + padding) {
+		return 0;
+	}
+	header->payload_type = packet[1] & 0x7f;
+	header->seq = packet[2] << 8 | packet[3];
+	header->timestamp = (uint32_t)packet[4] << 24 | packet[5] << 16 | packet[6] << 8 | packet[7];
+	header->ssrc = (uint32_t)packet[8] << 24 | packet[9] << 16 | packet[10] << 8 | packet[11];
+	*payload = packet + offset;
+	*payload_len = len - offset - padding;
+	return 1;
+}
+
+/**
+ * Write RTP header
+ * @param packet at least RTP_HEADER_SIZE bytes
+ * @param header
+ */
+static inline void rtp_write_header(uint8_t *packet, const rtp_header_t *header)
+{
+	packet[0] = RTP_VERSION << 6;
+	packet[1] = header->payload_type & 0x7f;
+	packet[2] = header->seq >> 8;
+	packet[3] = header->seq & 0xff;
+	packet[4] = header->timestamp >> 24;
+	packet[5] = (header->timestamp >> 16) & 0xff;
+	packet[6] = (header->timestamp >> 8) & 0xff;
+	packet[7] = header->timestamp & 0xff;
+	packet[8] = header->ssrc >> 24;
+	packet[9] = (header->ssrc >> 16) & 0xff;
+	packet[10] = (header->ssrc >> 8) & 0xff;
+	packet[11] = header->ssrc & 0xff;
+}
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * simpleamd-rtpreplay: sends raw audio files to simpleamd-server as G.711 RTP streams in real time.
+ * Each file is sent as one or more concurrent streams with unique SSRCs.  Packet loss and
+ * reordering can be simulated to exercise the server's jitter buffer.
+ */
+
+#define _GNU_SOURCE
+#include "g711.h"
+#include "rtp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define SAMPLES_PER_PACKET 160
+#define PACKET_NS 20000000L
+#define MAX_SOCKETS 64
+
+/** one stream being sent */
+struct stream {
+	int16_t *samples;
+	size_t num_samples;
+	size_t pos;
+	int sock;
+	rtp_header_t header;
+	/** packet held back to simulate reordering */
+	uint8_t held[RTP_HEADER_SIZE + SAMPLES_PER_PACKET];
+	size_t held_len;
+};
+
+static int16_t *read_file(const char *name, size_t *num_samples)
+{
+	FILE *file = fopen(name, "rb");
+	int16_t *samples = NULL;
+	long size;
+	if (!file) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	samples = (int16_t *)malloc(size > 0 ? size : 1);
+	*num_samples = fread(samples, sizeof(int16_t), size / sizeof(int16_t), file);
+	fclose(file);
+	return samples;
+}
+
+/**
+ * Send the next packet of the stream
+ * @return 0 when the stream is done
+ */
+static int stream_send(struct stream *stream, int alaw, int loss_pct, int reorder_pct)
+{
+	uint8_t packet[RTP_HEADER_SIZE + SAMPLES_PER_PACKET];
+	size_t len;
+	size_t i;
+
+	if (stream->pos >= stream->num_samples) {
+		if (stream->held_len) {
+			send(stream->sock, stream->held, stream->held_len, 0);
+			stream->held_len = 0;
+		}
+		return 0;
+	}
+
+	len = stream->num_samples - stream->pos;
+	if (len > SAMPLES_PER_PACKET) {
+		len = SAMPLES_PER_PACKET;
+	}
+	rtp_write_header(packet, &stream->header);
+	for (i = 0; i < len; i++) {
+		int16_t sample = stream->samples[stream->pos + i];
+		packet[RTP_HEADER_SIZE + i] = alaw ? g711_alaw_encode_sample(sample) : g711_ulaw_encode_sample(sample);
+	}
+	len += RTP_HEADER_SIZE;
+	stream->pos += SAMPLES_PER_PACKET;
+	stream->header.seq++;
+	stream->header.timestamp += SAMPLES_PER_PACKET;
+
+	if (loss_pct && rand() % 100 < loss_pct) {
+		return 1;
+	}
+	if (!stream->held_len && reorder_pct && rand() % 100 < reorder_pct) {
+		/* send after the next packet */
+		memcpy(stream->held, packet, len);
+		stream->held_len = len;
+		return 1;
+	}
+	send(stream->sock, packet, len, 0);
+	if (stream->held_len) {
+		send(stream->sock, stream->held, stream->held_len, 0);
+		stream->held_len = 0;
+	}
+	return 1;
+}
+
+#define USAGE "simpleamd-rtpreplay [options] <raw audio file>..."
+#define HELP USAGE"\n" \
+	"\t-a <address> Address of simpleamd-server (default 127.0.0.1)\n" \
+	"\t-p <port> Port of simpleamd-server (default 7000)\n" \
+	"\t-n <copies> Concurrent streams per file (default 1)\n" \
+	"\t-s <sockets> Number of source sockets to spread streams over (default 1 per stream, max 64)\n" \
+	"\t-A Send PCMA instead of PCMU\n" \
+	"\t-L <percent> Drop this percentage of packets\n" \
+	"\t-O <percent> Reorder this percentage of packets\n" \
+	"\t-f Send as fast as possible instead of real time\n"
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr = { 0 };
+	struct stream *streams;
+	struct timespec next;
+	const char *address = "127.0.0.1";
+	int sockets[MAX_SOCKETS];
+	int port = 7000;
+	int copies = 1;
+	int num_sockets = 0;
+	int alaw = 0;
+	int loss_pct = 0;
+	int reorder_pct = 0;
+	int fast = 0;
+	int num_streams;
+	int active;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "a:p:n:s:AL:O:fh")) != -1) {
+		switch (opt) {
+			case 'a': address = optarg; break;
+			case 'p': port = atoi(optarg); break;
+			case 'n': copies = atoi(optarg); break;
+			case 's': num_sockets = atoi(optarg); break;
+			case 'A': alaw = 1; break;
+			case 'L': loss_pct = atoi(optarg); break;
+			case 'O': reorder_pct = atoi(optarg); break;
+			case 'f': fast = 1; break;
+			default:
+				printf("%s", HELP);
+				exit(EXIT_SUCCESS);
+		}
+	}
+	if (optind >= argc || copies < 1 || copies > 10000) {
+		fprintf(stderr, USAGE"\n");
+		exit(EXIT_FAILURE);
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+		fprintf(stderr, "Invalid address %s\n", address);
+		exit(EXIT_FAILURE);
+	}
+
+	/* the server hashes source address and port to a worker, so spread streams over several sockets */
+	num_streams = (argc - optind) * copies;
+	if (num_streams <= 0 || num_streams > 1000000) {
+		fprintf(stderr, "Too many streams\n");
+		exit(EXIT_FAILURE);
+	}
+	if (num_sockets <= 0 || num_sockets > num_streams) {
+		num_sockets = num_streams;
+	}
+	if (num_sockets > MAX_SOCKETS) {
+		num_sockets = MAX_SOCKETS;
+	}
+	for (i = 0; i < num_sockets; i++) {
+		sockets[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sockets[i] < 0 || connect(sockets[i], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			perror("socket");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	g711_init();
+	srand(time(NULL));
+	streams = (struct stream *)calloc((size_t)num_streams, sizeof(*streams));
+	for (i = 0; i < num_streams; i++) {
+		if (i % copies == 0) {
+			streams[i].samples = read_file(argv[optind + i / copies], &streams[i].num_samples);
+		} else {
+			streams[i].samples = streams[i - 1].samples;
+			streams[i].num_samples = streams[i - 1].num_samples;
+		}
+		streams[i].sock = sockets[i % num_sockets];
+		streams[i].header.payload_type = alaw ? RTP_PT_PCMA : RTP_PT_PCMU;
+		streams[i].header.ssrc = ((uint32_t)rand() << 16) ^ rand() ^ i;
+		streams[i].header.seq = rand();
+		streams[i].header.timestamp = rand();
+		printf("%08x %s\n", streams[i].header.ssrc, argv[optind + i / copies]);
+	}
+	fflush(stdout);
+
+	/* send one packet per stream every 20 ms */
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	do {
+		for (active = 0, i = 0; i < num_streams; i++) {
+			active += stream_send(&streams[i], alaw, loss_pct, reorder_pct);
+		}
+		if (!fast) {
+			next.tv_nsec += PACKET_NS;
+			if (next.tv_nsec >= 1000000000L) {
+				next.tv_nsec -= 1000000000L;
+				next.tv_sec++;
+			}
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+			}
+		}
+	} while (active);
+
+	for (i = 0; i < num_streams; i += copies) {
+		free(streams[i].samples);
+	}
+	free(streams);
+	for (i = 0; i < num_sockets; i++) {
+		close(sockets[i]);
+	}
+	return EXIT_SUCCESS;
+}
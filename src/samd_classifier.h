@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#ifndef SAMD_CLASSIFIER_H
+#define SAMD_CLASSIFIER_H
+
+#include <stdint.h>
+#include "simpleamd.h"
+
+/*
+ * Classifier for ambiguous calls.  The duration rules of the AMD decide clear cases: silence after
+ * little voice is a human, voice well past machine_ms is a machine.  Between them, a logistic
+ * regression over summary features of the voice heard so far decides instead.  Models are trained
+ * offline from labeled calls with samd_classifier_trainer_*() or simpleamd -T, written as a C
+ * header of constant tables and compiled in, so classifying doesn't allocate.
+ */
+
+/* features, in order */
+#define SAMD_CLASSIFIER_VOICE_S 0
+#define SAMD_CLASSIFIER_UTTERANCES 1
+#define SAMD_CLASSIFIER_FIRST_UTTERANCE_S 2
+#define SAMD_CLASSIFIER_LONGEST_PAUSE_S 3
+#define SAMD_CLASSIFIER_PAUSE_FRACTION 4
+#define SAMD_CLASSIFIER_ENERGY_CV 5
+#define SAMD_CLASSIFIER_ZERO_CROSSINGS 6
+#define SAMD_CLASSIFIER_ZERO_CROSSINGS_SD 7
+#define SAMD_CLASSIFIER_FEATURES 8
+
+typedef struct samd_classifier_model {
+	/* features are standardized with mean and scale, then weighted */
+	double mean[SAMD_CLASSIFIER_FEATURES];
+	double scale[SAMD_CLASSIFIER_FEATURES];
+	double weights[SAMD_CLASSIFIER_FEATURES];
+	double bias;
+} samd_classifier_model_t;
+
+typedef struct samd_classifier_trainer samd_classifier_trainer_t;
+
+const samd_classifier_model_t *samd_classifier_get_default_model(void);
+double samd_classifier_predict(const samd_classifier_model_t *model, const double *features);
+const char *samd_classifier_feature_name(int feature);
+
+void samd_set_classifier(samd_t *amd, const samd_classifier_model_t *model);
+void samd_set_classifier_window_ms(samd_t *amd, uint32_t min_ms, uint32_t max_ms);
+int samd_get_classifier_features(samd_t *amd, double *features);
+
+void samd_classifier_trainer_init(samd_classifier_trainer_t **trainer);
+int samd_classifier_trainer_add(samd_classifier_trainer_t *trainer, const double *features, int machine);
+int samd_classifier_trainer_fit(samd_classifier_trainer_t *trainer, samd_classifier_model_t *model);
+int samd_classifier_write(const samd_classifier_model_t *model, const char *path, const char *name);
+void samd_classifier_trainer_destroy(samd_classifier_trainer_t **trainer);
+
+#endif
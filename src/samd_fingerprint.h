@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#ifndef SAMD_FINGERPRINT_H
+#define SAMD_FINGERPRINT_H
+
+#include <stdint.h>
+#include "simpleamd.h"
+
+/*
+ * Greeting fingerprints.  Every step_ms of voice, an AMD hashes the direction frame energy and
+ * zero crossings moved over the last SAMD_FINGERPRINT_WORD_STEPS steps into a 24-bit word.  Words
+ * depend only on the rise and fall of the features, so gain and noise floor don't change them.
+ * A read-only index of the words of known greetings, built from recordings with
+ * samd_fingerprint_builder_*() or simpleamd -B, is searched for each word; enough hits on one
+ * greeting at a consistent offset send SAMD_MACHINE_FINGERPRINT.
+ *
+ * Index layout: samd_fingerprint_header_t, num_greetings names of SAMD_FINGERPRINT_NAME_LEN
+ * bytes, then num_entries samd_fingerprint_entry_t sorted by word.
+ */
+
+#define SAMD_FINGERPRINT_MAGIC 0x50464153
+#define SAMD_FINGERPRINT_VERSION 1
+#define SAMD_FINGERPRINT_NAME_LEN 32
+#define SAMD_FINGERPRINT_STEP_MS 20
+#define SAMD_FINGERPRINT_WORD_STEPS 12
+
+typedef struct samd_fingerprint_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t step_ms;
+	uint32_t num_greetings;
+	uint32_t num_entries;
+	uint32_t pad[3];
+} samd_fingerprint_header_t;
+
+typedef struct samd_fingerprint_entry {
+	uint32_t word;
+	/* index of the greeting's name */
+	uint16_t greeting;
+	/* step of the greeting the word ends at */
+	uint16_t step;
+} samd_fingerprint_entry_t;
+
+typedef struct samd_fingerprint_index samd_fingerprint_index_t;
+typedef struct samd_fingerprint_builder samd_fingerprint_builder_t;
+
+int samd_fingerprint_index_open(samd_fingerprint_index_t **index, const char *path);
+uint32_t samd_fingerprint_index_get_num_greetings(samd_fingerprint_index_t *index);
+void samd_fingerprint_index_close(samd_fingerprint_index_t **index);
+
+void samd_set_fingerprint_index(samd_t *amd, samd_fingerprint_index_t *index);
+const char *samd_get_fingerprint_match(samd_t *amd);
+
+void samd_fingerprint_builder_init(samd_fingerprint_builder_t **builder, uint32_t sample_rate);
+int samd_fingerprint_builder_add(samd_fingerprint_builder_t *builder, const char *name, int16_t *samples, uint32_t num_samples, uint32_t channels);
+int samd_fingerprint_builder_write(samd_fingerprint_builder_t *builder, const char *path);
+void samd_fingerprint_builder_destroy(samd_fingerprint_builder_t **builder);
+
+#endif
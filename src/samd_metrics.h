@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#ifndef SAMD_METRICS_H
+#define SAMD_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "simpleamd.h"
+
+/*
+ * Process wide metrics in Prometheus text format.  Every thread updates its own shard, so
+ * updates never contend; samd_metrics_render() and samd_metrics_get() sum the shards.  A thread's
+ * shard is freed when it exits, and its counts are kept in a shard of retired totals.
+ *
+ * The library counts AMD events by type, frames analyzed by AMDs, active AMDs, and a histogram of
+ * audio time from the start of each call to its first AMD decision.  Applications add their own
+ * metrics with samd_metrics_register() or samd_metrics_register_fn().
+ */
+
+#define SAMD_METRICS_MAX 256
+
+/* built in metrics */
+#define SAMD_METRIC_FRAMES 0
+#define SAMD_METRIC_ACTIVE_DETECTORS 1
+/* one per samd_event_t: SAMD_METRIC_EVENTS + event */
+#define SAMD_METRIC_EVENTS 2
+
+typedef enum samd_metric_type {
+	SAMD_METRIC_COUNTER,
+	SAMD_METRIC_GAUGE
+} samd_metric_type_t;
+
+typedef double (* samd_metric_fn)(void *user_data);
+
+int samd_metrics_register(const char *name, const char *labels, const char *help, samd_metric_type_t type);
+int samd_metrics_register_fn(const char *name, const char *labels, const char *help, samd_metric_type_t type, samd_metric_fn fn, void *user_data);
+void samd_metrics_add(int metric, int64_t value);
+void samd_metrics_observe_decision_ms(uint32_t ms);
+double samd_metrics_get(int metric);
+size_t samd_metrics_render(char *buf, size_t size);
+
+#endif
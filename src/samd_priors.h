@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#ifndef SAMD_PRIORS_H
+#define SAMD_PRIORS_H
+
+#include <stdint.h>
+#include "simpleamd.h"
+
+/*
+ * Persistent noise floor priors.  A file, mapped shared by every process that opens it, holds the
+ * noise floor and energy threshold learned from completed calls per caller supplied key, such as a
+ * trunk group or carrier.  Apply a key's prior to the VAD of a new call with samd_priors_apply() so
+ * it detects voice from the first frame, and learn from the call when it ends with
+ * samd_priors_update().
+ *
+ * File layout: samd_priors_header_t, then num_slots samd_priors_slot_t in an open addressed hash
+ * table.  Slots are never removed.  Each slot is a seqlock: seq is odd while the slot is written.
+ */
+
+#define SAMD_PRIORS_MAGIC 0x50444d53
+#define SAMD_PRIORS_VERSION 1
+#define SAMD_PRIORS_KEY_LEN 40
+
+/* calls averaged over: later calls move a prior by 1 / SAMD_PRIORS_HISTORY */
+#define SAMD_PRIORS_HISTORY 16
+
+typedef struct samd_priors_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_slots;
+	uint8_t pad[64 - 3 * sizeof(uint32_t)];
+} samd_priors_header_t;
+
+typedef struct samd_priors_slot {
+	uint32_t seq;
+	uint32_t calls;
+	double noise_floor;
+	double threshold;
+	/* NUL terminated, longer keys are truncated */
+	char key[SAMD_PRIORS_KEY_LEN];
+} samd_priors_slot_t;
+
+typedef struct samd_priors samd_priors_t;
+
+int samd_priors_open(samd_priors_t **priors, const char *path, uint32_t num_slots);
+int samd_priors_get(samd_priors_t *priors, const char *key, double *noise_floor, double *threshold, uint32_t *calls);
+int samd_priors_put(samd_priors_t *priors, const char *key, double noise_floor, double threshold);
+int samd_priors_apply(samd_priors_t *priors, const char *key, samd_vad_t *vad);
+int samd_priors_update(samd_priors_t *priors, const char *key, samd_vad_t *vad);
+void samd_priors_close(samd_priors_t **priors);
+
+#endif
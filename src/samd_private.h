@@ -7,41 +7,189 @@
 #ifndef SAMD_PRIVATE_H
 #define SAMD_PRIVATE_H
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include "simpleamd.h"
+#include "samd_classifier.h"
+#include "samd_metrics.h"
 
-#define MS_PER_FRAME 10
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
 
-typedef struct samd_frame_analyzer samd_frame_analyzer_t;
+/** default analysis frame duration */
+#define DEFAULT_MS_PER_FRAME 10
 
+/** frame duration the beep detector analyzes zero crossings over */
+#define BEEP_MS_PER_FRAME 10
 
-/** frame analyzer callback function */
-typedef void (* samd_frame_analyzer_cb_fn)(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings);
+/** how the frame analyzer computes frames, only selected by tests and benchmarks */
+typedef enum samd_kernel {
+	SAMD_KERNEL_AUTO,
+	SAMD_KERNEL_SCALAR,
+	SAMD_KERNEL_REFERENCE
+} samd_kernel_t;
+
+/** buckets of the decision time histogram, besides +Inf */
+#define SAMD_DECISION_BUCKETS 9
 
 /**
- * Frame analysis stats
+ * Global stats and metrics counted by one thread
  */
-struct samd_frame_analyzer {
+typedef struct samd_shard {
+	samd_stats_t stats;
+	int64_t metrics[SAMD_METRICS_MAX];
+
+	/** decision time histogram, the last bucket is +Inf */
+	uint64_t decisions[SAMD_DECISION_BUCKETS + 1];
+
+	/** total decision time */
+	uint64_t decision_ms;
+
+	struct samd_shard *next;
+} samd_shard_t;
+
+/** noise floor histogram bins: 4 per octave of energy up to 65535 */
+#define NOISE_FLOOR_BINS 60
+
+/** silence between utterances, shorter gaps are part of an utterance */
+#define CLASSIFIER_PAUSE_MS 100
+
+/**
+ * Summary of the voice heard while detecting, for the classifier
+ */
+typedef struct samd_classifier_state {
+	/** frames since the first voice frame */
+	uint32_t frames;
+
+	/** voice frames */
+	uint32_t voice_frames;
+
+	/** frames up to and including the last voice frame */
+	uint32_t last_voice_frame;
+
+	/** current run of silence frames */
+	uint32_t silence_frames;
+
+	/** utterances, separated by at least CLASSIFIER_PAUSE_MS of silence */
+	uint32_t utterances;
 
+	/** frames from the first voice frame to the end of the first utterance */
+	uint32_t first_utterance_frames;
+
+	/** longest silence between utterances */
+	uint32_t longest_pause_frames;
+
+	/** duration of each frame */
+	uint32_t frame_ms;
+
+	/** sums over voice frames */
+	double energy_sum;
+	double energy_squares;
+	double zero_crossings_sum;
+	double zero_crossings_squares;
+} samd_classifier_state_t;
+
+/**
+ * Frame analyzer subscription
+ */
+typedef struct samd_frame_analyzer_subscriber {
 	/** callback for frame data */
 	samd_frame_analyzer_cb_fn callback;
 
-	/** user data to send to callbacks */
+	/** user data to send to callback */
 	void *user_cb_data;
 
-	/** energy detected in current frame channels (mono or stereo only) */
-	double energy[2];
+	/** channel to receive in split channel mode */
+	uint32_t channel;
+} samd_frame_analyzer_subscriber_t;
+
+/** points of each FFT window, a power of 2: 16 ms at 8 kHz */
+#define SPECTRAL_FFT_SIZE 128
 
-	/** total energy observed */
-	double total_energy;
+/** decimated samples of each channel kept, a power of 2 that holds a 40 ms frame at 8 kHz */
+#define SPECTRAL_RING_SIZE 512
+
+/**
+ * Recent decimated audio and FFT tables for spectral features
+ */
+typedef struct samd_spectral {
+	/** most recent samples of each channel */
+	int16_t ring[SAMD_MAX_CHANNELS][SPECTRAL_RING_SIZE];
+
+	/** next position in ring */
+	uint32_t pos[SAMD_MAX_CHANNELS];
+
+	/** samples being averaged into the next decimated sample */
+	int32_t sum[SAMD_MAX_CHANNELS];
+	uint32_t summed[SAMD_MAX_CHANNELS];
+
+	/** samples added per channel */
+	uint64_t pushed[SAMD_MAX_CHANNELS];
+
+	/** frame number + 1 of the features computed per channel, 0 if none */
+	uint32_t frame[SAMD_MAX_CHANNELS];
+	samd_spectral_features_t features[SAMD_MAX_CHANNELS];
+
+	/** frames the features were computed for */
+	uint64_t computed;
+
+	float window[SPECTRAL_FFT_SIZE];
+	float cos_table[SPECTRAL_FFT_SIZE / 2];
+	float sin_table[SPECTRAL_FFT_SIZE / 2];
+	uint8_t bit_reverse[SPECTRAL_FFT_SIZE];
+} samd_spectral_t;
+
+/**
+ * Frame analysis stats
+ */
+struct samd_frame_analyzer {
+
+	/** callbacks for frame data */
+	samd_frame_analyzer_subscriber_t *subscribers;
+
+	/** number of subscribers */
+	uint32_t num_subscribers;
+
+	/** allocated size of subscribers */
+	uint32_t max_subscribers;
+
+	/** mix channels together or analyze each channel separately */
+	samd_channel_mode_t channel_mode;
+
+	/** sample analysis implementation */
+	samd_kernel_t kernel;
+
+	/** channel of frame being sent to subscribers */
+	uint32_t channel;
+
+	/** channels in the last buffer, for gaps */
+	uint32_t channels;
+
+	/** index per channel of the first sample of the buffer or gap being processed */
+	uint64_t buffer_start_sample;
+
+	/** samples per channel of the buffer or gap processed when the current frame ended */
+	uint32_t buffer_offset;
+
+	/** energy detected in current frame channels (only first two channels in mixed mode) */
+	double energy[SAMD_MAX_CHANNELS];
+
+	/** total energy observed per channel */
+	double total_energy[SAMD_MAX_CHANNELS];
 
 	/** normalizes energy calculation over different sample rates */
 	uint32_t downsample_factor;
 
-	/** last sample processed */
-	int16_t last_sample;
+	/** last sample processed per channel (mixed sample in mixed mode) */
+	int16_t last_sample[SAMD_MAX_CHANNELS];
 
-	/** zero crossings in current frame */
-	uint32_t zero_crossings;
+	/** zero crossings in current frame per channel */
+	uint32_t zero_crossings[SAMD_MAX_CHANNELS];
 
 	/** time running */
 	uint32_t time_ms;
@@ -49,14 +197,26 @@ struct samd_frame_analyzer {
 	/** number of frames processed */
 	uint32_t frames;
 
+	/** number of samples processed per channel */
+	uint64_t total_samples;
+
 	/** number of samples processed in current frame */
 	uint32_t samples;
 
 	uint32_t samples_per_frame;
+
+	/** sample rate of the audio */
+	uint32_t sample_rate;
+
+	/** duration of each frame */
+	uint32_t frame_ms;
+
+	/** spectral feature state, NULL if disabled */
+	samd_spectral_t *spectral;
 };
 
 /** internal VAD state machine function type */
-typedef void (* samd_vad_state_fn)(samd_vad_t *vad, int in_voice);
+typedef samd_vad_event_t (* samd_vad_state_fn)(samd_vad_t *vad, int in_voice);
 
 /**
  * VAD state
@@ -115,6 +275,63 @@ struct samd_vad {
 
 	/** Time when first speech heard */
 	uint32_t initial_voice_time_ms;
+
+	/** duration of the frame being processed */
+	uint32_t frame_ms;
+
+	/** which events are sent to event_handler */
+	samd_vad_event_mode_t event_mode;
+
+	/** interval of SAMD_VAD_SILENCE / SAMD_VAD_VOICE events in edge mode.  0 to disable. */
+	uint32_t heartbeat_ms;
+
+	/** time last event was sent to event_handler */
+	uint32_t last_event_ms;
+
+	/** energy threshold before any adjustment */
+	double initial_threshold;
+
+	/** frames classified as voice */
+	uint64_t voice_frames;
+
+	/** number of SAMD_VAD_VOICE_BEGIN and SAMD_VAD_SILENCE_BEGIN events */
+	uint64_t transitions;
+
+	/** stats already added to global stats */
+	samd_stats_t flushed_stats;
+
+	/** duration of audio the noise floor is tracked over.  0 to disable. */
+	uint32_t noise_floor_window_ms;
+
+	/** percentile of frame energy in the window that is the noise floor */
+	uint32_t noise_floor_percentile;
+
+	/** histogram bin of each frame in the window */
+	uint8_t *noise_floor_ring;
+
+	/** size of noise_floor_ring, set on the first frame */
+	uint32_t noise_floor_frames;
+
+	/** next position in noise_floor_ring */
+	uint32_t noise_floor_pos;
+
+	/** frames in the window */
+	uint32_t noise_floor_count;
+
+	/** frames in the window per energy bin */
+	uint32_t noise_floor_histogram[NOISE_FLOOR_BINS];
+
+	/** current noise floor estimate */
+	double noise_floor;
+
+	/** true once noise_floor has been measured from this call's audio */
+	int noise_floor_measured;
+
+	/** threshold calibrated from the measured noise floor, before any voice adjustment */
+	double measured_threshold;
+
+	/** true if threshold was seeded by samd_vad_set_prior(), so no calibration is needed */
+	int has_prior;
 };
 
 /** internal beep state machine function type */
@@ -154,6 +371,18 @@ struct samd_beep {
 	/** minimum energy observed during potential beep */
 	double min_energy;
 
+	/** energy of frames shorter than BEEP_MS_PER_FRAME being combined */
+	double window_energy;
+
+	/** zero crossings of frames shorter than BEEP_MS_PER_FRAME being combined */
+	uint32_t window_zero_crossings;
+
+	/** number of frames shorter than BEEP_MS_PER_FRAME being combined */
+	uint32_t window_frames;
+
+	/** duration of frames shorter than BEEP_MS_PER_FRAME being combined */
+	uint32_t window_ms;
+
 	/** callback for VAD events */
 	samd_beep_event_fn event_handler;
 
@@ -165,11 +394,90 @@ struct samd_beep {
 
 	/** user data to send to callbacks */
 	void *user_log_data;
+
+	/** number of potential beeps started */
+	uint64_t candidates;
+
+	/** number of potential beeps that were not beeps */
+	uint64_t rejected;
+
+	/** number of beeps detected */
+	uint64_t accepted;
+
+	/** stats already added to global stats */
+	samd_stats_t flushed_stats;
 };
 
 /** Internal AMD state machine function type */
 typedef void (* samd_state_fn)(samd_t *amd, samd_vad_event_t event, int beep);
 
+/** greetings a fingerprinter tracks hits on at once */
+#define FINGERPRINT_CANDIDATES 8
+
+/**
+ * Hits on one greeting at one offset
+ */
+typedef struct samd_fingerprint_candidate {
+	/** greeting in the index, -1 if unused */
+	int32_t greeting;
+
+	/** step of the call minus step of the greeting */
+	int32_t offset;
+
+	/** words matched */
+	uint32_t hits;
+
+	/** step of the last hit */
+	uint32_t last_step;
+} samd_fingerprint_candidate_t;
+
+/**
+ * Computes fingerprint words from frame features
+ */
+typedef struct samd_fingerprinter {
+	/** duration of each step, 0 until the first frame */
+	uint32_t step_ms;
+
+	/** frames per step, 0 if the frame duration doesn't divide the step */
+	uint32_t step_frames;
+
+	/** frames in the current step */
+	uint32_t frames;
+
+	/** voice frames in the current step */
+	uint32_t voice_frames;
+
+	/** energy of the current step */
+	double energy;
+
+	/** zero crossings of the current step */
+	uint32_t zero_crossings;
+
+	/** energy of the previous step */
+	double last_energy;
+
+	/** zero crossings of the previous step */
+	uint32_t last_zero_crossings;
+
+	/** 1 bit per step: energy rose */
+	uint32_t energy_bits;
+
+	/** 1 bit per step: zero crossings rose */
+	uint32_t zero_crossing_bits;
+
+	/** 1 bit per step: step was mostly voice */
+	uint32_t voice_bits;
+
+	/** steps completed */
+	uint32_t steps;
+
+	/** greetings being matched */
+	samd_fingerprint_candidate_t candidates[FINGERPRINT_CANDIDATES];
+
+	/** greeting matched, -1 if none */
+	int32_t match;
+} samd_fingerprinter_t;
+
 /**
  * AMD state
  */
@@ -201,6 +509,15 @@ struct samd {
 	/** callback for AMD events */
 	samd_event_fn event_handler;
 
+	/** callback for AMD events with their position, replaces event_handler if set */
+	samd_event_info_fn event_info_handler;
+
+	/** analyzer sending the current frame */
+	samd_frame_analyzer_t *frame_analyzer;
+
+	/** end of the beep being reported, where samd_event_info_t places SAMD_MACHINE_BEEP.  0 if none. */
+	uint32_t beep_end_ms;
+
 	/** callback for log messages */
 	samd_log_fn log_handler;
 
@@ -215,25 +532,157 @@ struct samd {
 
 	/** user data to send to callbacks */
 	void *user_log_data;
+
+	/** true if events are stored in event_records instead of sent to event_handler */
+	int collect_events;
+
+	/** caller's array to store events */
+	samd_event_record_t *event_records;
+
+	/** size of event_records */
+	size_t max_event_records;
+
+	/** number of events detected while collecting */
+	size_t num_event_records;
+
+	/** true after the first event */
+	int decided;
+
+	/** 0 human - 1 machine, 0.5 without evidence */
+	double likelihood;
+
+	/** confidence to send provisional events at, 0 to disable */
+	double provisional_confidence;
+
+	/** bit (1 << event) set for each provisional event sent */
+	uint32_t provisional_sent;
+
+	/** number of state machine transitions */
+	uint64_t transitions;
+
+	/** true if cycles spent in each stage are counted */
+	int measure_cycles;
+
+	/** cycles spent in each stage, if measured */
+	uint64_t analyzer_cycles;
+	uint64_t vad_cycles;
+	uint64_t beep_cycles;
+	uint64_t amd_cycles;
+
+	/** stats already added to global stats */
+	samd_stats_t flushed_stats;
+
+	/** ring of recent frames, NULL if not recording */
+	samd_recorder_frame_t *recorder;
+
+	/** size of recorder */
+	uint32_t recorder_size;
+
+	/** next position to record */
+	uint32_t recorder_pos;
+
+	/** number of frames recorded, up to recorder_size */
+	uint32_t recorder_frames;
+
+	/** known greetings, NULL if not fingerprinting */
+	struct samd_fingerprint_index *fingerprint_index;
+
+	/** fingerprint of this call */
+	samd_fingerprinter_t fingerprinter;
+
+	/** sum of spectral features of voice frames while detecting */
+	samd_spectral_features_t spectral_sum;
+
+	/** number of frames in spectral_sum */
+	uint32_t spectral_frames;
+
+	/** model for ambiguous calls, NULL to decide by duration alone */
+	const samd_classifier_model_t *classifier;
+
+	/** voice the classifier decides between, 0 for the defaults */
+	uint32_t classifier_min_ms;
+	uint32_t classifier_max_ms;
+
+	/** summary of the voice heard while detecting */
+	samd_classifier_state_t classifier_state;
+
+	/** true once the classifier has been asked at machine_ms */
+	int classifier_asked;
+
+	/** features the classifier was first asked with, if have_classifier_features */
+	int have_classifier_features;
+	double classifier_features[SAMD_CLASSIFIER_FEATURES];
 };
 
+/**
+ * USDT probes in the simpleamd provider, compiled in with --enable-usdt.  Arguments are integers
+ * so any tracer can read them: energies are truncated.  Without USDT the arguments aren't evaluated.
+ */
+#ifdef SAMD_USDT
+#include <sys/sdt.h>
+#define SAMD_PROBE2(name, a1, a2) DTRACE_PROBE2(simpleamd, name, a1, a2)
+#define SAMD_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(simpleamd, name, a1, a2, a3)
+#define SAMD_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(simpleamd, name, a1, a2, a3, a4)
+#define SAMD_PROBE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(simpleamd, name, a1, a2, a3, a4, a5)
+#else
+#define SAMD_PROBE2(name, a1, a2)
+#define SAMD_PROBE3(name, a1, a2, a3)
+#define SAMD_PROBE4(name, a1, a2, a3, a4)
+#define SAMD_PROBE5(name, a1, a2, a3, a4, a5)
+#endif
+
 /**
  * Send a log message
  */
 #define samd_log_printf(obj, level, format_string, ...)  _samd_log_printf(obj->log_handler, level, obj->user_log_data, __FILE__, __LINE__, format_string, __VA_ARGS__)
 void _samd_log_printf(samd_log_fn log_handler, samd_log_level_t level, void *user_data, const char *file, int line, const char *format_string, ...);
 
-void samd_frame_analyzer_init(samd_frame_analyzer_t **analyzer);
-void samd_frame_analyzer_set_callback(samd_frame_analyzer_t *analyzer, samd_frame_analyzer_cb_fn cb, void *user_cb_data);
-void samd_frame_analyzer_set_sample_rate(samd_frame_analyzer_t *analyzer, uint32_t sample_rate);
-void samd_frame_analyzer_process_buffer(samd_frame_analyzer_t *analyzer, int16_t *samples, uint32_t num_samples, uint32_t channels);
-double samd_frame_analyzer_get_average_energy(samd_frame_analyzer_t *analyzer);
-void samd_frame_analyzer_destroy(samd_frame_analyzer_t **analyzer);
-
 void samd_vad_init_internal(samd_vad_t **vad);
-void samd_vad_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings);
+samd_vad_event_t samd_vad_process_frame_internal(samd_frame_analyzer_t *analyzer, samd_vad_t *vad, uint32_t time_ms, double energy, uint32_t zero_crossings);
+void samd_vad_send_event(samd_vad_t *vad, samd_vad_event_t event);
+samd_recorder_vad_state_t samd_vad_get_recorder_state(samd_vad_t *vad);
 
 void samd_beep_init_internal(samd_beep_t **beep);
-void samd_beep_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings);
+
+void samd_frame_analyzer_set_kernel(samd_frame_analyzer_t *analyzer, samd_kernel_t kernel);
+void samd_frame_analyzer_add_stats(samd_frame_analyzer_t *analyzer, samd_stats_t *stats);
+void samd_vad_add_stats(samd_vad_t *vad, samd_stats_t *stats);
+void samd_beep_add_stats(samd_beep_t *beep, samd_stats_t *stats);
+void samd_stats_flush(const samd_stats_t *stats, samd_stats_t *flushed_stats);
+
+samd_shard_t *samd_shard(void);
+samd_shard_t *samd_shard_retired(void);
+void samd_shard_for_each(void (*fn)(const samd_shard_t *shard, void *user_data), void *user_data);
+void samd_stats_retire(samd_shard_t *retired, const samd_shard_t *shard);
+void samd_metrics_retire(samd_shard_t *retired, const samd_shard_t *shard);
+
+samd_spectral_t *samd_spectral_create(void);
+void samd_spectral_push(samd_spectral_t *spectral, uint32_t channel, const int16_t *samples, uint32_t num_samples, uint32_t downsample_factor);
+void samd_spectral_push_silence(samd_spectral_t *spectral, uint32_t channel, uint64_t num_samples, uint32_t downsample_factor);
+void samd_spectral_compute(samd_spectral_t *spectral, uint32_t channel, uint32_t sample_rate, uint32_t frame_samples, samd_spectral_features_t *features);
+
+void samd_classifier_state_reset(samd_classifier_state_t *state);
+void samd_classifier_state_frame(samd_classifier_state_t *state, uint32_t frame_ms, double energy, uint32_t zero_crossings, int in_voice);
+void samd_classifier_state_features(const samd_classifier_state_t *state, double *features);
+
+void samd_fingerprinter_reset(samd_fingerprinter_t *fingerprinter, uint32_t step_ms, uint32_t frame_ms);
+int samd_fingerprinter_process_frame(samd_fingerprinter_t *fingerprinter, double energy, uint32_t zero_crossings, int in_voice, uint32_t *word);
+int32_t samd_fingerprint_index_match(struct samd_fingerprint_index *index, samd_fingerprinter_t *fingerprinter, uint32_t word);
+const char *samd_fingerprint_index_get_name(struct samd_fingerprint_index *index, int32_t greeting);
+uint32_t samd_fingerprint_index_get_step_ms(struct samd_fingerprint_index *index);
+
+/**
+ * @return CPU timestamp counter, or monotonic ns where there isn't one
+ */
+static inline uint64_t samd_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
 
 #endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#ifndef SAMD_SHM_H
+#define SAMD_SHM_H
+
+#include <stdint.h>
+#include "simpleamd.h"
+
+/*
+ * Shared memory ingest.  A media server creates a region of per-call audio rings with
+ * samd_shm_create() and hands it to a simpleamd-shm worker process with samd_shm_attach_worker().
+ * Audio written to a ring is analyzed in place by the worker and decisions are written back to the
+ * call's result slot.  Both sides signal each other with eventfds, so a single notification can
+ * cover any number of calls.
+ *
+ * Region layout: samd_shm_header_t, dirty bitmap (one bit per slot), then num_slots slots of
+ * slot_size bytes, each a samd_shm_slot_t followed by ring_samples int16_t samples.
+ */
+
+#define SAMD_SHM_MAGIC 0x444d4153
+#define SAMD_SHM_VERSION 1
+#define SAMD_SHM_ALIGN 64
+
+typedef enum samd_shm_slot_state {
+	SAMD_SHM_SLOT_FREE,
+	SAMD_SHM_SLOT_ACTIVE,
+	SAMD_SHM_SLOT_CLOSING
+} samd_shm_slot_state_t;
+
+typedef struct samd_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_slots;
+	uint32_t slot_size;
+	uint32_t ring_samples;
+	uint32_t sample_rate;
+	uint32_t slots_offset;
+	uint8_t pad[SAMD_SHM_ALIGN - 7 * sizeof(uint32_t)];
+	/* followed by dirty bitmap */
+	uint64_t dirty[];
+} samd_shm_header_t;
+
+typedef struct samd_shm_slot {
+	/* owned by media server, except CLOSING -> FREE */
+	uint32_t state;
+	uint32_t generation;
+	uint8_t pad0[SAMD_SHM_ALIGN - 2 * sizeof(uint32_t)];
+
+	/* samples written, free running.  Owned by media server. */
+	uint32_t write_pos;
+	uint8_t pad1[SAMD_SHM_ALIGN - sizeof(uint32_t)];
+
+	/* samples analyzed, free running.  Owned by worker. */
+	uint32_t read_pos;
+	uint8_t pad2[SAMD_SHM_ALIGN - sizeof(uint32_t)];
+
+	/* results, owned by worker.  result_seq is odd while an event is being written. */
+	uint32_t result_seq;
+	uint32_t first_event;
+	uint32_t first_time_ms;
+	uint32_t last_event;
+	uint32_t last_time_ms;
+	uint8_t pad3[SAMD_SHM_ALIGN - 5 * sizeof(uint32_t)];
+
+	/* followed by ring_samples samples */
+	int16_t samples[];
+} samd_shm_slot_t;
+
+typedef struct samd_shm samd_shm_t;
+
+int samd_shm_create(samd_shm_t **shm, uint32_t num_slots, uint32_t ring_ms, uint32_t sample_rate);
+int samd_shm_attach_worker(samd_shm_t *shm, const char *socket_path);
+int samd_shm_open_call(samd_shm_t *shm);
+uint32_t samd_shm_write(samd_shm_t *shm, int slot, const int16_t *samples, uint32_t num_samples);
+void samd_shm_notify(samd_shm_t *shm);
+int samd_shm_get_result(samd_shm_t *shm, int slot, samd_event_record_t *first, samd_event_record_t *last);
+int samd_shm_get_result_fd(samd_shm_t *shm);
+void samd_shm_close_call(samd_shm_t *shm, int slot);
+int samd_shm_call_closed(samd_shm_t *shm, int slot);
+void samd_shm_destroy(samd_shm_t **shm);
+
+/** helpers shared by the media server and worker */
+static inline samd_shm_slot_t *samd_shm_get_slot(samd_shm_header_t *header, uint32_t slot)
+{
+	return (samd_shm_slot_t *)((uint8_t *)header + header->slots_offset + (size_t)slot * header->slot_size);
+}
+
+static inline size_t samd_shm_region_size(uint32_t num_slots, uint32_t ring_samples, uint32_t *slots_offset, uint32_t *slot_size)
+{
+	*slots_offset = (sizeof(samd_shm_header_t) + ((num_slots + 63) / 64) * sizeof(uint64_t) + SAMD_SHM_ALIGN - 1) & ~(SAMD_SHM_ALIGN - 1);
+	*slot_size = (sizeof(samd_shm_slot_t) + ring_samples * sizeof(int16_t) + SAMD_SHM_ALIGN - 1) & ~(SAMD_SHM_ALIGN - 1);
+	return *slots_offset + (size_t)num_slots * *slot_size;
+}
+
+#endif
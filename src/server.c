@@ -0,0 +1,749 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * simpleamd-server: receives forked call audio as RTP over UDP and runs an AMD per stream.
+ *
+ * One worker thread per core, each with its own SO_REUSEPORT socket and epoll loop.  The kernel
+ * hashes each sender to one socket, so a stream always lands on the same worker and sessions
+ * are never shared between threads.  Streams are demultiplexed by SSRC, G.711 payloads are
+ * decoded, and a small jitter buffer restores packet order and conceals loss.  Time skipped in
+ * RTP timestamps, by loss, silence suppression or DTX, is given to the AMD as a gap.  AMD events are
+ * written as JSON lines to every client connected to the event Unix socket.  Metrics are served
+ * in Prometheus text format over HTTP on a TCP or Unix socket, if configured.
+ */
+
+#define _GNU_SOURCE
+#include <simpleamd.h>
+#include <samd_metrics.h>
+#include "g711.h"
+#include "rtp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#define MAX_PACKET_SIZE 1500
+#define MAX_PAYLOAD_SIZE (MAX_PACKET_SIZE - RTP_HEADER_SIZE)
+#define RECV_BATCH_SIZE 32
+/* a power of two, so slots of any -j fit */
+#define MAX_JITTER_DEPTH 16
+#define MAX_CONCEALED_PACKETS 50
+/* G.711 RTP clock, samples per ms */
+#define RTP_SAMPLES_PER_MS 8
+#define MAX_EVENT_CLIENTS 64
+#define MAX_EVENT_SIZE 256
+#define SESSION_BUCKETS 4096
+#define METRICS_BUFFER_SIZE 65536
+
+/** server configuration */
+static struct {
+	const char *address;
+	int port;
+	int num_workers;
+	const char *event_socket_path;
+	int jitter_depth;
+	int idle_timeout;
+	int machine_ms;
+	int wait_for_voice_ms;
+	int debug;
+	const char *metrics_listen;
+	/** jitter_depth rounded up to a power of two, so slot order survives the sequence number wrap */
+	int jitter_slots;
+} config = { "127.0.0.1", 7000, 0, "/tmp/simpleamd.sock", 4, 10, 1100, 2000, 0, NULL, 0 };
+
+/** server metrics, updated by workers */
+static struct {
+	int packets;
+	int lost;
+	int late;
+} metrics = { -1, -1, -1 };
+
+static volatile sig_atomic_t running = 1;
+
+/** clients receiving events */
+static struct {
+	pthread_mutex_t mutex;
+	int fds[MAX_EVENT_CLIENTS];
+	int num_fds;
+} event_clients = { PTHREAD_MUTEX_INITIALIZER, { 0 }, 0 };
+
+/** reordering slot */
+/** jitter buffer slot of a sequence number */
+#define JITTER_SLOT(session, seq) (&(session)->jitter[(uint16_t)(seq) & (config.jitter_slots - 1)])
+
+struct jitter_slot {
+	int used;
+	uint16_t seq;
+	uint32_t timestamp;
+	uint8_t payload_type;
+	uint16_t len;
+	uint8_t payload[MAX_PAYLOAD_SIZE];
+};
+
+struct worker;
+
+/** one RTP stream */
+struct session {
+	uint32_t ssrc;
+	samd_t *amd;
+	struct worker *worker;
+	uint16_t next_seq;
+	/** RTP timestamp of the first sample not yet given to the AMD, if next_timestamp_valid */
+	uint32_t next_timestamp;
+	int next_timestamp_valid;
+	uint32_t last_len;
+	time_t last_packet_time;
+	uint32_t packets;
+	uint32_t lost;
+	uint32_t late;
+	struct jitter_slot jitter[MAX_JITTER_DEPTH];
+	struct session *next;
+};
+
+/** one receive thread */
+struct worker {
+	int id;
+	pthread_t thread;
+	int sock;
+	int epoll_fd;
+	int timer_fd;
+	uint32_t num_sessions;
+	struct session *sessions[SESSION_BUCKETS];
+	char metric_labels[32];
+};
+
+static void logger(samd_log_level_t level, void *user_log_data, const char *file, int line, const char *message)
+{
+	struct session *session = (struct session *)user_log_data;
+	fprintf(stderr, "%08x\t%s:%d\t%s", session->ssrc, file, line, message);
+}
+
+/**
+ * Send an event line to all connected clients.  Slow or disconnected clients are dropped.
+ */
+static void event_broadcast(const char *line, size_t len)
+{
+	int i;
+	pthread_mutex_lock(&event_clients.mutex);
+	for (i = 0; i < event_clients.num_fds; i++) {
+		if (send(event_clients.fds[i], line, len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)len) {
+			close(event_clients.fds[i]);
+			event_clients.fds[i--] = event_clients.fds[--event_clients.num_fds];
+		}
+	}
+	pthread_mutex_unlock(&event_clients.mutex);
+}
+
+static void session_event(struct session *session, const char *event, uint32_t time_ms)
+{
+	char line[MAX_EVENT_SIZE];
+	int len = snprintf(line, sizeof(line), "{\"ssrc\":\"%08x\",\"worker\":%d,\"event\":\"%s\",\"time_ms\":%u,\"packets\":%u,\"lost\":%u,\"late\":%u}\n",
+		session->ssrc, session->worker->id, event, time_ms, session->packets, session->lost, session->late);
+	event_broadcast(line, len);
+}
+
+static void amd_event_handler(samd_event_t event, uint32_t time_ms, void *user_event_data)
+{
+	session_event((struct session *)user_event_data, samd_event_to_string(event), time_ms);
+}
+
+static struct session *session_create(struct worker *worker, uint32_t ssrc, uint16_t seq)
+{
+	struct session *session = (struct session *)calloc(1, sizeof(*session));
+	uint32_t bucket = ssrc % SESSION_BUCKETS;
+
+	session->ssrc = ssrc;
+	session->worker = worker;
+	session->next_seq = seq;
+	samd_init(&session->amd);
+	samd_set_machine_ms(session->amd, config.machine_ms);
+	samd_set_wait_for_voice_ms(session->amd, config.wait_for_voice_ms);
+	samd_set_event_handler(session->amd, amd_event_handler, session);
+	if (config.debug) {
+		samd_set_log_handler(session->amd, logger, session);
+	}
+
+	session->next = worker->sessions[bucket];
+	worker->sessions[bucket] = session;
+	worker->num_sessions++;
+	return session;
+}
+
+static struct session *session_find(struct worker *worker, uint32_t ssrc)
+{
+	struct session *session;
+	for (session = worker->sessions[ssrc % SESSION_BUCKETS]; session; session = session->next) {
+		if (session->ssrc == ssrc) {
+			return session;
+		}
+	}
+	return NULL;
+}
+
+static void session_destroy(struct session *session)
+{
+	session_event(session, "END", 0);
+	samd_destroy(&session->amd);
+	free(session);
+}
+
+/**
+ * Advance the AMD through a gap without audio, keeping any fraction of a ms for the next gap
+ */
+static void session_process_gap(struct session *session, uint32_t samples)
+{
+	uint32_t ms = samples / RTP_SAMPLES_PER_MS;
+	if (ms) {
+		samd_process_gap(session->amd, ms, 0.0);
+		session->next_timestamp += ms * RTP_SAMPLES_PER_MS;
+	}
+}
+
+/**
+ * Decode payload and send to AMD.  Time the sender skipped, with silence suppression or DTX, is
+ * given to the AMD as a gap first, so wait_for_voice_ms and voice end still expire.
+ */
+static void session_process_payload(struct session *session, uint32_t timestamp, uint8_t payload_type, const uint8_t *payload, uint32_t len)
+{
+	int16_t samples[MAX_PAYLOAD_SIZE];
+	int32_t shortfall = (int32_t)(timestamp - session->next_timestamp);
+	if (session->next_timestamp_valid && shortfall > 0 && shortfall <= config.idle_timeout * 1000 * RTP_SAMPLES_PER_MS) {
+		session_process_gap(session, shortfall);
+	}
+	session->next_timestamp = timestamp + len;
+	session->next_timestamp_valid = 1;
+	if (payload_type == RTP_PT_PCMA) {
+		g711_alaw_decode(samples, payload, len);
+	} else {
+		g711_ulaw_decode(samples, payload, len);
+	}
+	samd_process_buffer(session->amd, samples, len, 1);
+	session->last_len = len;
+}
+
+/**
+ * Replace a lost packet with a gap the size of the previous packet so detector timing is preserved.
+ * If the guess is short, the next packet's timestamp makes up the rest.
+ */
+static void session_conceal_loss(struct session *session)
+{
+	session->lost++;
+	samd_metrics_add(metrics.lost, 1);
+	if (session->last_len) {
+		session_process_gap(session, session->last_len);
+	}
+}
+
+/**
+ * Process the next expected packet, or conceal it if missing
+ */
+static void jitter_advance(struct session *session)
+{
+	struct jitter_slot *slot = JITTER_SLOT(session, session->next_seq);
+	if (slot->used && slot->seq == session->next_seq) {
+		session_process_payload(session, slot->timestamp, slot->payload_type, slot->payload, slot->len);
+		slot->used = 0;
+	} else {
+		session_conceal_loss(session);
+	}
+	session->next_seq++;
+}
+
+/**
+ * Process all buffered packets without concealing gaps between them
+ */
+static void jitter_flush(struct session *session)
+{
+	int i;
+	for (i = 0; i < config.jitter_slots; i++, session->next_seq++) {
+		struct jitter_slot *slot = JITTER_SLOT(session, session->next_seq);
+		if (slot->used) {
+			session_process_payload(session, slot->timestamp, slot->payload_type, slot->payload, slot->len);
+			slot->used = 0;
+		}
+	}
+}
+
+/**
+ * Insert packet into jitter buffer and process all in-order packets
+ */
+static void session_receive(struct session *session, const rtp_header_t *header, const uint8_t *payload, uint32_t len)
+{
+	int16_t ahead = (int16_t)(header->seq - session->next_seq);
+	struct jitter_slot *slot;
+
+	session->packets++;
+	session->last_packet_time = time(NULL);
+	samd_metrics_add(metrics.packets, 1);
+
+	if (ahead < 0 && ahead > -MAX_CONCEALED_PACKETS) {
+		/* already processed or concealed */
+		session->late++;
+		samd_metrics_add(metrics.late, 1);
+		return;
+	}
+	if (ahead < 0 || ahead >= MAX_CONCEALED_PACKETS) {
+		/* stream discontinuity - flush and resync */
+		jitter_flush(session);
+		session->next_seq = header->seq;
+		session->next_timestamp_valid = 0;
+		ahead = 0;
+	}
+	while (ahead >= config.jitter_depth) {
+		/* give up waiting for oldest missing packet */
+		jitter_advance(session);
+		ahead--;
+	}
+
+	slot = JITTER_SLOT(session, header->seq);
+	slot->used = 1;
+	slot->seq = header->seq;
+	slot->timestamp = header->timestamp;
+	slot->payload_type = header->payload_type;
+	slot->len = len;
+	memcpy(slot->payload, payload, len);
+
+	/* process everything that is now in order */
+	while (JITTER_SLOT(session, session->next_seq)->used && JITTER_SLOT(session, session->next_seq)->seq == session->next_seq) {
+		jitter_advance(session);
+	}
+}
+
+static void worker_handle_packet(struct worker *worker, const uint8_t *packet, uint32_t len)
+{
+	rtp_header_t header;
+	const uint8_t *payload;
+	uint32_t payload_len;
+	struct session *session;
+
+	if (!rtp_parse(packet, len, &header, &payload, &payload_len) || payload_len == 0) {
+		return;
+	}
+	if (header.payload_type != RTP_PT_PCMU && header.payload_type != RTP_PT_PCMA) {
+		/* DTMF, comfort noise, etc */
+		return;
+	}
+	session = session_find(worker, header.ssrc);
+	if (!session) {
+		session = session_create(worker, header.ssrc, header.seq);
+	}
+	session_receive(session, &header, payload, payload_len);
+}
+
+/**
+ * Remove sessions that stopped sending
+ */
+static void worker_reap_sessions(struct worker *worker)
+{
+	time_t now = time(NULL);
+	uint32_t i;
+	for (i = 0; i < SESSION_BUCKETS; i++) {
+		struct session **prev = &worker->sessions[i];
+		while (*prev) {
+			struct session *session = *prev;
+			if (now - session->last_packet_time >= config.idle_timeout) {
+				*prev = session->next;
+				worker->num_sessions--;
+				session_destroy(session);
+			} else {
+				prev = &session->next;
+			}
+		}
+	}
+}
+
+static void worker_receive(struct worker *worker)
+{
+	static __thread uint8_t buffers[RECV_BATCH_SIZE][MAX_PACKET_SIZE];
+	struct mmsghdr msgs[RECV_BATCH_SIZE];
+	struct iovec iovecs[RECV_BATCH_SIZE];
+	int i;
+	int n;
+
+	for (i = 0; i < RECV_BATCH_SIZE; i++) {
+		iovecs[i].iov_base = buffers[i];
+		iovecs[i].iov_len = MAX_PACKET_SIZE;
+		memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while ((n = recvmmsg(worker->sock, msgs, RECV_BATCH_SIZE, MSG_DONTWAIT, NULL)) > 0) {
+		for (i = 0; i < n; i++) {
+			worker_handle_packet(worker, buffers[i], msgs[i].msg_len);
+		}
+	}
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *worker = (struct worker *)arg;
+	struct epoll_event events[2];
+	cpu_set_t cpus;
+	uint32_t i;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(worker->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	while (running) {
+		int n = epoll_wait(worker->epoll_fd, events, 2, 1000);
+		int j;
+		for (j = 0; j < n; j++) {
+			if (events[j].data.fd == worker->sock) {
+				worker_receive(worker);
+			} else if (events[j].data.fd == worker->timer_fd) {
+				uint64_t expirations;
+				if (read(worker->timer_fd, &expirations, sizeof(expirations)) > 0) {
+					worker_reap_sessions(worker);
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < SESSION_BUCKETS; i++) {
+		while (worker->sessions[i]) {
+			struct session *session = worker->sessions[i];
+			worker->sessions[i] = session->next;
+			session_destroy(session);
+		}
+	}
+	return NULL;
+}
+
+static int worker_init(struct worker *worker, int id)
+{
+	struct sockaddr_in addr = { 0 };
+	struct itimerspec interval = { { 1, 0 }, { 1, 0 } };
+	struct epoll_event event = { 0 };
+	int on = 1;
+
+	worker->id = id;
+	worker->sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (worker->sock < 0) {
+		perror("socket");
+		return -1;
+	}
+	setsockopt(worker->sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(config.port);
+	if (inet_pton(AF_INET, config.address, &addr.sin_addr) != 1) {
+		fprintf(stderr, "Invalid address %s\n", config.address);
+		return -1;
+	}
+	if (bind(worker->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return -1;
+	}
+
+	worker->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	timerfd_settime(worker->timer_fd, 0, &interval, NULL);
+
+	worker->epoll_fd = epoll_create1(0);
+	event.events = EPOLLIN;
+	event.data.fd = worker->sock;
+	epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->sock, &event);
+	event.data.fd = worker->timer_fd;
+	epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->timer_fd, &event);
+	return 0;
+}
+
+static int event_socket_init(void)
+{
+	struct sockaddr_un addr = { 0 };
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, config.event_socket_path, sizeof(addr.sun_path) - 1);
+	unlink(config.event_socket_path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+		perror(config.event_socket_path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static double worker_cpu_seconds(void *user_data)
+{
+	struct worker *worker = (struct worker *)user_data;
+	struct timespec cpu = { 0 };
+	clockid_t clock_id;
+	if (pthread_getcpuclockid(worker->thread, &clock_id) == 0) {
+		clock_gettime(clock_id, &cpu);
+	}
+	return cpu.tv_sec + cpu.tv_nsec / 1e9;
+}
+
+static double worker_sessions(void *user_data)
+{
+	return ((struct worker *)user_data)->num_sessions;
+}
+
+static void metrics_init(struct worker *workers)
+{
+	int i;
+	metrics.packets = samd_metrics_register("simpleamd_server_packets_total", "", "RTP audio packets received.", SAMD_METRIC_COUNTER);
+	metrics.lost = samd_metrics_register("simpleamd_server_packets_lost_total", "", "Missing RTP packets replaced with silence.", SAMD_METRIC_COUNTER);
+	metrics.late = samd_metrics_register("simpleamd_server_packets_late_total", "", "RTP packets dropped because they arrived too late.", SAMD_METRIC_COUNTER);
+	for (i = 0; i < config.num_workers; i++) {
+		snprintf(workers[i].metric_labels, sizeof(workers[i].metric_labels), "worker=\"%d\"", i);
+		samd_metrics_register_fn("simpleamd_server_sessions", workers[i].metric_labels, i ? NULL : "Active RTP streams.", SAMD_METRIC_GAUGE, worker_sessions, &workers[i]);
+	}
+	for (i = 0; i < config.num_workers; i++) {
+		samd_metrics_register_fn("simpleamd_server_worker_cpu_seconds_total", workers[i].metric_labels, i ? NULL : "CPU time used by each worker thread.", SAMD_METRIC_COUNTER, worker_cpu_seconds, &workers[i]);
+	}
+}
+
+/**
+ * Listen for metrics scrapes on a Unix socket path or host:port
+ */
+static int metrics_socket_init(void)
+{
+	const char *listen_on = config.metrics_listen;
+	int fd = -1;
+	int on = 1;
+
+	if (listen_on[0] == '/') {
+		struct sockaddr_un addr = { 0 };
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, listen_on, sizeof(addr.sun_path) - 1);
+		unlink(listen_on);
+		if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+			perror(listen_on);
+			goto fail;
+		}
+	} else {
+		struct addrinfo hints = { 0 };
+		struct addrinfo *res = NULL;
+		char host[256];
+		const char *port = strrchr(listen_on, ':');
+		if (!port || port - listen_on >= (ptrdiff_t)sizeof(host)) {
+			fprintf(stderr, "Invalid metrics address %s, expected host:port or /path\n", listen_on);
+			return -1;
+		}
+		memcpy(host, listen_on, port - listen_on);
+		host[port - listen_on] = '\0';
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		if (getaddrinfo(host[0] ? host : NULL, port + 1, &hints, &res) != 0) {
+			fprintf(stderr, "Invalid metrics address %s\n", listen_on);
+			return -1;
+		}
+		fd = socket(res->ai_family, SOCK_STREAM, 0);
+		if (fd >= 0) {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		}
+		if (fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) < 0 || listen(fd, 16) < 0) {
+			perror(listen_on);
+			freeaddrinfo(res);
+			goto fail;
+		}
+		freeaddrinfo(res);
+	}
+	return fd;
+
+fail:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+/**
+ * Answer one HTTP request with all metrics.  Scrapes are small and local, so this is done
+ * synchronously with a short timeout.
+ */
+static void metrics_serve(int client)
+{
+	static char body[METRICS_BUFFER_SIZE];
+	char request[1024];
+	char header[256];
+	struct timeval timeout = { 1, 0 };
+	size_t len;
+	int header_len;
+
+	/* the request is not parsed, any path returns the metrics */
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	if (recv(client, request, sizeof(request), 0) <= 0) {
+		close(client);
+		return;
+	}
+	len = samd_metrics_render(body, sizeof(body));
+	if (len >= sizeof(body)) {
+		len = sizeof(body) - 1;
+	}
+	header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", len);
+	if (send(client, header, header_len, MSG_NOSIGNAL) == header_len) {
+		send(client, body, len, MSG_NOSIGNAL);
+	}
+	close(client);
+}
+
+static void stop(int sig)
+{
+	running = 0;
+}
+
+#define USAGE "simpleamd-server [options]"
+#define HELP USAGE"\n" \
+	"\t-a <address> Address to receive RTP (default 127.0.0.1)\n" \
+	"\t-p <port> Port to receive RTP (default 7000)\n" \
+	"\t-t <threads> Number of worker threads (default one per core)\n" \
+	"\t-u <path> Unix socket for JSON events (default /tmp/simpleamd.sock)\n" \
+	"\t-j <packets> Jitter buffer depth, 1 - 16 (default 4)\n" \
+	"\t-T <seconds> End sessions idle this long (default 10)\n" \
+	"\t-m <amd machine ms> Voice longer than this time is classified as machine (default 1100)\n" \
+	"\t-w <amd wait for voice ms> How long to wait for voice to begin (default 2000)\n" \
+	"\t-M <host:port|path> Serve Prometheus metrics over HTTP on this TCP address or Unix socket\n" \
+	"\t-d Enable debug logging\n"
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	struct sigaction sa = { 0 };
+	struct pollfd listeners[2];
+	int num_listeners = 1;
+	int event_fd;
+	int metrics_fd = -1;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "a:p:t:u:j:T:m:w:M:dh")) != -1) {
+		switch (opt) {
+			case 'a': config.address = optarg; break;
+			case 'p': config.port = atoi(optarg); break;
+			case 't': config.num_workers = atoi(optarg); break;
+			case 'u': config.event_socket_path = optarg; break;
+			case 'j': config.jitter_depth = atoi(optarg); break;
+			case 'T': config.idle_timeout = atoi(optarg); break;
+			case 'm': config.machine_ms = atoi(optarg); break;
+			case 'w': config.wait_for_voice_ms = atoi(optarg); break;
+			case 'M': config.metrics_listen = optarg; break;
+			case 'd': config.debug = 1; break;
+			default:
+				printf("%s", HELP);
+				exit(EXIT_SUCCESS);
+		}
+	}
+	if (config.jitter_depth < 1 || config.jitter_depth > MAX_JITTER_DEPTH) {
+		fprintf(stderr, "option -j (jitter buffer depth) must be 1 - %d\n", MAX_JITTER_DEPTH);
+		exit(EXIT_FAILURE);
+	}
+	for (config.jitter_slots = 1; config.jitter_slots < config.jitter_depth; config.jitter_slots <<= 1) {
+	}
+	if (config.num_workers <= 0) {
+		config.num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	g711_init();
+
+	/* interrupt poll() to shut down */
+	sa.sa_handler = stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	event_fd = event_socket_init();
+	if (event_fd < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	workers = (struct worker *)calloc(config.num_workers, sizeof(*workers));
+	for (i = 0; i < config.num_workers; i++) {
+		if (worker_init(&workers[i], i) < 0) {
+			exit(EXIT_FAILURE);
+		}
+	}
+	metrics_init(workers);
+	if (config.metrics_listen) {
+		metrics_fd = metrics_socket_init();
+		if (metrics_fd < 0) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < config.num_workers; i++) {
+		pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+	}
+	fprintf(stderr, "receiving RTP on %s:%d with %d workers, events on %s\n", config.address, config.port, config.num_workers, config.event_socket_path);
+	if (config.metrics_listen) {
+		fprintf(stderr, "metrics on %s\n", config.metrics_listen);
+	}
+
+	listeners[0].fd = event_fd;
+	listeners[0].events = POLLIN;
+	if (metrics_fd >= 0) {
+		listeners[1].fd = metrics_fd;
+		listeners[1].events = POLLIN;
+		num_listeners = 2;
+	}
+	while (running) {
+		int client;
+		if (poll(listeners, num_listeners, -1) <= 0) {
+			continue;
+		}
+		if (num_listeners > 1 && (listeners[1].revents & POLLIN)) {
+			client = accept(metrics_fd, NULL, NULL);
+			if (client >= 0) {
+				metrics_serve(client);
+			}
+		}
+		if (!(listeners[0].revents & POLLIN)) {
+			continue;
+		}
+		client = accept(event_fd, NULL, NULL);
+		if (client < 0) {
+			continue;
+		}
+		pthread_mutex_lock(&event_clients.mutex);
+		if (event_clients.num_fds < MAX_EVENT_CLIENTS) {
+			event_clients.fds[event_clients.num_fds++] = client;
+		} else {
+			close(client);
+		}
+		pthread_mutex_unlock(&event_clients.mutex);
+	}
+
+	for (i = 0; i < config.num_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].sock);
+		close(workers[i].timer_fd);
+		close(workers[i].epoll_fd);
+	}
+	free(workers);
+	close(event_fd);
+	unlink(config.event_socket_path);
+	if (metrics_fd >= 0) {
+		close(metrics_fd);
+		if (config.metrics_listen[0] == '/') {
+			unlink(config.metrics_listen);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
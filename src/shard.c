@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "samd_private.h"
+
+/** shards of running threads.  Readers and threads joining or leaving hold shards_mutex. */
+static samd_shard_t *shards = NULL;
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** counts of exited threads, and of threads that couldn't get a shard */
+static samd_shard_t retired;
+
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static int shard_key_ok = 0;
+
+static __thread samd_shard_t *thread_shard = NULL;
+
+/**
+ * Fold an exiting thread's counts into the retired shard and free its shard
+ * @param data the shard
+ */
+static void shard_destroy(void *data)
+{
+	samd_shard_t *shard = (samd_shard_t *)data;
+	samd_shard_t **prev;
+
+	pthread_mutex_lock(&shards_mutex);
+	for (prev = &shards; *prev && *prev != shard; prev = &(*prev)->next) {
+	}
+	if (*prev) {
+		*prev = shard->next;
+	}
+	samd_stats_retire(&retired, shard);
+	samd_metrics_retire(&retired, shard);
+	pthread_mutex_unlock(&shards_mutex);
+	free(shard);
+}
+
+static void shard_key_create(void)
+{
+	shard_key_ok = !pthread_key_create(&shard_key, shard_destroy);
+}
+
+/**
+ * Get the counts of the calling thread.  Only this thread stores to its shard, so it updates them
+ * with relaxed atomic stores instead of read-modify-write.
+ * @return this thread's shard, created on first use, or NULL if it couldn't be.  Add to
+ * samd_shard_retired() with atomic adds then.
+ */
+samd_shard_t *samd_shard(void)
+{
+	samd_shard_t *shard = thread_shard;
+	if (!shard) {
+		pthread_once(&shard_key_once, shard_key_create);
+		if (!shard_key_ok || !(shard = (samd_shard_t *)calloc(1, sizeof(*shard)))) {
+			return NULL;
+		}
+		if (pthread_setspecific(shard_key, shard)) {
+			free(shard);
+			return NULL;
+		}
+		pthread_mutex_lock(&shards_mutex);
+		shard->next = shards;
+		shards = shard;
+		pthread_mutex_unlock(&shards_mutex);
+		thread_shard = shard;
+	}
+	return shard;
+}
+
+/**
+ * @return the shard holding counts of exited threads, shared by all threads
+ */
+samd_shard_t *samd_shard_retired(void)
+{
+	return &retired;
+}
+
+/**
+ * Call fn on the retired shard and the shard of every running thread, which can't exit meanwhile
+ * @param fn
+ * @param user_data sent to fn
+ */
+void samd_shard_for_each(void (*fn)(const samd_shard_t *shard, void *user_data), void *user_data)
+{
+	samd_shard_t *shard;
+	pthread_mutex_lock(&shards_mutex);
+	for (shard = &retired; shard; shard = shard == &retired ? shards : shard->next) {
+		fn(shard, user_data);
+	}
+	pthread_mutex_unlock(&shards_mutex);
+}
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * Media server side of shared memory ingest.  Each call gets a single producer / single consumer
+ * ring in the region.  The media server only advances write_pos and the worker only advances
+ * read_pos, so no locks are needed.
+ */
+
+#define _GNU_SOURCE
+#include "samd_shm.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/** media server's handle to a region */
+struct samd_shm {
+	samd_shm_header_t *header;
+	size_t size;
+	int mem_fd;
+	/** signaled by media server when audio is written */
+	int notify_fd;
+	/** signaled by worker when results are written */
+	int result_fd;
+	/** set when a ring has been written since the last notification */
+	int pending;
+};
+
+/**
+ * Create shared memory region
+ * @param shm the region (output)
+ * @param num_slots max concurrent calls
+ * @param ring_ms ring size in ms of audio
+ * @param sample_rate of the audio
+ * @return 0 on success, -1 on failure
+ */
+int samd_shm_create(samd_shm_t **shm, uint32_t num_slots, uint32_t ring_ms, uint32_t sample_rate)
+{
+	samd_shm_t *new_shm;
+	uint32_t ring_samples = 1;
+	uint32_t slots_offset;
+	uint32_t slot_size;
+
+	*shm = NULL;
+	if (num_slots == 0 || ring_ms == 0 || sample_rate == 0 || sample_rate > 192000 || ring_ms > 60000) {
+		return -1;
+	}
+
+	/* power of two so free running positions wrap cleanly */
+	while (ring_samples < sample_rate / 1000 * ring_ms) {
+		ring_samples <<= 1;
+	}
+
+	new_shm = (samd_shm_t *)calloc(1, sizeof(*new_shm));
+	if (!new_shm) {
+		return -1;
+	}
+	new_shm->size = samd_shm_region_size(num_slots, ring_samples, &slots_offset, &slot_size);
+	new_shm->mem_fd = memfd_create("simpleamd", MFD_CLOEXEC);
+	new_shm->notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	new_shm->result_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (new_shm->mem_fd < 0 || new_shm->notify_fd < 0 || new_shm->result_fd < 0 || ftruncate(new_shm->mem_fd, new_shm->size) < 0) {
+		samd_shm_destroy(&new_shm);
+		return -1;
+	}
+	new_shm->header = (samd_shm_header_t *)mmap(NULL, new_shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, new_shm->mem_fd, 0);
+	if (new_shm->header == MAP_FAILED) {
+		new_shm->header = NULL;
+		samd_shm_destroy(&new_shm);
+		return -1;
+	}
+
+	/* memfd is zero filled, so all slots start free */
+	new_shm->header->version = SAMD_SHM_VERSION;
+	new_shm->header->num_slots = num_slots;
+	new_shm->header->slot_size = slot_size;
+	new_shm->header->ring_samples = ring_samples;
+	new_shm->header->sample_rate = sample_rate;
+	new_shm->header->slots_offset = slots_offset;
+	__atomic_store_n(&new_shm->header->magic, SAMD_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	*shm = new_shm;
+	return 0;
+}
+
+/**
+ * Hand region to a simpleamd-shm worker.  The region, notify eventfd, and result eventfd are passed
+ * over the worker's control socket.  The worker detaches when the returned control socket is closed.
+ * @param shm the region
+ * @param socket_path worker's control socket
+ * @return the control socket or -1 on failure
+ */
+int samd_shm_attach_worker(samd_shm_t *shm, const char *socket_path)
+{
+	struct sockaddr_un addr = { 0 };
+	int fds[3] = { shm->mem_fd, shm->notify_fd, shm->result_fd };
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct iovec iov;
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	uint32_t magic = SAMD_SHM_MAGIC;
+	int sock;
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		return -1;
+	}
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	iov.iov_base = &magic;
+	iov.iov_len = sizeof(magic);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(magic)) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * Start a call
+ * @param shm the region
+ * @return the call's slot or -1 if all slots are in use
+ */
+int samd_shm_open_call(samd_shm_t *shm)
+{
+	uint32_t i;
+	for (i = 0; i < shm->header->num_slots; i++) {
+		samd_shm_slot_t *slot = samd_shm_get_slot(shm->header, i);
+		if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == SAMD_SHM_SLOT_FREE) {
+			/* worker doesn't touch free slots */
+			slot->generation++;
+			slot->write_pos = 0;
+			slot->read_pos = 0;
+			slot->result_seq = 0;
+			slot->first_event = slot->last_event = 0;
+			slot->first_time_ms = slot->last_time_ms = 0;
+			__atomic_store_n(&slot->state, SAMD_SHM_SLOT_ACTIVE, __ATOMIC_RELEASE);
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void shm_mark_dirty(samd_shm_t *shm, int slot)
+{
+	__atomic_fetch_or(&shm->header->dirty[slot / 64], (uint64_t)1 << (slot % 64), __ATOMIC_RELEASE);
+	shm->pending = 1;
+}
+
+/**
+ * Write audio to call's ring.  The worker is not woken until samd_shm_notify() is called, so
+ * audio for many calls can be written with a single wakeup.
+ * @param shm the region
+ * @param slot the call
+ * @param samples to write
+ * @param num_samples to write
+ * @return number of samples written, less than num_samples if ring is full
+ */
+uint32_t samd_shm_write(samd_shm_t *shm, int slot, const int16_t *samples, uint32_t num_samples)
+{
+	samd_shm_slot_t *call = samd_shm_get_slot(shm->header, slot);
+	uint32_t ring_samples = shm->header->ring_samples;
+	uint32_t write_pos = call->write_pos;
+	uint32_t space = ring_samples - (write_pos - __atomic_load_n(&call->read_pos, __ATOMIC_ACQUIRE));
+	uint32_t offset = write_pos & (ring_samples - 1);
+	uint32_t first;
+
+	if (num_samples > space) {
+		num_samples = space;
+	}
+	if (num_samples == 0) {
+		return 0;
+	}
+	first = ring_samples - offset;
+	if (first > num_samples) {
+		first = num_samples;
+	}
+	memcpy(call->samples + offset, samples, first * sizeof(int16_t));
+	memcpy(call->samples, samples + first, (num_samples - first) * sizeof(int16_t));
+	__atomic_store_n(&call->write_pos, write_pos + num_samples, __ATOMIC_RELEASE);
+	shm_mark_dirty(shm, slot);
+	return num_samples;
+}
+
+/**
+ * Wake the worker if any rings were written or calls closed since the last notification
+ * @param shm the region
+ */
+void samd_shm_notify(samd_shm_t *shm)
+{
+	uint64_t one = 1;
+	if (shm->pending) {
+		shm->pending = 0;
+		if (write(shm->notify_fd, &one, sizeof(one)) < 0) {
+			/* counter is saturated, so the worker is already awake */
+		}
+	}
+}
+
+/**
+ * Get call's decision
+ * @param shm the region
+ * @param slot the call
+ * @param first first event detected (output, optional)
+ * @param last most recent event detected (output, optional)
+ * @return number of events detected so far, first and last are only valid if > 0
+ */
+int samd_shm_get_result(samd_shm_t *shm, int slot, samd_event_record_t *first, samd_event_record_t *last)
+{
+	samd_shm_slot_t *call = samd_shm_get_slot(shm->header, slot);
+	samd_event_record_t first_record;
+	samd_event_record_t last_record;
+	uint32_t seq;
+
+	/* the slot only keeps event times */
+	memset(&first_record, 0, sizeof(first_record));
+	memset(&last_record, 0, sizeof(last_record));
+
+	/* result_seq is odd while the worker is writing, retry if it was updated while being read */
+	do {
+		seq = __atomic_load_n(&call->result_seq, __ATOMIC_ACQUIRE);
+		first_record.event = (samd_event_t)call->first_event;
+		first_record.time_ms = call->first_time_ms;
+		last_record.event = (samd_event_t)call->last_event;
+		last_record.time_ms = call->last_time_ms;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&call->result_seq, __ATOMIC_RELAXED));
+
+	if (first) {
+		*first = first_record;
+	}
+	if (last) {
+		*last = last_record;
+	}
+	return seq / 2;
+}
+
+/**
+ * @param shm the region
+ * @return eventfd signaled when the worker has written new results
+ */
+int samd_shm_get_result_fd(samd_shm_t *shm)
+{
+	return shm->result_fd;
+}
+
+/**
+ * End a call.  The worker analyzes any audio left in the ring and then frees the slot.
+ * @param shm the region
+ * @param slot the call
+ */
+void samd_shm_close_call(samd_shm_t *shm, int slot)
+{
+	__atomic_store_n(&samd_shm_get_slot(shm->header, slot)->state, SAMD_SHM_SLOT_CLOSING, __ATOMIC_RELEASE);
+	shm_mark_dirty(shm, slot);
+}
+
+/**
+ * @param shm the region
+ * @param slot the call
+ * @return 1 if the worker has finished with a closed call
+ */
+int samd_shm_call_closed(samd_shm_t *shm, int slot)
+{
+	return __atomic_load_n(&samd_shm_get_slot(shm->header, slot)->state, __ATOMIC_ACQUIRE) == SAMD_SHM_SLOT_FREE;
+}
+
+/**
+ * Destroy region.  Any attached worker keeps its mapping until its control socket is closed.
+ * @param shm the region
+ */
+void samd_shm_destroy(samd_shm_t **shm)
+{
+	if (shm && *shm) {
+		if ((*shm)->header) {
+			munmap((*shm)->header, (*shm)->size);
+		}
+		if ((*shm)->mem_fd >= 0) {
+			close((*shm)->mem_fd);
+		}
+		if ((*shm)->notify_fd >= 0) {
+			close((*shm)->notify_fd);
+		}
+		if ((*shm)->result_fd >= 0) {
+			close((*shm)->result_fd);
+		}
+		free(*shm);
+		*shm = NULL;
+	}
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * simpleamd-shmfeed: stands in for a media server using shared memory ingest.  Each raw audio file
+ * is played as one or more calls into simpleamd-shm rings in 20 ms packets, with a single worker
+ * notification per packet interval.  Each call's decision is printed when it ends.
+ */
+
+#define _GNU_SOURCE
+#include "samd_shm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+
+#define PACKET_MS 20
+#define PACKET_NS (PACKET_MS * 1000000L)
+
+/** one call being played */
+struct call {
+	const char *name;
+	int16_t *samples;
+	size_t num_samples;
+	size_t pos;
+	int slot;
+	int closing;
+	int done;
+};
+
+static int16_t *read_file(const char *name, size_t *num_samples)
+{
+	FILE *file = fopen(name, "rb");
+	int16_t *samples = NULL;
+	long size;
+	if (!file) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	samples = (int16_t *)malloc(size > 0 ? size : 1);
+	*num_samples = fread(samples, sizeof(int16_t), size / sizeof(int16_t), file);
+	fclose(file);
+	return samples;
+}
+
+static void print_result(samd_shm_t *shm, struct call *call)
+{
+	samd_event_record_t first;
+	samd_event_record_t last;
+	if (samd_shm_get_result(shm, call->slot, &first, &last) > 0) {
+		printf("%s,%s,%llu,%s,%llu\n", call->name, samd_event_to_string(first.event), (unsigned long long)first.time_ms,
+			samd_event_to_string(last.event), (unsigned long long)last.time_ms);
+	} else {
+		printf("%s,NONE,0,NONE,0\n", call->name);
+	}
+}
+
+#define USAGE "simpleamd-shmfeed [options] <raw audio file>..."
+#define HELP USAGE"\n" \
+	"\t-u <path> Unix socket of simpleamd-shm (default /tmp/simpleamd-shm.sock)\n" \
+	"\t-n <copies> Concurrent calls per file (default 1)\n" \
+	"\t-r <sample rate> Sample rate of files (default 8000)\n" \
+	"\t-R <ms> Ring size per call in ms (default 1000)\n" \
+	"\t-f Write as fast as the rings allow instead of real time\n"
+
+int main(int argc, char **argv)
+{
+	samd_shm_t *shm;
+	struct call *calls;
+	struct timespec next;
+	const char *socket_path = "/tmp/simpleamd-shm.sock";
+	int copies = 1;
+	int sample_rate = 8000;
+	int ring_ms = 1000;
+	int fast = 0;
+	int num_calls;
+	int remaining;
+	int control_fd;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "u:n:r:R:fh")) != -1) {
+		switch (opt) {
+			case 'u': socket_path = optarg; break;
+			case 'n': copies = atoi(optarg); break;
+			case 'r': sample_rate = atoi(optarg); break;
+			case 'R': ring_ms = atoi(optarg); break;
+			case 'f': fast = 1; break;
+			default:
+				printf("%s", HELP);
+				exit(EXIT_SUCCESS);
+		}
+	}
+	if (optind >= argc || copies < 1 || copies > 10000 || sample_rate <= 0 || ring_ms < PACKET_MS) {
+		fprintf(stderr, USAGE"\n");
+		exit(EXIT_FAILURE);
+	}
+	num_calls = (argc - optind) * copies;
+	if (num_calls > 1000000) {
+		fprintf(stderr, "Too many calls\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (samd_shm_create(&shm, num_calls, ring_ms, sample_rate) < 0) {
+		perror("samd_shm_create");
+		exit(EXIT_FAILURE);
+	}
+	control_fd = samd_shm_attach_worker(shm, socket_path);
+	if (control_fd < 0) {
+		perror(socket_path);
+		exit(EXIT_FAILURE);
+	}
+
+	calls = (struct call *)calloc((size_t)num_calls, sizeof(*calls));
+	for (i = 0; i < num_calls; i++) {
+		calls[i].name = argv[optind + i / copies];
+		if (i % copies == 0) {
+			calls[i].samples = read_file(calls[i].name, &calls[i].num_samples);
+		} else {
+			calls[i].samples = calls[i - 1].samples;
+			calls[i].num_samples = calls[i - 1].num_samples;
+		}
+		calls[i].slot = samd_shm_open_call(shm);
+	}
+
+	/* write one packet per call, then wake the worker once for all of them */
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	remaining = num_calls;
+	while (remaining) {
+		struct pollfd pfd = { samd_shm_get_result_fd(shm), POLLIN, 0 };
+		size_t packet_samples = (size_t)sample_rate * PACKET_MS / 1000;
+
+		for (i = 0; i < num_calls; i++) {
+			struct call *call = &calls[i];
+			if (call->done) {
+				continue;
+			}
+			if (!call->closing) {
+				size_t len = call->num_samples - call->pos;
+				if (!fast && len > packet_samples) {
+					len = packet_samples;
+				}
+				call->pos += samd_shm_write(shm, call->slot, call->samples + call->pos, len);
+				if (call->pos >= call->num_samples) {
+					samd_shm_close_call(shm, call->slot);
+					call->closing = 1;
+				}
+			} else if (samd_shm_call_closed(shm, call->slot)) {
+				call->done = 1;
+				remaining--;
+			}
+		}
+		samd_shm_notify(shm);
+
+		if (fast) {
+			/* give the worker time to drain the rings */
+			uint64_t count;
+			if (poll(&pfd, 1, 1) > 0 && read(pfd.fd, &count, sizeof(count)) < 0) {
+				perror("read");
+			}
+		} else {
+			next.tv_nsec += PACKET_NS;
+			if (next.tv_nsec >= 1000000000L) {
+				next.tv_nsec -= 1000000000L;
+				next.tv_sec++;
+			}
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+			}
+		}
+	}
+
+	for (i = 0; i < num_calls; i++) {
+		print_result(shm, &calls[i]);
+	}
+
+	for (i = 0; i < num_calls; i += copies) {
+		free(calls[i].samples);
+	}
+	free(calls);
+	close(control_fd);
+	samd_shm_destroy(&shm);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,559 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * simpleamd-shm: runs an AMD per call on audio written by co-located media servers into shared
+ * memory rings.  A media server creates a region with samd_shm_create() and passes it over the
+ * control socket with samd_shm_attach_worker().  Audio is analyzed in place in the ring and each
+ * decision is written back to the call's result slot, so the only copy is the media server's write
+ * into the ring.
+ *
+ * The media server marks each ring it writes in the region's dirty bitmap and signals the notify
+ * eventfd once per batch.  On wakeup only the marked rings are visited.  The result eventfd is
+ * signaled once per wakeup if any call has a new result.
+ */
+
+#define _GNU_SOURCE
+#include "samd_shm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define MAX_REGIONS 64
+#define LISTEN_ID UINT32_MAX
+/* connections waiting for their handshake, with epoll ids from PENDING_ID */
+#define MAX_PENDING 16
+#define PENDING_ID 0x80000000
+#define HANDSHAKE_TIMEOUT_S 5
+
+/** configuration */
+static struct {
+	const char *control_socket_path;
+	int cpu;
+	int machine_ms;
+	int wait_for_voice_ms;
+	int debug;
+} config = { "/tmp/simpleamd-shm.sock", -1, 1100, 2000, 0 };
+
+static volatile sig_atomic_t running = 1;
+
+struct region;
+
+/** detector for one ring */
+struct call {
+	samd_t *amd;
+	struct region *region;
+	uint32_t slot;
+};
+
+/** region attached by a media server */
+struct region {
+	uint32_t id;
+	int control_fd;
+	int notify_fd;
+	int result_fd;
+	samd_shm_header_t *header;
+	size_t size;
+	struct call *calls;
+	/** set when a result was written since the media server was last signaled */
+	int results_pending;
+	/** validated copy of the header, the media server can still write the shared one */
+	samd_shm_header_t layout;
+};
+
+static struct region *regions[MAX_REGIONS];
+
+/** accepted media server connections that have not sent their region yet */
+static struct {
+	int fd;
+	time_t accepted;
+} pending[MAX_PENDING];
+static int num_pending;
+
+static samd_shm_slot_t *region_get_slot(struct region *region, uint32_t index)
+{
+	return (samd_shm_slot_t *)((uint8_t *)region->header + region->layout.slots_offset + (size_t)index * region->layout.slot_size);
+}
+
+static void logger(samd_log_level_t level, void *user_log_data, const char *file, int line, const char *message)
+{
+	struct call *call = (struct call *)user_log_data;
+	fprintf(stderr, "%u:%u\t%s:%d\t%s", call->region->id, call->slot, file, line, message);
+}
+
+/**
+ * Write decision to call's result slot
+ */
+static void amd_event_handler(samd_event_t event, uint32_t time_ms, void *user_event_data)
+{
+	struct call *call = (struct call *)user_event_data;
+	samd_shm_slot_t *slot = region_get_slot(call->region, call->slot);
+	uint32_t seq = slot->result_seq;
+
+	/* odd while writing so the media server can detect a torn read */
+	__atomic_store_n(&slot->result_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if (seq == 0) {
+		slot->first_event = event;
+		slot->first_time_ms = time_ms;
+	}
+	slot->last_event = event;
+	slot->last_time_ms = time_ms;
+	__atomic_store_n(&slot->result_seq, seq + 2, __ATOMIC_RELEASE);
+	call->region->results_pending = 1;
+
+	if (config.debug) {
+		fprintf(stderr, "%u:%u\t%s\t%u\n", call->region->id, call->slot, samd_event_to_string(event), time_ms);
+	}
+}
+
+static void call_start(struct region *region, uint32_t index)
+{
+	struct call *call = &region->calls[index];
+	call->region = region;
+	call->slot = index;
+	samd_init(&call->amd);
+	samd_set_sample_rate(call->amd, region->layout.sample_rate);
+	samd_set_machine_ms(call->amd, config.machine_ms);
+	samd_set_wait_for_voice_ms(call->amd, config.wait_for_voice_ms);
+	samd_set_event_handler(call->amd, amd_event_handler, call);
+	if (config.debug) {
+		samd_set_log_handler(call->amd, logger, call);
+	}
+}
+
+/**
+ * Analyze any audio waiting in the call's ring, and release the slot if the call is closing
+ */
+static void call_process(struct region *region, uint32_t index)
+{
+	samd_shm_slot_t *slot = region_get_slot(region, index);
+	struct call *call = &region->calls[index];
+	uint32_t ring_samples = region->layout.ring_samples;
+	uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+	uint32_t write_pos;
+	uint32_t read_pos;
+
+	if (state != SAMD_SHM_SLOT_ACTIVE && state != SAMD_SHM_SLOT_CLOSING) {
+		return;
+	}
+	if (!call->amd) {
+		call_start(region, index);
+	}
+
+	write_pos = __atomic_load_n(&slot->write_pos, __ATOMIC_ACQUIRE);
+	read_pos = slot->read_pos;
+	if (write_pos - read_pos > ring_samples) {
+		/* media server broke the ring protocol, skip to the newest audio */
+		read_pos = write_pos - ring_samples;
+	}
+	while (read_pos != write_pos) {
+		uint32_t offset = read_pos & (ring_samples - 1);
+		uint32_t n = write_pos - read_pos;
+		if (n > ring_samples - offset) {
+			n = ring_samples - offset;
+		}
+		samd_process_buffer(call->amd, slot->samples + offset, n, 1);
+		read_pos += n;
+		__atomic_store_n(&slot->read_pos, read_pos, __ATOMIC_RELEASE);
+	}
+
+	if (state == SAMD_SHM_SLOT_CLOSING) {
+		samd_destroy(&call->amd);
+		__atomic_store_n(&slot->state, SAMD_SHM_SLOT_FREE, __ATOMIC_RELEASE);
+		region->results_pending = 1;
+	}
+}
+
+/**
+ * Visit every ring marked since the last wakeup
+ */
+static void region_process(struct region *region)
+{
+	uint32_t num_words = (region->layout.num_slots + 63) / 64;
+	uint64_t one = 1;
+	uint64_t count;
+	uint32_t i;
+
+	if (read(region->notify_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		return;
+	}
+	for (i = 0; i < num_words; i++) {
+		uint64_t dirty = __atomic_exchange_n(&region->header->dirty[i], 0, __ATOMIC_ACQ_REL);
+		while (dirty) {
+			uint32_t index = i * 64 + __builtin_ctzll(dirty);
+			dirty &= dirty - 1;
+			if (index < region->layout.num_slots) {
+				call_process(region, index);
+			}
+		}
+	}
+
+	if (region->results_pending) {
+		region->results_pending = 0;
+		if (write(region->result_fd, &one, sizeof(one)) < 0) {
+			/* counter is saturated, so the media server is already signaled */
+		}
+	}
+}
+
+static void region_destroy(struct region *region)
+{
+	uint32_t i;
+	if (region->calls) {
+		for (i = 0; i < region->layout.num_slots; i++) {
+			if (region->calls[i].amd) {
+				samd_destroy(&region->calls[i].amd);
+			}
+		}
+		free(region->calls);
+	}
+	if (region->header) {
+		munmap(region->header, region->size);
+	}
+	close(region->control_fd);
+	close(region->notify_fd);
+	close(region->result_fd);
+	regions[region->id] = NULL;
+	free(region);
+}
+
+/**
+ * Map a region whose descriptors were received from a media server.  The header is checked against
+ * the mapping size since it is written by the other process.
+ * @return 0 on success
+ */
+static int region_map(struct region *region, int mem_fd)
+{
+	samd_shm_header_t *header = &region->layout;
+	struct stat st;
+	uint32_t slots_offset;
+	uint32_t slot_size;
+
+	if (fstat(mem_fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+		return -1;
+	}
+	region->size = st.st_size;
+	region->header = (samd_shm_header_t *)mmap(NULL, region->size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+	if (region->header == MAP_FAILED) {
+		region->header = NULL;
+		return -1;
+	}
+	memcpy(header, region->header, sizeof(*header));
+	if (header->magic != SAMD_SHM_MAGIC || header->version != SAMD_SHM_VERSION || header->num_slots == 0 || header->num_slots > 1000000 ||
+			header->ring_samples == 0 || header->ring_samples > (1 << 24) || (header->ring_samples & (header->ring_samples - 1)) ||
+			header->sample_rate == 0 || header->sample_rate > 192000 ||
+			samd_shm_region_size(header->num_slots, header->ring_samples, &slots_offset, &slot_size) > region->size ||
+			slots_offset != header->slots_offset || slot_size != header->slot_size) {
+		return -1;
+	}
+	region->calls = (struct call *)calloc(header->num_slots, sizeof(struct call));
+	return region->calls ? 0 : -1;
+}
+
+/**
+ * Close every descriptor received with a message
+ * @param msg filled in by recvmsg()
+ */
+static void close_received_fds(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			size_t num_received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			size_t i;
+			for (i = 0; i < num_received; i++) {
+				int fd;
+				memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+				close(fd);
+			}
+		}
+	}
+}
+
+/**
+ * Stop waiting for a connection's handshake
+ * @param index in pending
+ * @param epoll_fd
+ */
+static void pending_remove(int index, int epoll_fd)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pending[index].fd, NULL);
+	pending[index] = pending[--num_pending];
+	if (index < num_pending) {
+		struct epoll_event event = { 0 };
+		event.events = EPOLLIN;
+		event.data.u32 = PENDING_ID + index;
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, pending[index].fd, &event);
+	}
+}
+
+/**
+ * Drop connections that have not sent their handshake in time, so they can't hold pending slots
+ * @param epoll_fd
+ */
+static void pending_expire(int epoll_fd)
+{
+	time_t now = time(NULL);
+	int i;
+	for (i = num_pending - 1; i >= 0; i--) {
+		if (now - pending[i].accepted >= HANDSHAKE_TIMEOUT_S) {
+			int fd = pending[i].fd;
+			fprintf(stderr, "rejected media server connection: no handshake\n");
+			pending_remove(i, epoll_fd);
+			close(fd);
+		}
+	}
+}
+
+/**
+ * Accept a media server connection.  The socket is non-blocking and waits in epoll for its
+ * handshake, so a media server that never sends one can't stall the attached regions.
+ * @param listen_fd
+ * @param epoll_fd
+ */
+static void region_accept(int listen_fd, int epoll_fd)
+{
+	struct epoll_event event = { 0 };
+	int control_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (control_fd < 0) {
+		return;
+	}
+	if (num_pending == MAX_PENDING) {
+		fprintf(stderr, "rejected media server connection: too many pending\n");
+		close(control_fd);
+		return;
+	}
+	event.events = EPOLLIN;
+	event.data.u32 = PENDING_ID + num_pending;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, control_fd, &event) < 0) {
+		close(control_fd);
+		return;
+	}
+	pending[num_pending].fd = control_fd;
+	pending[num_pending].accepted = time(NULL);
+	num_pending++;
+}
+
+/**
+ * Read the handshake of a pending connection and attach its region
+ * @param index in pending
+ * @param epoll_fd
+ */
+static void region_handshake(int index, int epoll_fd)
+{
+	struct region *region;
+	struct epoll_event event = { 0 };
+	int fds[3];
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct iovec iov;
+	struct msghdr msg = { 0 };
+	struct cmsghdr *cmsg;
+	uint32_t magic = 0;
+	uint32_t id;
+	ssize_t len;
+	int control_fd = pending[index].fd;
+	int mem_fd;
+
+	iov.iov_base = &magic;
+	iov.iov_len = sizeof(magic);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	len = recvmsg(control_fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+	if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return;
+	}
+	pending_remove(index, epoll_fd);
+	if (len != sizeof(magic)) {
+		fprintf(stderr, "rejected media server connection\n");
+		if (len > 0) {
+			close_received_fds(&msg);
+		}
+		close(control_fd);
+		return;
+	}
+	for (id = 0; id < MAX_REGIONS && regions[id]; id++) {
+	}
+	/* whatever was sent must be closed unless it is attached */
+	if (id == MAX_REGIONS || magic != SAMD_SHM_MAGIC || (msg.msg_flags & MSG_CTRUNC) ||
+			!(cmsg = CMSG_FIRSTHDR(&msg)) || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+			cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || CMSG_NXTHDR(&msg, cmsg)) {
+		fprintf(stderr, "rejected media server connection\n");
+		close_received_fds(&msg);
+		close(control_fd);
+		return;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	mem_fd = fds[0];
+
+	region = (struct region *)calloc(1, sizeof(*region));
+	if (!region) {
+		close_received_fds(&msg);
+		close(control_fd);
+		return;
+	}
+	region->id = id;
+	region->control_fd = control_fd;
+	region->notify_fd = fds[1];
+	region->result_fd = fds[2];
+	regions[id] = region;
+	if (region_map(region, mem_fd) < 0) {
+		fprintf(stderr, "rejected region %u: invalid header\n", id);
+		close(mem_fd);
+		region_destroy(region);
+		return;
+	}
+	/* mapping holds a reference to the memory */
+	close(mem_fd);
+
+	event.events = EPOLLIN;
+	event.data.u32 = id * 2;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, region->notify_fd, &event);
+	event.data.u32 = id * 2 + 1;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, region->control_fd, &event);
+	fprintf(stderr, "attached region %u: %u slots, %u samples per ring, %u Hz\n", id, region->layout.num_slots, region->layout.ring_samples, region->layout.sample_rate);
+
+	/* pick up anything written before the region was attached */
+	region_process(region);
+}
+
+static int control_socket_init(void)
+{
+	struct sockaddr_un addr = { 0 };
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, config.control_socket_path, sizeof(addr.sun_path) - 1);
+	unlink(config.control_socket_path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+		perror(config.control_socket_path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void stop(int sig)
+{
+	running = 0;
+}
+
+#define USAGE "simpleamd-shm [options]"
+#define HELP USAGE"\n" \
+	"\t-u <path> Unix socket media servers attach to (default /tmp/simpleamd-shm.sock)\n" \
+	"\t-c <cpu> Pin to this CPU\n" \
+	"\t-m <amd machine ms> Voice longer than this time is classified as machine (default 1100)\n" \
+	"\t-w <amd wait for voice ms> How long to wait for voice to begin (default 2000)\n" \
+	"\t-d Enable debug logging\n"
+
+int main(int argc, char **argv)
+{
+	struct epoll_event events[MAX_REGIONS];
+	struct epoll_event event = { 0 };
+	struct sigaction sa = { 0 };
+	int listen_fd;
+	int epoll_fd;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "u:c:m:w:dh")) != -1) {
+		switch (opt) {
+			case 'u': config.control_socket_path = optarg; break;
+			case 'c': config.cpu = atoi(optarg); break;
+			case 'm': config.machine_ms = atoi(optarg); break;
+			case 'w': config.wait_for_voice_ms = atoi(optarg); break;
+			case 'd': config.debug = 1; break;
+			default:
+				printf("%s", HELP);
+				exit(EXIT_SUCCESS);
+		}
+	}
+
+	if (config.cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(config.cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			perror("sched_setaffinity");
+		}
+	}
+
+	sa.sa_handler = stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	listen_fd = control_socket_init();
+	if (listen_fd < 0) {
+		exit(EXIT_FAILURE);
+	}
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	event.events = EPOLLIN;
+	event.data.u32 = LISTEN_ID;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+	fprintf(stderr, "waiting for media servers on %s\n", config.control_socket_path);
+
+	while (running) {
+		int n = epoll_wait(epoll_fd, events, MAX_REGIONS, 1000);
+		for (i = 0; i < n; i++) {
+			uint32_t id = events[i].data.u32;
+			struct region *region;
+			if (id == LISTEN_ID) {
+				region_accept(listen_fd, epoll_fd);
+				continue;
+			}
+			if (id >= PENDING_ID) {
+				if (id - PENDING_ID < (uint32_t)num_pending) {
+					region_handshake(id - PENDING_ID, epoll_fd);
+				}
+				continue;
+			}
+			region = regions[id / 2];
+			if (!region) {
+				/* detached earlier in this batch */
+				continue;
+			}
+			if (id & 1) {
+				/* control socket is only read to detect the media server going away */
+				fprintf(stderr, "detached region %u\n", region->id);
+				region_destroy(region);
+			} else {
+				region_process(region);
+			}
+		}
+		pending_expire(epoll_fd);
+	}
+
+	for (i = 0; i < num_pending; i++) {
+		close(pending[i].fd);
+	}
+	for (i = 0; i < MAX_REGIONS; i++) {
+		if (regions[i]) {
+			region_destroy(regions[i]);
+		}
+	}
+	close(epoll_fd);
+	close(listen_fd);
+	unlink(config.control_socket_path);
+
+	return EXIT_SUCCESS;
+}
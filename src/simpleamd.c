@@ -4,12 +4,18 @@
  * See the file COPYING for copying permission.
  */
 #include <simpleamd.h>
+#include "samd_priors.h"
+#include "samd_fingerprint.h"
+#include "samd_classifier.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 
 int debug = 0;
 int summarize = 0;
@@ -23,6 +29,29 @@ int vad_sample_rate = 8000;
 int vad_channels = 1;
 int vad_initial_adjust_ms = 200;
 int vad_voice_adjust_ms = 0;
+int vad_noise_floor_window_ms = 0;
+double amd_provisional_confidence = 0.0;
+int split_channels = 0;
+int frame_ms = 10;
+int stream = 0;
+int recorder_ms = 0;
+samd_priors_t *priors = NULL;
+const char *priors_key = "default";
+samd_fingerprint_index_t *fingerprint_index = NULL;
+samd_fingerprint_builder_t *fingerprint_builder = NULL;
+const char *fingerprint_build_file = NULL;
+int use_classifier = 0;
+samd_classifier_trainer_t *classifier_trainer = NULL;
+const char *classifier_train_file = NULL;
+
+enum output_format {
+	OUTPUT_TEXT = 0,
+	OUTPUT_CSV,
+	OUTPUT_JSON
+};
+enum output_format output_format = OUTPUT_TEXT;
+
+#define STREAM_BUFFER_SAMPLES 32768
 
 static const char *result_string[4] = { "unknown", "human", "machine", "no-voice" };
 enum amd_test_result {
@@ -32,6 +61,26 @@ enum amd_test_result {
 	RESULT_NO_VOICE
 };
 
+/** AMD for one file or channel */
+struct detector {
+	samd_t *amd;
+	enum amd_test_result result;
+	uint32_t channel;
+	char name[1024];
+	/** most recent event */
+	int have_event;
+	samd_event_t event;
+	uint32_t event_ms;
+};
+
+/** cost of analyzing a file */
+struct analysis_cost {
+	uint64_t frames;
+	double audio_ms;
+	double wall_ms;
+	double cpu_ms;
+};
+
 struct amd_test_stats {
 	int humans;
 	int humans_detected_as_machine;
@@ -45,18 +94,38 @@ struct amd_test_stats {
 
 static void amd_logger(samd_log_level_t level, void *user_log_data, const char *file, int line, const char *message)
 {
-	printf("%s\t\t%s:%d\t%s", (char *)user_log_data, file, line, message);
+	/* keep stdout for events when streaming */
+	fprintf(stream ? stderr : stdout, "%s\t\t%s:%d\t%s", (char *)user_log_data, file, line, message);
 }
 
-static void amd_event_handler(samd_event_t event, uint32_t time_ms, void *user_event_data)
+static void amd_event_handler(const samd_event_info_t *info, void *user_event_data)
 {
-	enum amd_test_result *result = (enum amd_test_result *)user_event_data;
-	if (event == SAMD_MACHINE_VOICE || event == SAMD_MACHINE_SILENCE || event == SAMD_MACHINE_BEEP) {
-		*result = RESULT_MACHINE;
+	struct detector *detector = (struct detector *)user_event_data;
+	samd_event_t event = info->event;
+	uint32_t time_ms = (uint32_t)info->time_ms;
+	/* provisional events don't decide the result, they are only streamed */
+	if (event != SAMD_LIKELY_HUMAN && event != SAMD_LIKELY_MACHINE) {
+		detector->have_event = 1;
+		detector->event = event;
+		detector->event_ms = time_ms;
+	}
+	if (event == SAMD_MACHINE_VOICE || event == SAMD_MACHINE_SILENCE || event == SAMD_MACHINE_BEEP || event == SAMD_MACHINE_FINGERPRINT) {
+		detector->result = RESULT_MACHINE;
 	} else if (event == SAMD_HUMAN_SILENCE || event == SAMD_HUMAN_VOICE) {
-		*result = RESULT_HUMAN;
+		detector->result = RESULT_HUMAN;
 	} else if (event == SAMD_NO_VOICE) {
-		*result = RESULT_NO_VOICE;
+		detector->result = RESULT_NO_VOICE;
+	}
+	if (stream) {
+		/* one line per event, flushed so the reader sees it right away */
+		if (split_channels) {
+			printf("{\"channel\":%u,\"event\":\"%s\",\"time_ms\":%llu,\"sample\":%llu}\n", detector->channel, samd_event_to_string(event),
+				(unsigned long long)info->time_ms, (unsigned long long)info->sample);
+		} else {
+			printf("{\"event\":\"%s\",\"time_ms\":%llu,\"sample\":%llu}\n", samd_event_to_string(event),
+				(unsigned long long)info->time_ms, (unsigned long long)info->sample);
+		}
+		fflush(stdout);
 	}
 }
 
@@ -70,14 +139,10 @@ static enum amd_test_result get_expected_result_from_audio_file_name(const char
 	return RESULT_UNKNOWN;
 }
 
-static enum amd_test_result analyze_file(struct amd_test_stats *test_stats, const char *raw_audio_file_name, enum amd_test_result expected_result)
+static samd_t *create_amd(struct detector *detector)
 {
 	samd_vad_t *vad = NULL;
 	samd_t *amd = NULL;
-	FILE *raw_audio_file;
-	int16_t samples[80] = { 0 };
-	enum amd_test_result result = RESULT_UNKNOWN;
-	int pass = 0;
 
 	/* create AMD */
 	samd_init(&amd);
@@ -86,11 +151,20 @@ static enum amd_test_result analyze_file(struct amd_test_stats *test_stats, cons
 		exit(EXIT_FAILURE);
 	}
 	samd_set_sample_rate(amd, vad_sample_rate);
+	samd_set_frame_ms(amd, frame_ms);
+	if (recorder_ms) {
+		samd_set_recorder_ms(amd, recorder_ms);
+	}
 	samd_set_machine_ms(amd, amd_machine_ms); /* voice longer than this is classified machine */
 	samd_set_wait_for_voice_ms(amd, amd_wait_for_voice_ms); /* maximum duration of initial silence to allow */
-	samd_set_event_handler(amd, amd_event_handler, &result);
+	samd_set_provisional_confidence(amd, amd_provisional_confidence); /* early LIKELY HUMAN / MACHINE events */
+	samd_set_fingerprint_index(amd, fingerprint_index); /* known greetings are machines right away */
+	if (use_classifier || classifier_train_file) {
+		samd_set_classifier(amd, samd_classifier_get_default_model()); /* ambiguous calls are classified */
+	}
+	samd_set_event_info_handler(amd, amd_event_handler, detector);
 	if (debug) {
-		samd_set_log_handler(amd, amd_logger, (void *)raw_audio_file_name);
+		samd_set_log_handler(amd, amd_logger, detector->name);
 	}
 
 	/* configure VAD for AMD */
@@ -101,22 +175,106 @@ static enum amd_test_result analyze_file(struct amd_test_stats *test_stats, cons
 	samd_vad_set_voice_adjust_ms(vad, vad_voice_adjust_ms); /* time to adjust energy threshold relative to start of voice */
 	samd_vad_set_voice_ms(vad, vad_voice_ms); /* how long to wait for start of voice */
 	samd_vad_set_voice_end_ms(vad, vad_voice_end_ms); /* how long to wait for end of voice */
+	samd_vad_set_noise_floor_window_ms(vad, vad_noise_floor_window_ms); /* track background noise continuously instead */
+	if (priors) {
+		samd_priors_apply(priors, priors_key, vad); /* start from the noise floor of earlier calls */
+	}
 
-	raw_audio_file = fopen(raw_audio_file_name, "rb");
-	if (!raw_audio_file) {
-		perror(raw_audio_file_name);
-		exit(EXIT_FAILURE);
+	return amd;
+}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void print_json_string(const char *str)
+{
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			printf("\\%c", *str);
+		} else if ((unsigned char)*str < 0x20) {
+			printf("\\u%04x", *str);
+		} else {
+			putchar(*str);
+		}
 	}
+	putchar('"');
+}
 
-	while (!feof(raw_audio_file) && !ferror(raw_audio_file) && result == RESULT_UNKNOWN) {
-		size_t num_samples = fread(samples, sizeof(int16_t), 80, raw_audio_file);
-		if (num_samples > 0) {
-			samd_process_buffer(amd, samples, num_samples, vad_channels);
+/**
+ * Print a CSV field quoted per RFC 4180, with embedded quotes doubled
+ */
+static void print_csv_string(const char *str)
+{
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"') {
+			putchar('"');
 		}
+		putchar(*str);
 	}
+	putchar('"');
+}
 
-	fclose(raw_audio_file);
-	samd_destroy(&amd);
+static void print_result(const struct detector *detector, enum amd_test_result expected_result, int pass, const struct analysis_cost *cost)
+{
+	const char *event = detector->have_event ? samd_event_to_string(detector->event) : "";
+	/* processing time relative to audio time, lower is faster */
+	double rtf = cost->audio_ms > 0.0 ? cost->cpu_ms / cost->audio_ms : 0.0;
+
+	switch (output_format) {
+		case OUTPUT_CSV:
+			print_csv_string(detector->name);
+			printf(",%s,%s,%s,%s,%u,%llu,%.0f,%.3f,%.3f,%.6f\n", result_string[expected_result],
+				result_string[detector->result], pass ? "pass" : "fail", event, detector->event_ms,
+				(unsigned long long)cost->frames, cost->audio_ms, cost->wall_ms, cost->cpu_ms, rtf);
+			break;
+		case OUTPUT_JSON:
+			printf("{\"file\":");
+			print_json_string(detector->name);
+			printf(",\"expected\":\"%s\",\"result\":\"%s\",\"pass\":%s,\"event\":", result_string[expected_result],
+				result_string[detector->result], pass ? "true" : "false");
+			if (detector->have_event) {
+				print_json_string(event);
+			} else {
+				printf("null");
+			}
+			printf(",\"time_ms\":%u,\"frames\":%llu,\"audio_ms\":%.0f,\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"rtf\":%.6f}\n",
+				detector->event_ms, (unsigned long long)cost->frames, cost->audio_ms, cost->wall_ms, cost->cpu_ms, rtf);
+			break;
+		default:
+			printf("%s,%s,%s\n", detector->name, result_string[detector->result], pass ? "pass" : "fail");
+			break;
+	}
+}
+
+/**
+ * Print the recent frames of a misclassified detector to stderr
+ */
+static void dump_recorder(const struct detector *detector)
+{
+	static const char *vad_states[] = { "initial", "silence", "voice" };
+	static const char *amd_states[] = { "wait", "detect", "human", "machine", "done" };
+	size_t num_frames = samd_dump_recorder(detector->amd, NULL, 0);
+	samd_recorder_frame_t *frames = (samd_recorder_frame_t *)malloc(sizeof(*frames) * (num_frames ? num_frames : 1));
+	size_t i;
+
+	num_frames = samd_dump_recorder(detector->amd, frames, num_frames);
+	fprintf(stderr, "# %s: time_ms energy zero_crossings threshold vad amd flags\n", detector->name);
+	for (i = 0; i < num_frames; i++) {
+		fprintf(stderr, "%u %u %u %u %s %s %s%s\n", frames[i].time_ms, frames[i].energy, frames[i].zero_crossings, frames[i].threshold,
+			vad_states[frames[i].vad_state], amd_states[frames[i].amd_state],
+			frames[i].flags & SAMD_RECORDER_VOICE ? "V" : "-", frames[i].flags & SAMD_RECORDER_BEEP ? "B" : "-");
+	}
+	free(frames);
+}
+
+static void update_stats(struct amd_test_stats *test_stats, const struct detector *detector, enum amd_test_result expected_result, const struct analysis_cost *cost)
+{
+	enum amd_test_result result = detector->result;
+	int pass = 0;
 
 	if (expected_result == RESULT_MACHINE) {
 		test_stats->machines++;
@@ -138,26 +296,244 @@ static enum amd_test_result analyze_file(struct amd_test_stats *test_stats, cons
 		}
 	}
 
-	printf("%s,%s,%s\n", raw_audio_file_name, result_string[result], pass ? "pass" : "fail");
+	print_result(detector, expected_result, pass, cost);
+	if (recorder_ms && !pass && expected_result != RESULT_UNKNOWN) {
+		dump_recorder(detector);
+	}
+}
+
+/**
+ * Create an AMD for the input, or one per channel when detecting channels separately
+ * @param detectors (output)
+ * @param analyzer shared by the detectors when detecting channels separately (output)
+ * @param name of the input
+ * @return the number of detectors
+ */
+static uint32_t create_detectors(struct detector *detectors, samd_frame_analyzer_t **analyzer, const char *name)
+{
+	uint32_t num_detectors = 1;
+	uint32_t i;
+
+	memset(detectors, 0, sizeof(*detectors) * SAMD_MAX_CHANNELS);
+	*analyzer = NULL;
+	if (split_channels) {
+		/* one AMD per channel, all sharing one pass over the samples */
+		num_detectors = vad_channels < SAMD_MAX_CHANNELS ? vad_channels : SAMD_MAX_CHANNELS;
+		samd_frame_analyzer_init(analyzer);
+		samd_frame_analyzer_set_sample_rate(*analyzer, vad_sample_rate);
+		samd_frame_analyzer_set_frame_ms(*analyzer, frame_ms);
+		samd_frame_analyzer_set_channel_mode(*analyzer, SAMD_CHANNEL_MODE_SPLIT);
+		for (i = 0; i < num_detectors; i++) {
+			snprintf(detectors[i].name, sizeof(detectors[i].name), "%s:%u", name, i);
+			detectors[i].channel = i;
+			detectors[i].amd = create_amd(&detectors[i]);
+			samd_frame_analyzer_subscribe_channel(*analyzer, i, samd_process_frame, detectors[i].amd);
+		}
+	} else {
+		snprintf(detectors[0].name, sizeof(detectors[0].name), "%s", name);
+		detectors[0].amd = create_amd(&detectors[0]);
+	}
+	return num_detectors;
+}
+
+static void process_samples(struct detector *detectors, samd_frame_analyzer_t *analyzer, int16_t *samples, uint32_t num_samples)
+{
+	if (analyzer) {
+		samd_frame_analyzer_process_buffer(analyzer, samples, num_samples, vad_channels);
+	} else {
+		samd_process_buffer(detectors[0].amd, samples, num_samples, vad_channels);
+	}
+}
+
+static int16_t *read_file(const char *name, size_t *num_samples)
+{
+	FILE *file = fopen(name, "rb");
+	int16_t *samples = NULL;
+	long size;
+	if (!file) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	samples = (int16_t *)malloc(size > 0 ? size : 1);
+	if (!samples) {
+		fprintf(stderr, "Failed to allocate %ld bytes for %s\n", size, name);
+		exit(EXIT_FAILURE);
+	}
+	*num_samples = fread(samples, sizeof(int16_t), size / sizeof(int16_t), file);
+	fclose(file);
+	return samples;
+}
+
+static enum amd_test_result analyze_file(struct amd_test_stats *test_stats, const char *raw_audio_file_name, enum amd_test_result expected_result)
+{
+	struct detector detectors[SAMD_MAX_CHANNELS];
+	struct analysis_cost cost = { 0 };
+	struct timespec wall_start, wall_end, cpu_start, cpu_end;
+	samd_frame_analyzer_t *analyzer = NULL;
+	int16_t *samples;
+	size_t num_samples;
+	size_t pos = 0;
+	size_t chunk = 80 * (split_channels ? vad_channels : 1);
+	uint32_t num_detectors;
+	uint32_t undecided;
+	uint32_t i;
+
+	num_detectors = create_detectors(detectors, &analyzer, raw_audio_file_name);
+
+	/* read the whole file first so only analysis is timed */
+	samples = read_file(raw_audio_file_name, &num_samples);
+
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+	undecided = num_detectors;
+	while (pos < num_samples && undecided) {
+		size_t len = num_samples - pos < chunk ? num_samples - pos : chunk;
+		process_samples(detectors, analyzer, samples + pos, len);
+		pos += len;
+		for (undecided = 0, i = 0; i < num_detectors; i++) {
+			undecided += detectors[i].result == RESULT_UNKNOWN;
+		}
+	}
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+	cost.wall_ms = elapsed_ms(&wall_start, &wall_end);
+	cost.cpu_ms = elapsed_ms(&cpu_start, &cpu_end);
+	cost.audio_ms = (double)(pos / vad_channels) * 1000.0 / vad_sample_rate;
+	cost.frames = (pos / vad_channels) / ((uint64_t)vad_sample_rate * frame_ms / 1000);
+
+	free(samples);
+	for (i = 0; i < num_detectors; i++) {
+		double features[SAMD_CLASSIFIER_FEATURES];
+		update_stats(test_stats, &detectors[i], expected_result, &cost);
+		if (classifier_trainer && expected_result != RESULT_UNKNOWN && samd_get_classifier_features(detectors[i].amd, features)) {
+			samd_classifier_trainer_add(classifier_trainer, features, expected_result == RESULT_MACHINE);
+		}
+		if (priors) {
+			samd_priors_update(priors, priors_key, samd_get_vad(detectors[i].amd));
+		}
+		samd_destroy(&detectors[i].amd);
+	}
+	samd_frame_analyzer_destroy(&analyzer);
+
+	return detectors[0].result;
+}
+
+static void add_greeting(const char *raw_audio_file_name)
+{
+	const char *name = strrchr(raw_audio_file_name, '/');
+	size_t num_samples;
+	int16_t *samples = read_file(raw_audio_file_name, &num_samples);
+	if (samd_fingerprint_builder_add(fingerprint_builder, name ? name + 1 : raw_audio_file_name, samples, num_samples, vad_channels)) {
+		fprintf(stderr, "Too many greetings, skipping %s\n", raw_audio_file_name);
+	}
+	free(samples);
+}
+
+static void process_file(struct amd_test_stats *test_stats, const char *raw_audio_file_name)
+{
+	if (fingerprint_builder) {
+		add_greeting(raw_audio_file_name);
+	} else {
+		analyze_file(test_stats, raw_audio_file_name, get_expected_result_from_audio_file_name(raw_audio_file_name));
+	}
+}
+
+/**
+ * Analyze audio from stdin or a FIFO as it arrives, writing each event as a JSON line.  Runs until
+ * end of input.
+ * @param name of the input, NULL for stdin
+ */
+static void analyze_stream(const char *name)
+{
+	struct detector detectors[SAMD_MAX_CHANNELS];
+	samd_frame_analyzer_t *analyzer = NULL;
+	int16_t samples[STREAM_BUFFER_SAMPLES];
+	size_t frame_size = sizeof(int16_t) * vad_channels;
+	size_t pending = 0;
+	uint32_t num_detectors;
+	uint32_t i;
+	int fd = STDIN_FILENO;
+
+	if (frame_size > sizeof(samples)) {
+		fprintf(stderr, "Too many channels\n");
+		exit(EXIT_FAILURE);
+	}
+	if (name && (fd = open(name, O_RDONLY)) < 0) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+
+	num_detectors = create_detectors(detectors, &analyzer, name ? name : "stdin");
+
+	/* blocking reads return as soon as any audio arrives; stdin's flags are left as inherited */
+	for (;;) {
+		size_t whole;
+		ssize_t len = read(fd, (uint8_t *)samples + pending, sizeof(samples) - pending);
+		if (len == 0) {
+			break;
+		}
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror(name ? name : "stdin");
+			break;
+		}
+
+		/* only whole frames of samples are processed, the rest is carried to the next read */
+		pending += len;
+		whole = pending - pending % frame_size;
+		if (whole) {
+			process_samples(detectors, analyzer, samples, whole / sizeof(int16_t));
+			pending -= whole;
+			memmove(samples, (uint8_t *)samples + whole, pending);
+		}
+	}
 
-	return result;
+	if (name) {
+		close(fd);
+	}
+	for (i = 0; i < num_detectors; i++) {
+		if (priors) {
+			samd_priors_update(priors, priors_key, samd_get_vad(detectors[i].amd));
+		}
+		samd_destroy(&detectors[i].amd);
+	}
+	samd_frame_analyzer_destroy(&analyzer);
 }
 
-#define USAGE "simpleamd <-f <raw audio file>|-l <list file>>"
+#define USAGE "simpleamd <-f <raw audio file>|-l <list file>|-|--stream>"
 #define HELP USAGE"\n" \
 	"\t-f <raw audio file> RAW LPCM input file\n" \
+	"\t- | --stream Analyze RAW LPCM from stdin (or the -f FIFO) as it arrives, writing each event as a JSON line\n" \
 	"\t-l <list file> Text file listing raw audio files to test\n" \
 	"\t-e <vad energy> Energy threshold (default 130)\n" \
 	"\t-v <vad voice ms> Consecutive speech to trigger start of voice (default 20)\n" \
 	"\t-s <vad silence ms> Consecutive silence to trigger start of silence (default 500)\n" \
 	"\t-i <vad initial adjust ms> Time to measure background environment before starting VAD.  Disable with 0. (default 100)\n" \
 	"\t-r <vad sample rate> Sample rate of input audio (default 8000)\n" \
-	"\t-c <vad channels> Number of channels per sample (default 1)\n" \
+	"\t-c <vad channels> Number of channels per sample, up to 16 (default 1)\n" \
 	"\t-n <vad voice adjust ms> Time relative to start of initial utterance for voice adjustment.  Disable with 0. (default 0)\n" \
+	"\t-N <vad noise floor window ms> Track the noise floor over this much audio and adjust energy threshold every frame.  Disable with 0. (default 0)\n" \
 	"\t-a <vad adjust threshold> maximum factor to adjust energy threshold relative to current threshold.  (default 3)\n" \
 	"\t-m <amd machine ms> Voice longer than this time is classified as machine (default 1100)\n" \
+	"\t-L <amd provisional confidence> With --stream, also write LIKELY HUMAN / MACHINE events at this confidence, 0.5 - 1.  Disable with 0. (default 0)\n" \
 	"\t-w <amd wait for voice ms> How long to wait for voice to begin (default 2000)\n" \
+	"\t-F <frame ms> Analysis frame duration: 5, 10, 20 or 40 (default 10)\n" \
+	"\t-S Detect each channel separately\n" \
 	"\t-d Enable debug logging\n" \
+	"\t-o <format> Per file output: text, csv or json (default text)\n" \
+	"\t-P <priors file> Start each call from the noise floor learned from earlier calls, and learn from it\n" \
+	"\t-K <priors key> Key of the calls in the priors file (default \"default\")\n" \
+	"\t-G <fingerprint index> Detect known greetings in this index as machines\n" \
+	"\t-B <fingerprint index> Build an index of the greetings in the input files instead of analyzing them\n" \
+	"\t-C Decide ambiguous calls with the classifier\n" \
+	"\t-T <model header> Train the classifier on the ambiguous input files, labeled by name, and write it as a C header\n" \
+	"\t-x <ms> Record this much of each call and print the frames of misclassified files to stderr\n" \
 	"\t-R Summarize results\n"
 
 int main(int argc, char **argv)
@@ -165,9 +541,13 @@ int main(int argc, char **argv)
 	struct amd_test_stats test_stats = { 0 };
 	char *list_file_name = NULL;
 	char *raw_audio_file_name = NULL;
+	static const struct option long_options[] = {
+		{ "stream", no_argument, NULL, 'I' },
+		{ NULL, 0, NULL, 0 }
+	};
 	int opt;
 
-	while ((opt = getopt(argc, argv, "a:f:l:e:v:s:i:m:w:c:r:n:dR")) != -1) {
+	while ((opt = getopt_long(argc, argv, "a:f:l:e:v:s:i:m:w:c:r:n:N:L:F:o:x:P:K:G:B:T:CdRS", long_options, NULL)) != -1) {
 		switch (opt) {
 			case 'f':
 				raw_audio_file_name = strdup(optarg);
@@ -246,10 +626,10 @@ int main(int argc, char **argv)
 			}
 			case 'c': {
 				int val = atoi(optarg);
-				if (val > 0) {
+				if (val > 0 && val <= SAMD_MAX_CHANNELS) {
 					vad_channels = val;
 				} else {
-					fprintf(stderr, "option -c (vad channels) must be > 0\n");
+					fprintf(stderr, "option -c (vad channels) must be > 0 and <= %d\n", SAMD_MAX_CHANNELS);
 					exit(EXIT_FAILURE);
 				}
 				break;
@@ -274,12 +654,94 @@ int main(int argc, char **argv)
 				}
 				break;
 			}
+			case 'F': {
+				int val = atoi(optarg);
+				if (val == 5 || val == 10 || val == 20 || val == 40) {
+					frame_ms = val;
+				} else {
+					fprintf(stderr, "option -F (frame ms) must be 5, 10, 20 or 40\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
+			case 'o':
+				if (!strcmp(optarg, "text")) {
+					output_format = OUTPUT_TEXT;
+				} else if (!strcmp(optarg, "csv")) {
+					output_format = OUTPUT_CSV;
+				} else if (!strcmp(optarg, "json")) {
+					output_format = OUTPUT_JSON;
+				} else {
+					fprintf(stderr, "option -o (output format) must be text, csv or json\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'N': {
+				int val = atoi(optarg);
+				if (val >= 0) {
+					vad_noise_floor_window_ms = val;
+				} else {
+					fprintf(stderr, "option -N (vad noise floor window ms) must be >= 0\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
+			case 'L': {
+				double val = atof(optarg);
+				if (val == 0.0 || (val > 0.5 && val <= 1.0)) {
+					amd_provisional_confidence = val;
+				} else {
+					fprintf(stderr, "option -L (amd provisional confidence) must be > 0.5 and <= 1, or 0\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
+			case 'P':
+				if (samd_priors_open(&priors, optarg, 1024)) {
+					perror(optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'K':
+				priors_key = optarg;
+				break;
+			case 'G':
+				if (samd_fingerprint_index_open(&fingerprint_index, optarg)) {
+					fprintf(stderr, "Failed to open fingerprint index %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'B':
+				fingerprint_build_file = optarg;
+				break;
+			case 'C':
+				use_classifier = 1;
+				break;
+			case 'T':
+				classifier_train_file = optarg;
+				break;
+			case 'x': {
+				int val = atoi(optarg);
+				if (val > 0) {
+					recorder_ms = val;
+				} else {
+					fprintf(stderr, "option -x (recorder ms) must be > 0\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			}
 			case 'd':
 				debug = 1;
 				break;
 			case 'R':
 				summarize = 1;
 				break;
+			case 'S':
+				split_channels = 1;
+				break;
+			case 'I':
+				stream = 1;
+				break;
 			default:
 				printf("%s", HELP);
 				exit(EXIT_SUCCESS);
@@ -287,12 +749,46 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (fingerprint_index && SAMD_FINGERPRINT_STEP_MS % frame_ms) {
+		fprintf(stderr, "option -G (fingerprint index) needs -F (frame ms) of 5, 10 or 20\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* "-" streams from stdin */
+	if (optind < argc && !strcmp(argv[optind], "-")) {
+		stream = 1;
+	} else if (raw_audio_file_name && !strcmp(raw_audio_file_name, "-")) {
+		stream = 1;
+		free(raw_audio_file_name);
+		raw_audio_file_name = NULL;
+	}
+	if (stream) {
+		if (list_file_name) {
+			fprintf(stderr, USAGE"\n");
+			exit(EXIT_FAILURE);
+		}
+		analyze_stream(raw_audio_file_name);
+		samd_priors_close(&priors);
+		return EXIT_SUCCESS;
+	}
+
 	/* list file and raw audio file are mutually exclusive */
 	if ((!list_file_name && !raw_audio_file_name) || (list_file_name && raw_audio_file_name)) {
 		fprintf(stderr, USAGE"\n");
 		exit(EXIT_FAILURE);
 	}
 
+	if (fingerprint_build_file) {
+		samd_fingerprint_builder_init(&fingerprint_builder, vad_sample_rate);
+	}
+	if (classifier_train_file) {
+		samd_classifier_trainer_init(&classifier_trainer);
+	}
+
+	if (output_format == OUTPUT_CSV) {
+		printf("file,expected,result,pass,event,time_ms,frames,audio_ms,wall_ms,cpu_ms,rtf\n");
+	}
+
 	/* analyze the files */
 	if (list_file_name) {
 		char raw_audio_file_buf[1024];
@@ -307,12 +803,34 @@ int main(int argc, char **argv)
 				*newline = '\0';
 			}
 			if (raw_audio_file_buf[0] != '\0' && raw_audio_file_buf[0] != '#') {
-				analyze_file(&test_stats, raw_audio_file_buf, get_expected_result_from_audio_file_name(raw_audio_file_buf));
+				process_file(&test_stats, raw_audio_file_buf);
 			}
 		}
 		fclose(list_file);
 	} else {
-		analyze_file(&test_stats, raw_audio_file_name, get_expected_result_from_audio_file_name(raw_audio_file_name));
+		process_file(&test_stats, raw_audio_file_name);
+	}
+
+	if (fingerprint_builder) {
+		if (samd_fingerprint_builder_write(fingerprint_builder, fingerprint_build_file)) {
+			perror(fingerprint_build_file);
+			exit(EXIT_FAILURE);
+		}
+		samd_fingerprint_builder_destroy(&fingerprint_builder);
+		return EXIT_SUCCESS;
+	}
+
+	if (classifier_trainer) {
+		samd_classifier_model_t model;
+		if (samd_classifier_trainer_fit(classifier_trainer, &model)) {
+			fprintf(stderr, "Need ambiguous humans and machines to train the classifier\n");
+			exit(EXIT_FAILURE);
+		}
+		if (samd_classifier_write(&model, classifier_train_file, "samd_classifier_model")) {
+			perror(classifier_train_file);
+			exit(EXIT_FAILURE);
+		}
+		samd_classifier_trainer_destroy(&classifier_trainer);
 	}
 
 	/* output final stats */
@@ -357,5 +875,7 @@ int main(int argc, char **argv)
 			((double)correctly_detected_total / (double)total) * 100.0);
 	}
 
+	samd_priors_close(&priors);
+	samd_fingerprint_index_close(&fingerprint_index);
 	return EXIT_SUCCESS;
 }
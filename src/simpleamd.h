@@ -24,6 +24,7 @@
 #ifndef SIMPLEAMD_H
 #define SIMPLEAMD_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* common */
@@ -36,6 +37,70 @@ typedef enum samd_log_level {
 
 typedef void (* samd_log_fn)(samd_log_level_t level, void *user_log_data, const char *file, int line, const char *message);
 
+/* Statistics - counters of a detector, or of all detectors with samd_get_global_stats() */
+typedef struct samd_stats {
+	uint64_t frames;
+	uint64_t samples;
+	uint64_t voice_frames;
+	uint64_t vad_transitions;
+	uint64_t amd_transitions;
+	uint64_t beep_candidates;
+	uint64_t beep_rejected;
+	uint64_t beep_accepted;
+	uint64_t analyzer_cycles;
+	uint64_t vad_cycles;
+	uint64_t beep_cycles;
+	uint64_t amd_cycles;
+	uint64_t spectral_frames;
+	double initial_energy_threshold;
+	double energy_threshold;
+	double average_energy;
+	double noise_floor;
+} samd_stats_t;
+
+void samd_get_global_stats(samd_stats_t *stats);
+
+
+/* Frame analyzer - computes energy and zero crossings for each audio frame and sends them to subscribers */
+#define SAMD_MAX_CHANNELS 16
+
+typedef enum samd_channel_mode {
+	SAMD_CHANNEL_MODE_MIXED,
+	SAMD_CHANNEL_MODE_SPLIT
+} samd_channel_mode_t;
+
+typedef struct samd_frame_analyzer samd_frame_analyzer_t;
+
+/* Spectral features of a frame, see samd_frame_analyzer_set_spectral() */
+#define SAMD_SPECTRAL_BANDS 4
+
+typedef struct samd_spectral_features {
+	/* power weighted mean frequency */
+	double centroid_hz;
+	/* geometric / arithmetic mean of power: near 1 for noise, near 0 for tones */
+	double flatness;
+	/* fraction of power in 0-500, 500-1000, 1000-2000 and 2000-4000 Hz */
+	double bands[SAMD_SPECTRAL_BANDS];
+} samd_spectral_features_t;
+
+typedef void (* samd_frame_analyzer_cb_fn)(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings);
+
+void samd_frame_analyzer_init(samd_frame_analyzer_t **analyzer);
+void samd_frame_analyzer_subscribe(samd_frame_analyzer_t *analyzer, samd_frame_analyzer_cb_fn cb, void *user_cb_data);
+void samd_frame_analyzer_subscribe_channel(samd_frame_analyzer_t *analyzer, uint32_t channel, samd_frame_analyzer_cb_fn cb, void *user_cb_data);
+void samd_frame_analyzer_unsubscribe(samd_frame_analyzer_t *analyzer, samd_frame_analyzer_cb_fn cb, void *user_cb_data);
+void samd_frame_analyzer_set_sample_rate(samd_frame_analyzer_t *analyzer, uint32_t sample_rate);
+void samd_frame_analyzer_set_frame_ms(samd_frame_analyzer_t *analyzer, uint32_t ms);
+void samd_frame_analyzer_set_channel_mode(samd_frame_analyzer_t *analyzer, samd_channel_mode_t channel_mode);
+void samd_frame_analyzer_set_spectral(samd_frame_analyzer_t *analyzer, int spectral);
+void samd_frame_analyzer_process_buffer(samd_frame_analyzer_t *analyzer, int16_t *samples, uint32_t num_samples, uint32_t channels);
+int samd_frame_analyzer_get_spectral_features(samd_frame_analyzer_t *analyzer, samd_spectral_features_t *features);
+void samd_frame_analyzer_process_gap(samd_frame_analyzer_t *analyzer, uint32_t ms, double energy);
+void samd_frame_analyzer_process_frame_features(samd_frame_analyzer_t *analyzer, uint32_t time_ms, double energy, uint32_t zero_crossings);
+double samd_frame_analyzer_get_average_energy(samd_frame_analyzer_t *analyzer);
+double samd_frame_analyzer_get_channel_average_energy(samd_frame_analyzer_t *analyzer, uint32_t channel);
+void samd_frame_analyzer_destroy(samd_frame_analyzer_t **analyzer);
+
 
 /* VAD */
 typedef enum samd_vad_event {
@@ -46,6 +111,11 @@ typedef enum samd_vad_event {
 	SAMD_VAD_VOICE
 } samd_vad_event_t;
 
+typedef enum samd_vad_event_mode {
+	SAMD_VAD_EVENT_MODE_ALL,
+	SAMD_VAD_EVENT_MODE_EDGE
+} samd_vad_event_mode_t;
+
 typedef struct samd_vad samd_vad_t;
 
 typedef void (* samd_vad_event_fn)(samd_vad_event_t event, uint32_t time_ms, uint32_t total_voice_ms, uint32_t transition_ms, void *user_event_data);
@@ -53,14 +123,25 @@ typedef void (* samd_vad_event_fn)(samd_vad_event_t event, uint32_t time_ms, uin
 void samd_vad_init(samd_vad_t **vad);
 void samd_vad_set_log_handler(samd_vad_t *vad, samd_log_fn log_handler, void *user_log_data);
 void samd_vad_set_event_handler(samd_vad_t *vad, samd_vad_event_fn event_handler, void *user_event_data);
+void samd_vad_set_event_mode(samd_vad_t *vad, samd_vad_event_mode_t event_mode);
+void samd_vad_set_heartbeat_ms(samd_vad_t *vad, uint32_t ms);
 void samd_vad_set_sample_rate(samd_vad_t *vad, uint32_t sample_rate);
+void samd_vad_set_frame_ms(samd_vad_t *vad, uint32_t ms);
 void samd_vad_set_energy_threshold(samd_vad_t *vad, double energy_threshold);
 void samd_vad_set_max_energy_threshold(samd_vad_t *vad, double max_energy_threshold);
 void samd_vad_set_initial_adjust_ms(samd_vad_t *vad, uint32_t ms);
 void samd_vad_set_voice_adjust_ms(samd_vad_t *vad, uint32_t ms);
 void samd_vad_set_voice_ms(samd_vad_t *vad, uint32_t ms);
 void samd_vad_set_voice_end_ms(samd_vad_t *vad, uint32_t ms);
+void samd_vad_set_noise_floor_window_ms(samd_vad_t *vad, uint32_t ms);
+void samd_vad_set_noise_floor_percentile(samd_vad_t *vad, uint32_t percentile);
+void samd_vad_set_prior(samd_vad_t *vad, double noise_floor, double threshold);
+int samd_vad_get_noise_floor(samd_vad_t *vad, double *noise_floor);
 void samd_vad_process_buffer(samd_vad_t *vad, int16_t *samples, uint32_t num_samples, uint32_t channels);
+void samd_vad_process_gap(samd_vad_t *vad, uint32_t ms, double energy);
+void samd_vad_process_frame_features(samd_vad_t *vad, uint32_t time_ms, double energy, uint32_t zero_crossings);
+void samd_vad_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings);
+void samd_vad_get_stats(samd_vad_t *vad, samd_stats_t *stats);
 void samd_vad_destroy(samd_vad_t **vad);
 const char *samd_vad_event_to_string(samd_vad_event_t event);
 
@@ -74,7 +155,12 @@ void samd_beep_init(samd_beep_t **beep);
 void samd_beep_set_log_handler(samd_beep_t *beep, samd_log_fn log_handler, void *user_log_data);
 void samd_beep_set_event_handler(samd_beep_t *beep, samd_beep_event_fn event_handler, void *user_event_data);
 void samd_beep_set_sample_rate(samd_beep_t *beep, uint32_t sample_rate);
+void samd_beep_set_frame_ms(samd_beep_t *beep, uint32_t ms);
 void samd_beep_process_buffer(samd_beep_t *beep, int16_t *samples, uint32_t num_samples, uint32_t channels);
+void samd_beep_process_gap(samd_beep_t *beep, uint32_t ms, double energy);
+void samd_beep_process_frame_features(samd_beep_t *beep, uint32_t time_ms, double energy, uint32_t zero_crossings);
+void samd_beep_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings);
+void samd_beep_get_stats(samd_beep_t *beep, samd_stats_t *stats);
 void samd_beep_destroy(samd_beep_t **beep);
 
 
@@ -85,21 +171,93 @@ typedef enum samd_event {
 	SAMD_MACHINE_SILENCE,
 	SAMD_MACHINE_BEEP,
 	SAMD_HUMAN_VOICE,
-	SAMD_HUMAN_SILENCE
+	SAMD_HUMAN_SILENCE,
+	/* provisional, see samd_set_provisional_confidence() */
+	SAMD_LIKELY_HUMAN,
+	SAMD_LIKELY_MACHINE,
+	/* matched a known greeting, see samd_fingerprint.h */
+	SAMD_MACHINE_FINGERPRINT
 } samd_event_t;
 
 typedef struct samd samd_t;
-typedef void (* samd_event_fn)(samd_event_t event, uint32_t samples, void *user_event_data);
+typedef void (* samd_event_fn)(samd_event_t event, uint32_t time_ms, void *user_event_data);
+
+/* Position of an event in the input, see samd_set_event_info_handler() */
+typedef struct samd_event_info {
+	samd_event_t event;
+	/* since detection began, doesn't wrap */
+	uint64_t time_ms;
+	/* index per channel of the first sample after the frame the event was detected in, or of the
+	 * end of the beep for SAMD_MACHINE_BEEP */
+	uint64_t sample;
+	/* sample relative to the start of the buffer or gap just processed, in samples per channel.
+	 * Negative if sample is in an earlier buffer, as the end of a beep can be. */
+	int64_t offset;
+} samd_event_info_t;
+
+typedef void (* samd_event_info_fn)(const samd_event_info_t *info, void *user_event_data);
+
+typedef struct samd_event_record {
+	samd_event_t event;
+	/* see samd_event_info_t */
+	uint64_t time_ms;
+	uint64_t sample;
+	int64_t offset;
+} samd_event_record_t;
+
+/* Flight recorder - recent frames of an AMD, see samd_set_recorder_ms() */
+typedef enum samd_recorder_vad_state {
+	SAMD_RECORDER_VAD_INITIAL,
+	SAMD_RECORDER_VAD_SILENCE,
+	SAMD_RECORDER_VAD_VOICE
+} samd_recorder_vad_state_t;
+
+typedef enum samd_recorder_amd_state {
+	SAMD_RECORDER_AMD_WAIT_FOR_VOICE,
+	SAMD_RECORDER_AMD_DETECT,
+	SAMD_RECORDER_AMD_HUMAN,
+	SAMD_RECORDER_AMD_MACHINE,
+	SAMD_RECORDER_AMD_DONE
+} samd_recorder_amd_state_t;
+
+/* frame was classified as voice */
+#define SAMD_RECORDER_VOICE 0x01
+/* beep detector is timing a potential beep */
+#define SAMD_RECORDER_BEEP 0x02
+
+typedef struct samd_recorder_frame {
+	uint32_t time_ms;
+	uint16_t energy;
+	uint16_t threshold;
+	uint8_t zero_crossings;
+	uint8_t vad_state;
+	uint8_t amd_state;
+	uint8_t flags;
+} samd_recorder_frame_t;
 
 void samd_init(samd_t **amd);
 samd_vad_t *samd_get_vad(samd_t *amd);
 samd_beep_t *samd_get_beep(samd_t *beep);
 void samd_set_wait_for_voice_ms(samd_t *amd, uint32_t ms);
 void samd_set_machine_ms(samd_t *amd, uint32_t ms);
+void samd_set_provisional_confidence(samd_t *amd, double confidence);
+double samd_get_machine_likelihood(samd_t *amd);
+void samd_set_spectral(samd_t *amd, int spectral);
+uint32_t samd_get_spectral_features(samd_t *amd, samd_spectral_features_t *features);
 void samd_set_log_handler(samd_t *amd, samd_log_fn log_handler, void *user_log_data);
 void samd_set_event_handler(samd_t *amd, samd_event_fn event_handler, void *user_event_data);
+void samd_set_event_info_handler(samd_t *amd, samd_event_info_fn event_info_handler, void *user_event_data);
 void samd_set_sample_rate(samd_t *amd, uint32_t sample_rate);
+void samd_set_frame_ms(samd_t *amd, uint32_t ms);
 void samd_process_buffer(samd_t *amd, int16_t *samples, uint32_t num_samples, uint32_t channels);
+size_t samd_process_buffer_events(samd_t *amd, int16_t *samples, uint32_t num_samples, uint32_t channels, samd_event_record_t *events, size_t max_events);
+void samd_process_gap(samd_t *amd, uint32_t ms, double energy);
+void samd_process_frame_features(samd_t *amd, uint32_t time_ms, double energy, uint32_t zero_crossings);
+void samd_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings);
+void samd_set_measure_cycles(samd_t *amd, int measure_cycles);
+void samd_set_recorder_ms(samd_t *amd, uint32_t ms);
+size_t samd_dump_recorder(samd_t *amd, samd_recorder_frame_t *frames, size_t max_frames);
+void samd_get_stats(samd_t *amd, samd_stats_t *stats);
 void samd_destroy(samd_t **amd);
 const char *samd_event_to_string(samd_event_t event);
 
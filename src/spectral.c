@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * Spectral features for the frame analyzer.  The most recent SPECTRAL_RING_SIZE samples of each
+ * channel, decimated to at most 8 kHz, are kept in a ring as audio is analyzed.  When a subscriber
+ * asks for the features of a frame, the power of Hann windowed FFTs overlapping by half is averaged
+ * over windows covering the whole frame (Welch's method).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "samd_private.h"
+
+/** upper edge of each band in Hz */
+static const double band_edges_hz[SAMD_SPECTRAL_BANDS] = { 500.0, 1000.0, 2000.0, 4000.0 };
+
+/**
+ * Create spectral state
+ * @return the state
+ */
+samd_spectral_t *samd_spectral_create(void)
+{
+	samd_spectral_t *spectral = (samd_spectral_t *)calloc(1, sizeof(*spectral));
+	uint32_t i;
+	if (!spectral) {
+		return NULL;
+	}
+	for (i = 0; i < SPECTRAL_FFT_SIZE; i++) {
+		uint32_t j, r = 0;
+		spectral->window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / (SPECTRAL_FFT_SIZE - 1));
+		for (j = 1; j < SPECTRAL_FFT_SIZE; j <<= 1) {
+			r = (r << 1) | ((i & j) ? 1 : 0);
+		}
+		spectral->bit_reverse[i] = r;
+	}
+	for (i = 0; i < SPECTRAL_FFT_SIZE / 2; i++) {
+		spectral->cos_table[i] = cosf(2.0f * (float)M_PI * i / SPECTRAL_FFT_SIZE);
+		spectral->sin_table[i] = sinf(2.0f * (float)M_PI * i / SPECTRAL_FFT_SIZE);
+	}
+	return spectral;
+}
+
+/**
+ * Add samples of a channel to its ring
+ * @param spectral
+ * @param channel
+ * @param samples
+ * @param num_samples
+ * @param downsample_factor average every N samples into one
+ */
+void samd_spectral_push(samd_spectral_t *spectral, uint32_t channel, const int16_t *samples, uint32_t num_samples, uint32_t downsample_factor)
+{
+	int16_t *ring = spectral->ring[channel];
+	uint32_t pos = spectral->pos[channel];
+	uint32_t i;
+
+	if (downsample_factor == 1) {
+		for (i = 0; i < num_samples; i++) {
+			ring[pos] = samples[i];
+			pos = (pos + 1) & (SPECTRAL_RING_SIZE - 1);
+		}
+	} else {
+		/* box filter before decimating, so higher rates don't alias */
+		int32_t sum = spectral->sum[channel];
+		uint32_t summed = spectral->summed[channel];
+		for (i = 0; i < num_samples; i++) {
+			sum += samples[i];
+			if (++summed == downsample_factor) {
+				ring[pos] = (int16_t)(sum / (int32_t)downsample_factor);
+				pos = (pos + 1) & (SPECTRAL_RING_SIZE - 1);
+				sum = 0;
+				summed = 0;
+			}
+		}
+		spectral->sum[channel] = sum;
+		spectral->summed[channel] = summed;
+	}
+	spectral->pos[channel] = pos;
+	spectral->pushed[channel] += num_samples;
+}
+
+/**
+ * Add num_samples of digital silence to a channel's ring.  The same as pushing zeros, but once the
+ * ring is all zeros the rest of the gap costs nothing.
+ * @param spectral
+ * @param channel
+ * @param num_samples
+ * @param downsample_factor average every N samples into one
+ */
+void samd_spectral_push_silence(samd_spectral_t *spectral, uint32_t channel, uint64_t num_samples, uint32_t downsample_factor)
+{
+	static const int16_t zeros[SPECTRAL_FFT_SIZE] = { 0 };
+	uint64_t fill = (uint64_t)(SPECTRAL_RING_SIZE + 1) * downsample_factor;
+
+	if (num_samples > fill) {
+		/* partial sum is completed, then the whole ring is zeros */
+		memset(spectral->ring[channel], 0, sizeof(spectral->ring[channel]));
+		spectral->sum[channel] = 0;
+		spectral->summed[channel] = (spectral->summed[channel] + num_samples) % downsample_factor;
+		spectral->pushed[channel] += num_samples;
+		return;
+	}
+	while (num_samples) {
+		uint32_t n = num_samples < SPECTRAL_FFT_SIZE ? (uint32_t)num_samples : SPECTRAL_FFT_SIZE;
+		samd_spectral_push(spectral, channel, zeros, n, downsample_factor);
+		num_samples -= n;
+	}
+}
+
+/**
+ * Add the power of one Hann windowed FFT to power
+ * @param spectral
+ * @param ring of the channel
+ * @param start ring position of the window's oldest sample
+ * @param power (in/out) per bin, DC to Nyquist
+ */
+static void spectral_window_power(samd_spectral_t *spectral, const int16_t *ring, uint32_t start, double *power)
+{
+	float re[SPECTRAL_FFT_SIZE];
+	float im[SPECTRAL_FFT_SIZE];
+	uint32_t size, i, k;
+
+	/* oldest sample first, in bit reversed order */
+	for (i = 0; i < SPECTRAL_FFT_SIZE; i++) {
+		uint32_t r = spectral->bit_reverse[i];
+		re[r] = ring[(start + i) & (SPECTRAL_RING_SIZE - 1)] * spectral->window[i];
+		im[r] = 0.0f;
+	}
+
+	/* radix 2 decimation in time */
+	for (size = 2; size <= SPECTRAL_FFT_SIZE; size <<= 1) {
+		uint32_t half = size / 2;
+		uint32_t step = SPECTRAL_FFT_SIZE / size;
+		for (i = 0; i < SPECTRAL_FFT_SIZE; i += size) {
+			for (k = 0; k < half; k++) {
+				float wr = spectral->cos_table[k * step];
+				float wi = -spectral->sin_table[k * step];
+				uint32_t a = i + k, b = i + k + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+
+	for (k = 1; k <= SPECTRAL_FFT_SIZE / 2; k++) {
+		power[k] += (double)re[k] * re[k] + (double)im[k] * im[k];
+	}
+}
+
+/**
+ * Compute the features of the last frame in a channel's ring
+ * @param spectral
+ * @param channel
+ * @param sample_rate of the samples in the ring
+ * @param frame_samples decimated samples in the frame
+ * @param features (output)
+ */
+void samd_spectral_compute(samd_spectral_t *spectral, uint32_t channel, uint32_t sample_rate, uint32_t frame_samples, samd_spectral_features_t *features)
+{
+	double power[SPECTRAL_FFT_SIZE / 2 + 1] = { 0.0 };
+	const int16_t *ring = spectral->ring[channel];
+	uint32_t end = spectral->pos[channel];
+	double bin_hz = (double)sample_rate / SPECTRAL_FFT_SIZE;
+	double total = 0.0, weighted = 0.0, log_sum = 0.0;
+	uint32_t windows = 1, i, k, band = 0;
+
+	memset(features, 0, sizeof(*features));
+
+	/* windows step back half a window at a time from the newest sample until the frame is covered */
+	if (frame_samples > SPECTRAL_RING_SIZE) {
+		frame_samples = SPECTRAL_RING_SIZE;
+	}
+	if (frame_samples > SPECTRAL_FFT_SIZE) {
+		windows += (frame_samples - SPECTRAL_FFT_SIZE + SPECTRAL_FFT_SIZE / 2 - 1) / (SPECTRAL_FFT_SIZE / 2);
+	}
+	for (i = 0; i < windows; i++) {
+		spectral_window_power(spectral, ring, end - SPECTRAL_FFT_SIZE - i * (SPECTRAL_FFT_SIZE / 2), power);
+	}
+
+	/* mean power of each bin, without DC */
+	for (k = 1; k <= SPECTRAL_FFT_SIZE / 2; k++) {
+		double bin_power = power[k] / windows + 1e-3;
+		double hz = k * bin_hz;
+		total += bin_power;
+		weighted += bin_power * hz;
+		log_sum += log(bin_power);
+		while (band < SAMD_SPECTRAL_BANDS - 1 && hz >= band_edges_hz[band]) {
+			band++;
+		}
+		features->bands[band] += bin_power;
+	}
+
+	features->centroid_hz = weighted / total;
+	features->flatness = exp(log_sum / (SPECTRAL_FFT_SIZE / 2)) / (total / (SPECTRAL_FFT_SIZE / 2));
+	for (band = 0; band < SAMD_SPECTRAL_BANDS; band++) {
+		features->bands[band] /= total;
+	}
+	spectral->computed++;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+#include <string.h>
+#include <simpleamd.h>
+#include <samd_private.h>
+
+/** apply op to each counter summed in the global stats */
+#define STATS_FOR_EACH(op) \
+	op(frames); \
+	op(samples); \
+	op(voice_frames); \
+	op(vad_transitions); \
+	op(amd_transitions); \
+	op(beep_candidates); \
+	op(beep_rejected); \
+	op(beep_accepted); \
+	op(analyzer_cycles); \
+	op(vad_cycles); \
+	op(beep_cycles); \
+	op(amd_cycles); \
+	op(spectral_frames)
+
+/* one counter of shard, stats and flushed_stats; only the owning thread stores to a shard */
+#define STATS_FLUSH(field) __atomic_store_n(&shard->stats.field, shard->stats.field + (stats->field - flushed_stats->field), __ATOMIC_RELAXED)
+#define STATS_FLUSH_RETIRED(field) __atomic_fetch_add(&retired->stats.field, stats->field - flushed_stats->field, __ATOMIC_RELAXED)
+#define STATS_RETIRE(field) __atomic_fetch_add(&retired->stats.field, shard->stats.field, __ATOMIC_RELAXED)
+#define STATS_SUM(field) stats->field += __atomic_load_n(&shard->stats.field, __ATOMIC_RELAXED)
+
+/**
+ * Fold an exiting thread's counters into the retired shard, with shards locked
+ * @param retired
+ * @param shard of the exiting thread
+ */
+void samd_stats_retire(samd_shard_t *retired, const samd_shard_t *shard)
+{
+	STATS_FOR_EACH(STATS_RETIRE);
+}
+
+/**
+ * Add counters that changed since the last flush to this thread's shard of the global stats
+ * @param stats current stats of a detector
+ * @param flushed_stats stats at the last flush, updated
+ */
+void samd_stats_flush(const samd_stats_t *stats, samd_stats_t *flushed_stats)
+{
+	samd_shard_t *shard = samd_shard();
+	if (shard) {
+		STATS_FOR_EACH(STATS_FLUSH);
+	} else {
+		samd_shard_t *retired = samd_shard_retired();
+		STATS_FOR_EACH(STATS_FLUSH_RETIRED);
+	}
+	*flushed_stats = *stats;
+}
+
+static void stats_sum(const samd_shard_t *shard, void *user_data)
+{
+	samd_stats_t *stats = (samd_stats_t *)user_data;
+	STATS_FOR_EACH(STATS_SUM);
+}
+
+/**
+ * Get the counters of all detectors in this process.  Detectors add to these after each
+ * buffer they process, and when destroyed.  Energy thresholds and average energy are per detector
+ * and always 0 here.
+ * @param stats (output)
+ */
+void samd_get_global_stats(samd_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	samd_shard_for_each(stats_sum, stats);
+}
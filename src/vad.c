@@ -5,12 +5,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "samd_private.h"
 
-static void vad_state_initial(samd_vad_t *vad, int in_voice);
-static void vad_state_silence(samd_vad_t *vad, int in_voice);
-static void vad_state_voice(samd_vad_t *vad, int in_voice);
+static samd_vad_event_t vad_state_initial(samd_vad_t *vad, int in_voice);
+static samd_vad_event_t vad_state_silence(samd_vad_t *vad, int in_voice);
+static samd_vad_event_t vad_state_voice(samd_vad_t *vad, int in_voice);
 
 #define VAD_DEFAULT_ENERGY_THRESHOLD 130.0
 #define VAD_DEFAULT_MAX_ENERGY_THRESHOLD 1300.0
@@ -18,6 +19,8 @@ static void vad_state_voice(samd_vad_t *vad, int in_voice);
 #define VAD_DEFAULT_VOICE_END_MS 850
 #define VAD_DEFAULT_INITIAL_ADJUST_MS 200
 #define VAD_DEFAULT_VOICE_ADJUST_MS 0
+#define VAD_DEFAULT_NOISE_FLOOR_PERCENTILE 10
+#define VAD_THRESHOLD_FACTOR 3.0
 
 /**
  * NO-OP log handler
@@ -65,6 +68,7 @@ void samd_vad_set_event_handler(samd_vad_t *vad, samd_vad_event_fn event_handler
 void samd_vad_set_energy_threshold(samd_vad_t *vad, double threshold)
 {
 	vad->threshold = threshold;
+	vad->initial_threshold = threshold;
 }
 
 /**
@@ -97,6 +101,16 @@ void samd_vad_set_sample_rate(samd_vad_t *vad, uint32_t sample_rate)
 	samd_frame_analyzer_set_sample_rate(vad->analyzer, sample_rate);
 }
 
+/**
+ * Set the duration of each analysis frame
+ * @param vad
+ * @param ms 5, 10 (default), 20 or 40
+ */
+void samd_vad_set_frame_ms(samd_vad_t *vad, uint32_t ms)
+{
+	samd_frame_analyzer_set_frame_ms(vad->analyzer, ms);
+}
+
 /**
  * Time to adjust energy threshold relative to start.  Set to 0 to disable.
  */
@@ -128,7 +142,8 @@ static void vad_threshold_adjust(samd_vad_t *vad, samd_frame_analyzer_t *analyze
 {
 	uint32_t time_ms = vad->time_ms;
 	double average_energy = samd_frame_analyzer_get_average_energy(analyzer);
-	double new_threshold = fmin(average_energy * 3.0, vad->max_threshold);
+	double new_threshold = fmin(average_energy * VAD_THRESHOLD_FACTOR, vad->max_threshold);
+	SAMD_PROBE5(vad_threshold, vad, time_ms, (uint32_t)vad->threshold, (uint32_t)fmax(new_threshold, vad->threshold), (uint32_t)average_energy);
 	if (new_threshold > vad->threshold) {
 		samd_log_printf(vad, SAMD_LOG_INFO, "%d: increasing threshold %f to %f, average energy = %f\n", time_ms, vad->threshold, new_threshold, average_energy);
 		vad->threshold = new_threshold;
@@ -138,29 +153,298 @@ static void vad_threshold_adjust(samd_vad_t *vad, samd_frame_analyzer_t *analyze
 }
 
 /**
- * Handle the next frame of processed audio
+ * Track the noise floor continuously and keep the energy threshold at 3x the noise floor,
+ * between the configured energy threshold and max energy threshold.  This replaces the one time
+ * adjustments at initial_adjust_ms and voice_adjust_ms; the threshold is first set at
+ * initial_adjust_ms.  Off by default.
+ * @param vad
+ * @param ms duration of recent audio the noise floor is measured over, 0 to disable
+ */
+void samd_vad_set_noise_floor_window_ms(samd_vad_t *vad, uint32_t ms)
+{
+	vad->noise_floor_window_ms = ms;
+	free(vad->noise_floor_ring);
+	vad->noise_floor_ring = NULL;
+	vad->noise_floor_frames = 0;
+	vad->noise_floor_pos = 0;
+	vad->noise_floor_count = 0;
+	memset(vad->noise_floor_histogram, 0, sizeof(vad->noise_floor_histogram));
+}
+
+/**
+ * Set the percentile of frame energy over the noise floor window taken as the noise floor
+ * @param vad
+ * @param percentile 1 - 99 (default 10)
+ */
+void samd_vad_set_noise_floor_percentile(samd_vad_t *vad, uint32_t percentile)
+{
+	if (percentile >= 1 && percentile <= 99) {
+		vad->noise_floor_percentile = percentile;
+	}
+}
+
+/**
+ * Seed the VAD with a known noise floor and energy threshold, for example from earlier calls on the
+ * same trunk group.  Voice is detected against the threshold from the first frame instead of
+ * after initial_adjust_ms, and the initial adjustment of the threshold is skipped, though the noise
+ * floor is still measured then for samd_priors_update().  With noise floor tracking, the prior is
+ * kept until the noise floor window is full.  Set after the energy thresholds.
+ * @param vad
+ * @param noise_floor background energy
+ * @param threshold energy threshold, or 0 for 3x noise_floor, between the energy threshold and
+ *        the max energy threshold
+ */
+void samd_vad_set_prior(samd_vad_t *vad, double noise_floor, double threshold)
+{
+	if (threshold <= 0.0) {
+		threshold = fmax(fmin(noise_floor * VAD_THRESHOLD_FACTOR, vad->max_threshold), vad->initial_threshold);
+	}
+	vad->noise_floor = noise_floor;
+	vad->threshold = threshold;
+	vad->has_prior = 1;
+}
+
+/**
+ * Get the background energy measured from this call's audio: at initial_adjust_ms, or by noise
+ * floor tracking.
+ * @param vad
+ * @param noise_floor (output)
+ * @return 1 if measured, 0 if not (yet)
+ */
+int samd_vad_get_noise_floor(samd_vad_t *vad, double *noise_floor)
+{
+	*noise_floor = vad->noise_floor;
+	return vad->noise_floor_measured;
+}
+
+/**
+ * @return noise floor histogram bin of energy: 4 bins per octave
+ */
+static uint32_t noise_floor_bin(double energy)
+{
+	uint32_t e = energy < 65535.0 ? (uint32_t)energy : 65535;
+	uint32_t msb;
+	if (e < 4) {
+		return e;
+	}
+	msb = 31 - __builtin_clz(e);
+	return msb * 4 + ((e >> (msb - 2)) & 3) - 4;
+}
+
+/**
+ * @return lowest energy in noise floor histogram bin
+ */
+static double noise_floor_bin_energy(uint32_t bin)
+{
+	if (bin < 4) {
+		return bin;
+	}
+	return (double)((4 + bin % 4) << (bin / 4 - 1));
+}
+
+/**
+ * Add a frame to the noise floor window, dropping the oldest, and find the new noise floor.
+ * Cost is constant per frame.
+ * @param vad
+ * @param energy of frame
+ */
+static void vad_noise_floor_update(samd_vad_t *vad, double energy)
+{
+	uint32_t target;
+	uint32_t seen = 0;
+	uint32_t bin;
+
+	if (!vad->noise_floor_ring) {
+		vad->noise_floor_frames = vad->noise_floor_window_ms / vad->frame_ms;
+		if (vad->noise_floor_frames == 0) {
+			vad->noise_floor_frames = 1;
+		}
+		vad->noise_floor_ring = (uint8_t *)malloc(vad->noise_floor_frames);
+		if (!vad->noise_floor_ring) {
+			return;
+		}
+	}
+	if (vad->noise_floor_count == vad->noise_floor_frames) {
+		vad->noise_floor_histogram[vad->noise_floor_ring[vad->noise_floor_pos]]--;
+	} else {
+		vad->noise_floor_count++;
+	}
+	bin = noise_floor_bin(energy);
+	vad->noise_floor_ring[vad->noise_floor_pos] = bin;
+	vad->noise_floor_histogram[bin]++;
+	if (++vad->noise_floor_pos == vad->noise_floor_frames) {
+		vad->noise_floor_pos = 0;
+	}
+
+	target = vad->noise_floor_count * vad->noise_floor_percentile / 100;
+	for (bin = 0; bin < NOISE_FLOOR_BINS - 1; bin++) {
+		seen += vad->noise_floor_histogram[bin];
+		if (seen > target) {
+			break;
+		}
+	}
+	vad->noise_floor = noise_floor_bin_energy(bin);
+}
+
+/**
+ * Set energy threshold from the tracked noise floor
+ */
+static void vad_noise_floor_threshold(samd_vad_t *vad)
+{
+	double new_threshold = fmax(fmin(vad->noise_floor * VAD_THRESHOLD_FACTOR, vad->max_threshold), vad->initial_threshold);
+	if (new_threshold != vad->threshold) {
+		SAMD_PROBE5(vad_threshold, vad, vad->time_ms, (uint32_t)vad->threshold, (uint32_t)new_threshold, (uint32_t)vad->noise_floor);
+		samd_log_printf(vad, SAMD_LOG_DEBUG, "%d: threshold %f to %f, noise floor = %f\n", vad->time_ms, vad->threshold, new_threshold, vad->noise_floor);
+		vad->threshold = new_threshold;
+	}
+}
+
+/**
+ * Set which events are sent to the event handler.  In edge mode, only SAMD_VAD_SILENCE_BEGIN and
+ * SAMD_VAD_VOICE_BEGIN are sent, plus SAMD_VAD_SILENCE or SAMD_VAD_VOICE every heartbeat_ms if configured.
+ * @param vad
+ * @param event_mode SAMD_VAD_EVENT_MODE_ALL (default) or SAMD_VAD_EVENT_MODE_EDGE
+ */
+void samd_vad_set_event_mode(samd_vad_t *vad, samd_vad_event_mode_t event_mode)
+{
+	vad->event_mode = event_mode;
+}
+
+/**
+ * Set the interval of SAMD_VAD_SILENCE / SAMD_VAD_VOICE events in edge mode.  Set to 0 to disable (default).
+ * @param vad
+ * @param ms
+ */
+void samd_vad_set_heartbeat_ms(samd_vad_t *vad, uint32_t ms)
+{
+	vad->heartbeat_ms = ms;
+}
+
+/**
+ * Send an event to the event handler, if allowed by the event mode
+ * @param vad
+ * @param event detected in last frame
+ */
+void samd_vad_send_event(samd_vad_t *vad, samd_vad_event_t event)
+{
+	switch (event) {
+		case SAMD_VAD_NONE:
+			return;
+		case SAMD_VAD_SILENCE_BEGIN:
+		case SAMD_VAD_VOICE_BEGIN:
+			vad->event_handler(event, vad->time_ms, vad->total_voice_ms, 0, vad->user_event_data);
+			break;
+		case SAMD_VAD_SILENCE:
+		case SAMD_VAD_VOICE:
+			if (vad->event_mode == SAMD_VAD_EVENT_MODE_EDGE && (!vad->heartbeat_ms || vad->time_ms - vad->last_event_ms < vad->heartbeat_ms)) {
+				return;
+			}
+			vad->event_handler(event, vad->time_ms, vad->total_voice_ms, vad->transition_ms, vad->user_event_data);
+			break;
+	}
+	vad->last_event_ms = vad->time_ms;
+}
+
+/**
+ * Run the next frame of processed audio through the VAD state machine without sending events.
  * @param analzyer the frame analyzer
- * @param user_data this VAD
+ * @param vad
+ * @return the event detected in this frame
  */
-void samd_vad_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
+samd_vad_event_t samd_vad_process_frame_internal(samd_frame_analyzer_t *analyzer, samd_vad_t *vad, uint32_t time_ms, double energy, uint32_t zero_crossings)
 {
-	samd_vad_t *vad = (samd_vad_t *)user_data;
+	uint32_t frame_start_ms = time_ms - analyzer->frame_ms;
+	samd_vad_event_t event;
 	vad->time_ms = time_ms;
+	vad->frame_ms = analyzer->frame_ms;
 	vad->energy = energy;
 	vad->zero_crossings = zero_crossings;
 
-	/* auto adjust threshold for noise if configured */
-	if (vad->time_ms == vad->initial_adjust_ms || (vad->voice_adjust_ms && vad->initial_voice_time_ms && vad->time_ms == vad->voice_adjust_ms + vad->initial_voice_time_ms)) {
+	if (vad->noise_floor_window_ms) {
+		/* continuous adjustment */
+		vad_noise_floor_update(vad, energy);
+		if (vad->has_prior ? vad->noise_floor_count == vad->noise_floor_frames : vad->time_ms >= vad->initial_adjust_ms) {
+			vad->noise_floor_measured = 1;
+			vad_noise_floor_threshold(vad);
+			vad->measured_threshold = vad->threshold;
+		}
+	} else if (frame_start_ms < vad->initial_adjust_ms && vad->time_ms >= vad->initial_adjust_ms) {
+		/* measured even with a prior, so the call can update it */
+		vad->noise_floor = samd_frame_analyzer_get_average_energy(analyzer);
+		vad->noise_floor_measured = 1;
+		vad->measured_threshold = fmax(fmin(vad->noise_floor * VAD_THRESHOLD_FACTOR, vad->max_threshold), vad->initial_threshold);
+		if (!vad->has_prior) {
+			vad_threshold_adjust(vad, analyzer);
+		}
+	} else if (vad->voice_adjust_ms && vad->initial_voice_time_ms && frame_start_ms < vad->voice_adjust_ms + vad->initial_voice_time_ms && vad->time_ms >= vad->voice_adjust_ms + vad->initial_voice_time_ms) {
 		vad_threshold_adjust(vad, analyzer);
 	}
 
 	/* use max energy threshold if sensing of background noise levels has not completed */
-	if ((vad->time_ms > vad->initial_adjust_ms && energy > vad->threshold) || energy > vad->max_threshold) {
-		vad->total_voice_ms += MS_PER_FRAME;
-		vad->state(vad, 1);
+	if (((vad->has_prior || vad->time_ms > vad->initial_adjust_ms) && energy > vad->threshold) || energy > vad->max_threshold) {
+		vad->total_voice_ms += vad->frame_ms;
+		vad->voice_frames++;
+		event = vad->state(vad, 1);
 	} else {
-		vad->state(vad, 0);
+		event = vad->state(vad, 0);
+	}
+	if (event == SAMD_VAD_VOICE_BEGIN || event == SAMD_VAD_SILENCE_BEGIN) {
+		SAMD_PROBE4(vad_transition, vad, time_ms, event == SAMD_VAD_VOICE_BEGIN, vad->total_voice_ms);
+		vad->transitions++;
+	}
+	return event;
+}
+
+/**
+ * Handle the next frame of processed audio.  Subscribe to a shared frame analyzer with this function
+ * to run this VAD on audio already being analyzed for other detectors.
+ * @param analzyer the frame analyzer
+ * @param user_data this VAD
+ */
+void samd_vad_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	samd_vad_t *vad = (samd_vad_t *)user_data;
+	samd_vad_send_event(vad, samd_vad_process_frame_internal(analyzer, vad, time_ms, energy, zero_crossings));
+}
+
+/**
+ * Add voice frame and transition counts and energy thresholds to stats
+ * @param vad
+ * @param stats
+ */
+void samd_vad_add_stats(samd_vad_t *vad, samd_stats_t *stats)
+{
+	stats->voice_frames += vad->voice_frames;
+	stats->vad_transitions += vad->transitions;
+	stats->initial_energy_threshold = vad->initial_threshold;
+	stats->energy_threshold = vad->threshold;
+	stats->noise_floor = vad->noise_floor;
+}
+
+/**
+ * Get the counters of this VAD.  Frames, samples and average energy are from the VAD's own
+ * frame analyzer, so they are 0 if frames are from a shared analyzer.
+ * @param vad
+ * @param stats (output)
+ */
+void samd_vad_get_stats(samd_vad_t *vad, samd_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (vad->analyzer) {
+		samd_frame_analyzer_add_stats(vad->analyzer, stats);
 	}
+	samd_vad_add_stats(vad, stats);
+}
+
+/**
+ * Add new counts of a standalone VAD to the global stats
+ * @param vad
+ */
+static void vad_stats_flush(samd_vad_t *vad)
+{
+	samd_stats_t stats;
+	samd_vad_get_stats(vad, &stats);
+	samd_stats_flush(&stats, &vad->flushed_stats);
 }
 
 /**
@@ -173,6 +457,32 @@ void samd_vad_process_frame(samd_frame_analyzer_t *analyzer, void *user_data, ui
 void samd_vad_process_buffer(samd_vad_t *vad, int16_t *samples, uint32_t num_samples, uint32_t channels)
 {
 	samd_frame_analyzer_process_buffer(vad->analyzer, samples, num_samples, channels);
+	vad_stats_flush(vad);
+}
+
+/**
+ * Advance through a gap in the audio without buffers of silence, see samd_frame_analyzer_process_gap()
+ * @param vad
+ * @param ms duration of the gap
+ * @param energy average absolute sample value to treat the gap as
+ */
+void samd_vad_process_gap(samd_vad_t *vad, uint32_t ms, double energy)
+{
+	samd_frame_analyzer_process_gap(vad->analyzer, ms, energy);
+	vad_stats_flush(vad);
+}
+
+/**
+ * Process the next frame of features computed by the caller, bypassing sample analysis
+ * @param vad
+ * @param time_ms end time of this frame, relative to start of detection
+ * @param energy average absolute sample value in the frame, normalized to 8000 Hz
+ * @param zero_crossings number of negative to positive zero crossings in the frame
+ */
+void samd_vad_process_frame_features(samd_vad_t *vad, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	samd_frame_analyzer_process_frame_features(vad->analyzer, time_ms, energy, zero_crossings);
+	vad_stats_flush(vad);
 }
 
 /**
@@ -196,6 +506,24 @@ void samd_vad_init_internal(samd_vad_t **vad)
 	new_vad->transition_ms = 0;
 	new_vad->initial_voice_time_ms = 0;
 	new_vad->total_voice_ms = 0;
+	new_vad->frame_ms = DEFAULT_MS_PER_FRAME;
+	new_vad->last_event_ms = 0;
+	new_vad->event_mode = SAMD_VAD_EVENT_MODE_ALL;
+	new_vad->heartbeat_ms = 0;
+	new_vad->voice_frames = 0;
+	new_vad->noise_floor_window_ms = 0;
+	new_vad->noise_floor_percentile = VAD_DEFAULT_NOISE_FLOOR_PERCENTILE;
+	new_vad->noise_floor_ring = NULL;
+	new_vad->noise_floor_frames = 0;
+	new_vad->noise_floor_pos = 0;
+	new_vad->noise_floor_count = 0;
+	new_vad->noise_floor = 0.0;
+	new_vad->noise_floor_measured = 0;
+	new_vad->measured_threshold = 0.0;
+	new_vad->has_prior = 0;
+	memset(new_vad->noise_floor_histogram, 0, sizeof(new_vad->noise_floor_histogram));
+	new_vad->transitions = 0;
+	memset(&new_vad->flushed_stats, 0, sizeof(new_vad->flushed_stats));
 
 	/* set detection defaults */
 	samd_vad_set_energy_threshold(new_vad, VAD_DEFAULT_ENERGY_THRESHOLD);
@@ -221,7 +549,7 @@ void samd_vad_init(samd_vad_t **vad)
 	samd_vad_init_internal(&new_vad);
 
 	samd_frame_analyzer_init(&new_vad->analyzer);
-	samd_frame_analyzer_set_callback(new_vad->analyzer, samd_vad_process_frame, new_vad);
+	samd_frame_analyzer_subscribe(new_vad->analyzer, samd_vad_process_frame, new_vad);
 
 	*vad = new_vad;
 }
@@ -231,10 +559,10 @@ void samd_vad_init(samd_vad_t **vad)
  * @param vad
  * @param in_voice true if a voice frame was measured
  */
-static void vad_state_common(samd_vad_t *vad, int in_voice)
+static samd_vad_event_t vad_state_common(samd_vad_t *vad, int in_voice)
 {
 	if (in_voice) {
-		vad->transition_ms += MS_PER_FRAME;
+		vad->transition_ms += vad->frame_ms;
 	} else {
 		vad->transition_ms = 0;
 	}
@@ -245,8 +573,9 @@ static void vad_state_common(samd_vad_t *vad, int in_voice)
 		if (vad->initial_voice_time_ms == 0) {
 			vad->initial_voice_time_ms = vad->time_ms;
 		}
-		vad->event_handler(SAMD_VAD_VOICE_BEGIN, vad->time_ms, vad->total_voice_ms, 0, vad->user_event_data);
+		return SAMD_VAD_VOICE_BEGIN;
 	}
+	return SAMD_VAD_NONE;
 }
 
 /**
@@ -254,16 +583,16 @@ static void vad_state_common(samd_vad_t *vad, int in_voice)
  * @param vad
  * @param in_voice true if a voice frame was measured
  */
-static void vad_state_initial(samd_vad_t *vad, int in_voice)
+static samd_vad_event_t vad_state_initial(samd_vad_t *vad, int in_voice)
 {
-	vad_state_common(vad, in_voice);
+	samd_vad_event_t event = vad_state_common(vad, in_voice);
 	if (vad->state != vad_state_voice && vad->time_ms >= vad->voice_end_ms) {
 		vad->state = vad_state_silence;
 		samd_log_printf(vad, SAMD_LOG_INFO, "%d: (voice) SILENCE DETECTED, total voice ms = %d\n", vad->time_ms, vad->total_voice_ms);
-		vad->event_handler(SAMD_VAD_SILENCE_BEGIN, vad->time_ms, vad->total_voice_ms, 0, vad->user_event_data);
-	} else {
-		samd_log_printf(vad, SAMD_LOG_DEBUG, "%d: (silence) energy = %f, voice ms = %d, zero crossings = %d, total voice ms = %d\n", vad->time_ms, vad->energy, vad->transition_ms, vad->zero_crossings, vad->total_voice_ms);
+		return SAMD_VAD_SILENCE_BEGIN;
 	}
+	samd_log_printf(vad, SAMD_LOG_DEBUG, "%d: (silence) energy = %f, voice ms = %d, zero crossings = %d, total voice ms = %d\n", vad->time_ms, vad->energy, vad->transition_ms, vad->zero_crossings, vad->total_voice_ms);
+	return event;
 }
 
 /**
@@ -271,13 +600,13 @@ static void vad_state_initial(samd_vad_t *vad, int in_voice)
  * @param vad
  * @param in_voice true if a voice frame was measured
  */
-static void vad_state_silence(samd_vad_t *vad, int in_voice)
+static samd_vad_event_t vad_state_silence(samd_vad_t *vad, int in_voice)
 {
-	vad_state_common(vad, in_voice);
-	if (vad->state != vad_state_voice) {
-		samd_log_printf(vad, SAMD_LOG_DEBUG, "%d: (silence) energy = %f, voice ms = %d, zero crossings = %d, total voice ms = %d\n", vad->time_ms, vad->energy, vad->transition_ms, vad->zero_crossings, vad->total_voice_ms);
-		vad->event_handler(SAMD_VAD_SILENCE, vad->time_ms, vad->total_voice_ms, vad->transition_ms, vad->user_event_data);
+	if (vad_state_common(vad, in_voice) == SAMD_VAD_VOICE_BEGIN) {
+		return SAMD_VAD_VOICE_BEGIN;
 	}
+	samd_log_printf(vad, SAMD_LOG_DEBUG, "%d: (silence) energy = %f, voice ms = %d, zero crossings = %d, total voice ms = %d\n", vad->time_ms, vad->energy, vad->transition_ms, vad->zero_crossings, vad->total_voice_ms);
+	return SAMD_VAD_SILENCE;
 }
 
 /**
@@ -285,23 +614,36 @@ static void vad_state_silence(samd_vad_t *vad, int in_voice)
  * @param vad
  * @param in_voice true if a voice frame was measured
  */
-static void vad_state_voice(samd_vad_t *vad, int in_voice)
+static samd_vad_event_t vad_state_voice(samd_vad_t *vad, int in_voice)
 {
 	if (in_voice) {
 		vad->transition_ms = 0;
 	} else {
-		vad->transition_ms += MS_PER_FRAME;
+		vad->transition_ms += vad->frame_ms;
 	}
 
 	if (vad->transition_ms >= vad->voice_end_ms) {
 		vad->state = vad_state_silence;
 		vad->transition_ms = 0;
 		samd_log_printf(vad, SAMD_LOG_INFO, "%d: (voice) SILENCE DETECTED, total voice ms = %d\n", vad->time_ms, vad->total_voice_ms);
-		vad->event_handler(SAMD_VAD_SILENCE_BEGIN, vad->time_ms, vad->total_voice_ms, 0, vad->user_event_data);
-	} else {
-		samd_log_printf(vad, SAMD_LOG_DEBUG, "%d: (voice) energy = %f, silence ms = %d, zero crossings = %d, total voice ms = %d\n", vad->time_ms, vad->energy, vad->transition_ms, vad->zero_crossings, vad->total_voice_ms);
-		vad->event_handler(SAMD_VAD_VOICE, vad->time_ms, vad->total_voice_ms, vad->transition_ms, vad->user_event_data);
+		return SAMD_VAD_SILENCE_BEGIN;
+	}
+	samd_log_printf(vad, SAMD_LOG_DEBUG, "%d: (voice) energy = %f, silence ms = %d, zero crossings = %d, total voice ms = %d\n", vad->time_ms, vad->energy, vad->transition_ms, vad->zero_crossings, vad->total_voice_ms);
+	return SAMD_VAD_VOICE;
+}
+
+/**
+ * @param vad
+ * @return current state for the AMD flight recorder
+ */
+samd_recorder_vad_state_t samd_vad_get_recorder_state(samd_vad_t *vad)
+{
+	if (vad->state == vad_state_voice) {
+		return SAMD_RECORDER_VAD_VOICE;
+	} else if (vad->state == vad_state_silence) {
+		return SAMD_RECORDER_VAD_SILENCE;
 	}
+	return SAMD_RECORDER_VAD_INITIAL;
 }
 
 /**
@@ -314,8 +656,11 @@ void samd_vad_destroy(samd_vad_t **vad)
 		samd_frame_analyzer_t *analyzer = (*vad)->analyzer;
 		samd_log_printf((*vad), SAMD_LOG_DEBUG, "%d: DESTROY VAD\n", (*vad)->time_ms);
 		if (analyzer) {
+			/* counts of a VAD inside an AMD are flushed by the AMD */
+			vad_stats_flush(*vad);
 			samd_frame_analyzer_destroy(&analyzer);
 		}
+		free((*vad)->noise_floor_ring);
 		free(*vad);
 		*vad = NULL;
 	}
@@ -328,6 +673,7 @@ const char *samd_vad_event_to_string(samd_vad_event_t event)
 		case SAMD_VAD_SILENCE: return "VAD SILENCE";
 		case SAMD_VAD_VOICE_BEGIN: return "VAD VOICE BEGIN";
 		case SAMD_VAD_VOICE: return "VAD VOICE";
+		case SAMD_VAD_NONE: break;
 	}
 	return "";
 }
@@ -0,0 +1,1626 @@
+/*
+ * Copyright (c) 2014-2015 Christopher M. Rienzo <chris@rienzo.com>
+ *
+ * See the file COPYING for copying permission.
+ */
+
+/*
+ * Golden event trace tests.  Synthetic calls are run through samd_t and standalone VAD and beep
+ * detectors, and the complete event sequence and detector counters are compared with the traces
+ * checked in to tests/golden.  Equivalence mode runs every analyzer kernel side by side and
+ * requires identical frames and events from each.  The traces hold only the default detectors;
+ * optional features have their own checks, which assert what the feature promises: the same
+ * decisions with gaps or spectral features, the same events collected per buffer, provisional
+ * events before the decision, the spectra of tones, a noise step, VAD heartbeats, event positions,
+ * priors, fingerprints, the classifier, and metrics and stats of exited threads.
+ *
+ * check_golden [-u] [-e] [-v]
+ *   -u rewrite the golden traces from the current build
+ *   -e only run the kernel equivalence checks
+ *   -v print traces that don't match
+ */
+
+#include <simpleamd.h>
+#include <samd_metrics.h>
+#include <samd_priors.h>
+#include <samd_fingerprint.h>
+#include <samd_classifier.h>
+#include "samd_private.h"
+#include "synth.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define MAX_SEGMENTS 8
+#define MAX_TRACE 65536
+#define SEED 42
+#define RECORDER_MS 1000
+#define NOISE_FLOOR_WINDOW_MS 3000
+/* background noise 20 dB louder after the quiet part */
+#define NOISE_STEP_QUIET_MS 3000
+#define NOISE_STEP_LOUD_MS 7000
+/* 100 ms at 8 kHz */
+#define EVENT_BUFFER_SAMPLES 800
+#define HEARTBEAT_MS 200
+#define MAX_BUFFER_EVENTS 32
+#define PRIOR_NOISE_FLOOR 40.0
+#define PROVISIONAL_CONFIDENCE 0.7
+/* comfort noise level of gaps */
+#define GAP_ENERGY 40.0
+#define FINGERPRINT_SEED 1000
+/* greetings indexed, each by its own speaker, and the pace of a speaker not in the index */
+#define FINGERPRINT_GREETINGS 3
+#define FINGERPRINT_OTHER_PACE 150
+#define FINGERPRINT_SPEECH_MS 4000
+/* a known greeting must be matched this soon after it starts */
+#define FINGERPRINT_MAX_MS 1000
+
+/** part of a synthetic call */
+struct segment {
+	synth_signal_t signal;
+	uint32_t ms;
+};
+
+/** synthetic call */
+struct call {
+	const char *name;
+	struct segment segments[MAX_SEGMENTS];
+};
+
+/** how a call is fed to the detectors */
+struct config {
+	uint32_t sample_rate;
+	uint32_t channels;
+	uint32_t frame_ms;
+};
+
+static const struct call calls[] = {
+	{ "human_hello", { { SYNTH_SILENCE, 600 }, { SYNTH_SPEECH, 900 }, { SYNTH_SILENCE, 3000 } } },
+	{ "machine_greeting", { { SYNTH_SILENCE, 400 }, { SYNTH_SPEECH, 6000 }, { SYNTH_SILENCE, 1000 } } },
+	{ "machine_beep1000", { { SYNTH_SILENCE, 400 }, { SYNTH_SPEECH, 3000 }, { SYNTH_SILENCE, 500 }, { SYNTH_BEEP_1000, 600 }, { SYNTH_SILENCE, 2000 } } },
+	{ "machine_beep440", { { SYNTH_SILENCE, 400 }, { SYNTH_SPEECH, 3000 }, { SYNTH_SILENCE, 500 }, { SYNTH_BEEP_440, 800 }, { SYNTH_SILENCE, 2000 } } },
+	{ "beep_only", { { SYNTH_SILENCE, 300 }, { SYNTH_BEEP_1000, 1000 }, { SYNTH_SILENCE, 2000 } } },
+	{ "dtmf", { { SYNTH_SILENCE, 300 }, { SYNTH_DTMF, 2000 }, { SYNTH_SILENCE, 2000 } } },
+	{ "dead_air", { { SYNTH_SILENCE, 6000 } } },
+	{ "noise", { { SYNTH_NOISE, 4000 } } }
+};
+
+static const struct config configs[] = {
+	{ 8000, 1, 10 },
+	{ 8000, 1, 20 },
+	{ 16000, 2, 10 },
+	{ 48000, 1, 10 }
+};
+
+static const samd_kernel_t kernels[] = { SAMD_KERNEL_AUTO, SAMD_KERNEL_SCALAR, SAMD_KERNEL_REFERENCE };
+static const char *kernel_names[] = { "auto", "scalar", "reference" };
+
+/** accumulated text of events */
+struct trace {
+	char text[MAX_TRACE];
+	size_t len;
+};
+
+static int verbose = 0;
+
+static void trace_printf(struct trace *trace, const char *format, ...)
+{
+	va_list ap;
+	int len;
+	if (!trace) {
+		return;
+	}
+	va_start(ap, format);
+	len = vsnprintf(trace->text + trace->len, sizeof(trace->text) - trace->len, format, ap);
+	va_end(ap);
+	if (len > 0) {
+		trace->len += len;
+		if (trace->len >= sizeof(trace->text)) {
+			trace->len = sizeof(trace->text) - 1;
+		}
+	}
+}
+
+/**
+ * Build the call's audio.  The call is on the first channel, other channels are silent.
+ */
+static int16_t *call_generate(const struct call *call, const struct config *config, uint32_t *num_samples)
+{
+	uint32_t total_frames = 0;
+	uint32_t pos = 0;
+	int16_t *mono;
+	int16_t *samples;
+	uint32_t i;
+	int s;
+
+	for (s = 0; s < MAX_SEGMENTS && call->segments[s].ms; s++) {
+		total_frames += config->sample_rate * call->segments[s].ms / 1000;
+	}
+	mono = (int16_t *)malloc(sizeof(int16_t) * total_frames);
+	for (s = 0; s < MAX_SEGMENTS && call->segments[s].ms; s++) {
+		uint32_t n = config->sample_rate * call->segments[s].ms / 1000;
+		synth_generate_mono(mono + pos, call->segments[s].signal, config->sample_rate, n, SEED + s);
+		pos += n;
+	}
+	samples = (int16_t *)calloc(total_frames * config->channels, sizeof(int16_t));
+	for (i = 0; i < total_frames; i++) {
+		samples[i * config->channels] = mono[i];
+	}
+	free(mono);
+	*num_samples = total_frames * config->channels;
+	return samples;
+}
+
+/** how detectors are set up and fed, zero for defaults */
+struct run_options {
+	/* samd_t */
+	uint32_t recorder_ms;
+	double provisional_confidence;
+	int spectral;
+	const samd_classifier_model_t *classifier;
+	samd_fingerprint_index_t *fingerprint_index;
+	/* samd_vad_t */
+	uint32_t noise_floor_window_ms;
+	double prior_noise_floor;
+	/* duration of each buffer, 20 ms if 0 */
+	uint32_t packet_ms;
+	/* replace packets of digital silence with gaps of gap_energy */
+	int gaps;
+	double gap_energy;
+};
+
+static const struct run_options default_options = { 0 };
+
+static void amd_event_handler(samd_event_t event, uint32_t time_ms, void *user_event_data)
+{
+	trace_printf((struct trace *)user_event_data, "amd %s %u\n", samd_event_to_string(event), time_ms);
+}
+
+static void vad_event_handler(samd_vad_event_t event, uint32_t time_ms, uint32_t total_voice_ms, uint32_t transition_ms, void *user_event_data)
+{
+	trace_printf((struct trace *)user_event_data, "vad %s %u %u %u\n", samd_vad_event_to_string(event), time_ms, total_voice_ms, transition_ms);
+}
+
+static void beep_event_handler(uint32_t time_ms, void *user_event_data)
+{
+	trace_printf((struct trace *)user_event_data, "beep %u\n", time_ms);
+}
+
+static void frame_handler(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	(void)analyzer;
+	trace_printf((struct trace *)user_data, "frame %u %.6f %u\n", time_ms, energy, zero_crossings);
+}
+
+/**
+ * Feed samples to one detector or analyzer in packets
+ */
+static void feed(samd_t *amd, samd_vad_t *vad, samd_beep_t *beep, samd_frame_analyzer_t *analyzer, int16_t *samples, uint32_t num_samples, const struct config *config, const struct run_options *options)
+{
+	uint32_t packet_ms = options->packet_ms ? options->packet_ms : 20;
+	uint32_t packet = config->sample_rate * packet_ms / 1000 * config->channels;
+	uint32_t pos;
+	for (pos = 0; pos < num_samples; pos += packet) {
+		uint32_t n = num_samples - pos < packet ? num_samples - pos : packet;
+		uint32_t i = 0;
+		if (options->gaps && n == packet) {
+			for (i = 0; i < n && !samples[pos + i]; i++) {
+			}
+		}
+		if (options->gaps && n == packet && i == n) {
+			if (amd) {
+				samd_process_gap(amd, packet_ms, options->gap_energy);
+			} else if (vad) {
+				samd_vad_process_gap(vad, packet_ms, options->gap_energy);
+			} else if (beep) {
+				samd_beep_process_gap(beep, packet_ms, options->gap_energy);
+			} else {
+				samd_frame_analyzer_process_gap(analyzer, packet_ms, options->gap_energy);
+			}
+		} else if (amd) {
+			samd_process_buffer(amd, samples + pos, n, config->channels);
+		} else if (vad) {
+			samd_vad_process_buffer(vad, samples + pos, n, config->channels);
+		} else if (beep) {
+			samd_beep_process_buffer(beep, samples + pos, n, config->channels);
+		} else {
+			samd_frame_analyzer_process_buffer(analyzer, samples + pos, n, config->channels);
+		}
+	}
+}
+
+/**
+ * @return an AMD tracing its events, configured by options
+ */
+static samd_t *create_amd(struct trace *trace, const struct config *config, const struct run_options *options)
+{
+	samd_t *amd = NULL;
+	samd_init(&amd);
+	samd_set_sample_rate(amd, config->sample_rate);
+	samd_set_frame_ms(amd, config->frame_ms);
+	samd_set_event_handler(amd, amd_event_handler, trace);
+	samd_set_recorder_ms(amd, options->recorder_ms);
+	samd_set_provisional_confidence(amd, options->provisional_confidence);
+	samd_set_spectral(amd, options->spectral);
+	if (options->classifier) {
+		samd_set_classifier(amd, options->classifier);
+	}
+	if (options->fingerprint_index) {
+		samd_set_fingerprint_index(amd, options->fingerprint_index);
+	}
+	return amd;
+}
+
+/**
+ * @return a VAD tracing its edge events, configured by options
+ */
+static samd_vad_t *create_vad(struct trace *trace, const struct config *config, const struct run_options *options)
+{
+	samd_vad_t *vad = NULL;
+	samd_vad_init(&vad);
+	samd_vad_set_sample_rate(vad, config->sample_rate);
+	samd_vad_set_frame_ms(vad, config->frame_ms);
+	samd_vad_set_event_mode(vad, SAMD_VAD_EVENT_MODE_EDGE);
+	samd_vad_set_event_handler(vad, vad_event_handler, trace);
+	if (options->noise_floor_window_ms) {
+		samd_vad_set_noise_floor_window_ms(vad, options->noise_floor_window_ms);
+	}
+	if (options->prior_noise_floor) {
+		samd_vad_set_prior(vad, options->prior_noise_floor, 0.0);
+	}
+	return vad;
+}
+
+/**
+ * Trace a detector's counters and add them to total
+ */
+static void trace_stats(struct trace *trace, const char *detector, const samd_stats_t *stats, samd_stats_t *total)
+{
+	trace_printf(trace, "stats %s %llu %llu %llu %llu %llu %llu %llu %llu %.3f %.3f %.3f\n", detector,
+		(unsigned long long)stats->frames, (unsigned long long)stats->samples, (unsigned long long)stats->voice_frames,
+		(unsigned long long)stats->vad_transitions, (unsigned long long)stats->amd_transitions,
+		(unsigned long long)stats->beep_candidates, (unsigned long long)stats->beep_rejected, (unsigned long long)stats->beep_accepted,
+		stats->initial_energy_threshold, stats->energy_threshold, stats->average_energy);
+	total->frames += stats->frames;
+	total->samples += stats->samples;
+	total->voice_frames += stats->voice_frames;
+	total->vad_transitions += stats->vad_transitions;
+	total->amd_transitions += stats->amd_transitions;
+	total->beep_candidates += stats->beep_candidates;
+	total->beep_rejected += stats->beep_rejected;
+	total->beep_accepted += stats->beep_accepted;
+}
+
+/**
+ * Trace a mismatch if the global stats didn't grow by total since before
+ */
+static void check_global_stats(struct trace *trace, const samd_stats_t *before, const samd_stats_t *total)
+{
+	samd_stats_t after;
+	samd_get_global_stats(&after);
+	if (after.frames - before->frames != total->frames || after.samples - before->samples != total->samples ||
+			after.voice_frames - before->voice_frames != total->voice_frames ||
+			after.vad_transitions - before->vad_transitions != total->vad_transitions ||
+			after.amd_transitions - before->amd_transitions != total->amd_transitions ||
+			after.beep_candidates - before->beep_candidates != total->beep_candidates ||
+			after.beep_rejected - before->beep_rejected != total->beep_rejected ||
+			after.beep_accepted - before->beep_accepted != total->beep_accepted) {
+		trace_printf(trace, "stats global mismatch\n");
+	}
+}
+
+/**
+ * Trace the number of recorded frames and the last one, and a mismatch if recorded frames aren't
+ * consecutive
+ */
+static void trace_recorder(struct trace *trace, samd_t *amd, const struct config *config)
+{
+	samd_recorder_frame_t frames[RECORDER_MS / 5];
+	size_t num_frames = samd_dump_recorder(amd, frames, sizeof(frames) / sizeof(frames[0]));
+	size_t i;
+
+	if (num_frames == 0) {
+		trace_printf(trace, "recorder 0\n");
+		return;
+	}
+	for (i = 1; i < num_frames; i++) {
+		if (frames[i].time_ms != frames[i - 1].time_ms + config->frame_ms) {
+			trace_printf(trace, "recorder mismatch %u %u\n", frames[i - 1].time_ms, frames[i].time_ms);
+			break;
+		}
+	}
+	i = num_frames - 1;
+	trace_printf(trace, "recorder %u %u %u %u %u %u %u %u\n", (unsigned)num_frames, frames[i].time_ms, frames[i].energy,
+		frames[i].zero_crossings, frames[i].threshold, frames[i].vad_state, frames[i].amd_state, frames[i].flags);
+}
+
+/**
+ * Run the call through each detector with its own analyzer
+ */
+static void run_detectors(struct trace *trace, int16_t *samples, uint32_t num_samples, const struct config *config)
+{
+	struct run_options options = default_options;
+	samd_t *amd;
+	samd_vad_t *vad;
+	samd_beep_t *beep = NULL;
+	samd_stats_t stats;
+	samd_stats_t total = { 0 };
+	samd_stats_t global;
+	double frames_metric = samd_metrics_get(SAMD_METRIC_FRAMES);
+	double active_metric = samd_metrics_get(SAMD_METRIC_ACTIVE_DETECTORS);
+
+	samd_get_global_stats(&global);
+
+	options.recorder_ms = RECORDER_MS;
+	amd = create_amd(trace, config, &options);
+	feed(amd, NULL, NULL, NULL, samples, num_samples, config, &options);
+	trace_recorder(trace, amd, config);
+	samd_get_stats(amd, &stats);
+	trace_stats(trace, "amd", &stats, &total);
+	samd_destroy(&amd);
+	if (samd_metrics_get(SAMD_METRIC_FRAMES) - frames_metric != stats.frames || samd_metrics_get(SAMD_METRIC_ACTIVE_DETECTORS) != active_metric) {
+		trace_printf(trace, "metrics mismatch\n");
+	}
+
+	vad = create_vad(trace, config, &default_options);
+	feed(NULL, vad, NULL, NULL, samples, num_samples, config, &default_options);
+	samd_vad_get_stats(vad, &stats);
+	trace_stats(trace, "vad", &stats, &total);
+	samd_vad_destroy(&vad);
+
+	samd_beep_init(&beep);
+	samd_beep_set_sample_rate(beep, config->sample_rate);
+	samd_beep_set_frame_ms(beep, config->frame_ms);
+	samd_beep_set_event_handler(beep, beep_event_handler, trace);
+	feed(NULL, NULL, beep, NULL, samples, num_samples, config, &default_options);
+	samd_beep_get_stats(beep, &stats);
+	trace_stats(trace, "beep", &stats, &total);
+	samd_beep_destroy(&beep);
+
+	check_global_stats(trace, &global, &total);
+}
+
+/**
+ * Run the call through one analyzer shared by all detectors, using the given kernel.  Frames are
+ * traced too, so kernels must agree exactly.
+ */
+static void run_kernel(struct trace *trace, int16_t *samples, uint32_t num_samples, const struct config *config, samd_channel_mode_t channel_mode, samd_kernel_t kernel, int gaps)
+{
+	struct run_options options = default_options;
+	samd_frame_analyzer_t *analyzer = NULL;
+	samd_t *amd = NULL;
+	samd_vad_t *vad = NULL;
+	samd_beep_t *beep = NULL;
+
+	samd_frame_analyzer_init(&analyzer);
+	samd_frame_analyzer_set_sample_rate(analyzer, config->sample_rate);
+	samd_frame_analyzer_set_frame_ms(analyzer, config->frame_ms);
+	samd_frame_analyzer_set_channel_mode(analyzer, channel_mode);
+	samd_frame_analyzer_set_kernel(analyzer, kernel);
+
+	samd_init(&amd);
+	samd_set_event_handler(amd, amd_event_handler, trace);
+	samd_vad_init(&vad);
+	samd_vad_set_event_mode(vad, SAMD_VAD_EVENT_MODE_EDGE);
+	samd_vad_set_event_handler(vad, vad_event_handler, trace);
+	samd_beep_init(&beep);
+	samd_beep_set_event_handler(beep, beep_event_handler, trace);
+
+	samd_frame_analyzer_subscribe(analyzer, frame_handler, trace);
+	samd_frame_analyzer_subscribe(analyzer, samd_process_frame, amd);
+	samd_frame_analyzer_subscribe(analyzer, samd_vad_process_frame, vad);
+	samd_frame_analyzer_subscribe(analyzer, samd_beep_process_frame, beep);
+	options.gaps = gaps;
+	feed(NULL, NULL, NULL, analyzer, samples, num_samples, config, &options);
+
+	samd_frame_analyzer_destroy(&analyzer);
+	samd_destroy(&amd);
+	samd_vad_destroy(&vad);
+	samd_beep_destroy(&beep);
+}
+
+static char *read_text_file(const char *file_name)
+{
+	FILE *file = fopen(file_name, "r");
+	char *text;
+	long size;
+	if (!file) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	text = (char *)calloc(1, size + 1);
+	if (fread(text, 1, size, file) != (size_t)size) {
+		size = 0;
+	}
+	text[size] = '\0';
+	fclose(file);
+	return text;
+}
+
+/**
+ * @return 0 if the call's traces match the golden file
+ */
+static int check_golden(const char *golden_dir, const struct call *call, int update)
+{
+	struct trace *trace = (struct trace *)calloc(1, sizeof(*trace));
+	char file_name[1024];
+	char *golden;
+	size_t c;
+	int failed = 0;
+
+	for (c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		uint32_t num_samples;
+		int16_t *samples = call_generate(call, &configs[c], &num_samples);
+		trace_printf(trace, "# %s %u Hz %u channels %u ms\n", call->name, configs[c].sample_rate, configs[c].channels, configs[c].frame_ms);
+		run_detectors(trace, samples, num_samples, &configs[c]);
+		free(samples);
+	}
+
+	if (snprintf(file_name, sizeof(file_name), "%s/%s.trace", golden_dir, call->name) >= (int)sizeof(file_name)) {
+		fprintf(stderr, "golden directory name too long\n");
+		free(trace);
+		return 1;
+	}
+	if (update) {
+		FILE *file = fopen(file_name, "w");
+		if (!file || fwrite(trace->text, 1, trace->len, file) != trace->len) {
+			perror(file_name);
+			failed = 1;
+		}
+		if (file) {
+			fclose(file);
+		}
+		printf("UPDATED %s\n", file_name);
+	} else if (!(golden = read_text_file(file_name))) {
+		perror(file_name);
+		failed = 1;
+	} else {
+		failed = strcmp(golden, trace->text) != 0;
+		printf("%s golden %s\n", failed ? "FAIL" : "PASS", call->name);
+		if (failed && verbose) {
+			printf("--- expected\n%s--- actual\n%s", golden, trace->text);
+		}
+		free(golden);
+	}
+	free(trace);
+	return failed;
+}
+
+/**
+ * @return 0 if every kernel gives the same frames and events for the call
+ */
+static int check_equivalence(const struct call *call)
+{
+	struct trace *expected = (struct trace *)calloc(1, sizeof(*expected));
+	struct trace *actual = (struct trace *)calloc(1, sizeof(*actual));
+	size_t num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+	size_t c, k;
+	int mode;
+	int failed = 0;
+
+	for (c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		uint32_t num_samples;
+		int16_t *samples = call_generate(call, &configs[c], &num_samples);
+		for (mode = SAMD_CHANNEL_MODE_MIXED; mode <= SAMD_CHANNEL_MODE_SPLIT; mode++) {
+			expected->len = 0;
+			run_kernel(expected, samples, num_samples, &configs[c], (samd_channel_mode_t)mode, kernels[0], 0);
+			/* the last run replaces packets of silence with gaps */
+			for (k = 1; k <= num_kernels; k++) {
+				int gaps = k == num_kernels;
+				const char *name = gaps ? "gaps" : kernel_names[k];
+				actual->len = 0;
+				run_kernel(actual, samples, num_samples, &configs[c], (samd_channel_mode_t)mode, kernels[gaps ? 0 : k], gaps);
+				if (actual->len != expected->len || memcmp(actual->text, expected->text, actual->len)) {
+					printf("FAIL equivalence %s %u Hz %u channels %u ms %s: %s differs from %s\n", call->name,
+						configs[c].sample_rate, configs[c].channels, configs[c].frame_ms, mode == SAMD_CHANNEL_MODE_MIXED ? "mixed" : "split",
+						name, kernel_names[0]);
+					if (verbose) {
+						printf("--- %s\n%.*s--- %s\n%.*s", kernel_names[0], (int)expected->len, expected->text, name, (int)actual->len, actual->text);
+					}
+					failed = 1;
+				}
+			}
+		}
+		free(samples);
+	}
+	if (!failed) {
+		printf("PASS equivalence %s\n", call->name);
+	}
+	free(expected);
+	free(actual);
+	return failed;
+}
+
+/**
+ * @return 0 if options that shouldn't change decisions give the call's AMD the same events and
+ * frames as the defaults: packets of silence replaced by gaps of comfort noise, and spectral
+ * features
+ */
+static int check_variants(const struct call *call)
+{
+	static const char *variant_names[] = { "gaps", "spectral" };
+	struct trace *expected = (struct trace *)calloc(1, sizeof(*expected));
+	struct trace *actual = (struct trace *)calloc(1, sizeof(*actual));
+	const char *failure = NULL;
+	size_t c, v;
+
+	for (c = 0; c < sizeof(configs) / sizeof(configs[0]) && !failure; c++) {
+		uint32_t num_samples;
+		int16_t *samples = call_generate(call, &configs[c], &num_samples);
+		samd_stats_t expected_stats, stats;
+		samd_t *amd;
+
+		expected->len = 0;
+		amd = create_amd(expected, &configs[c], &default_options);
+		feed(amd, NULL, NULL, NULL, samples, num_samples, &configs[c], &default_options);
+		samd_get_stats(amd, &expected_stats);
+		samd_destroy(&amd);
+
+		for (v = 0; v < sizeof(variant_names) / sizeof(variant_names[0]) && !failure; v++) {
+			struct run_options options = default_options;
+			samd_spectral_features_t features;
+			if (v == 0) {
+				options.gaps = 1;
+				options.gap_energy = GAP_ENERGY;
+			} else {
+				options.spectral = 1;
+			}
+			actual->len = 0;
+			amd = create_amd(actual, &configs[c], &options);
+			feed(amd, NULL, NULL, NULL, samples, num_samples, &configs[c], &options);
+			samd_get_stats(amd, &stats);
+			if (actual->len != expected->len || memcmp(actual->text, expected->text, actual->len) ||
+					stats.frames != expected_stats.frames || stats.samples != expected_stats.samples ||
+					(options.spectral && stats.spectral_frames != samd_get_spectral_features(amd, &features))) {
+				failure = variant_names[v];
+				if (verbose) {
+					printf("--- %u Hz %u channels %u ms\n%.*s--- %s\n%.*s", configs[c].sample_rate, configs[c].channels, configs[c].frame_ms,
+						(int)expected->len, expected->text, failure, (int)actual->len, actual->text);
+				}
+			}
+			samd_destroy(&amd);
+		}
+		free(samples);
+	}
+
+	printf("%s variants %s%s%s\n", failure ? "FAIL" : "PASS", call->name, failure ? " " : "", failure ? failure : "");
+	free(expected);
+	free(actual);
+	return failure != NULL;
+}
+
+/** events delivered to an info handler */
+struct event_list {
+	samd_event_info_t events[MAX_BUFFER_EVENTS];
+	size_t num_events;
+};
+
+static void event_list_handler(const samd_event_info_t *info, void *user_event_data)
+{
+	struct event_list *list = (struct event_list *)user_event_data;
+	if (list->num_events < MAX_BUFFER_EVENTS) {
+		list->events[list->num_events] = *info;
+	}
+	list->num_events++;
+}
+
+static void unexpected_event_handler(samd_event_t event, uint32_t time_ms, void *user_event_data)
+{
+	(void)event;
+	(void)time_ms;
+	(*(int *)user_event_data)++;
+}
+
+/**
+ * @return 0 if samd_process_buffer_events() returns the events the info handler gets, in buffers
+ * of one frame up to the whole call, counts events that don't fit without writing past
+ * max_events, and doesn't call the event handler
+ */
+static int check_buffer_events(const struct call *call)
+{
+	static const char *size_names[] = { "frame", "10 frames", "unaligned", "call" };
+	samd_event_record_t records[MAX_BUFFER_EVENTS + 1];
+	struct event_list *expected = (struct event_list *)calloc(1, sizeof(*expected));
+	const char *failure = NULL;
+	size_t c, b;
+
+	for (c = 0; c < sizeof(configs) / sizeof(configs[0]) && !failure; c++) {
+		const struct config *config = &configs[c];
+		uint32_t frame = config->sample_rate * config->frame_ms / 1000;
+		uint32_t sizes[] = { frame, 10 * frame, 10 * frame + 37, 0 };
+		uint32_t num_samples;
+		int16_t *samples = call_generate(call, config, &num_samples);
+		uint32_t num_frames = num_samples / config->channels;
+		samd_t *amd = NULL;
+
+		expected->num_events = 0;
+		samd_init(&amd);
+		samd_set_sample_rate(amd, config->sample_rate);
+		samd_set_frame_ms(amd, config->frame_ms);
+		samd_set_event_info_handler(amd, event_list_handler, expected);
+		samd_process_buffer(amd, samples, num_samples, config->channels);
+		samd_destroy(&amd);
+		sizes[3] = num_frames;
+		if (expected->num_events == 0 || expected->num_events > MAX_BUFFER_EVENTS) {
+			failure = "reference";
+		}
+
+		for (b = 0; b < sizeof(sizes) / sizeof(sizes[0]) && !failure; b++) {
+			size_t num_events = 0;
+			int handler_calls = 0;
+			uint32_t pos;
+
+			samd_init(&amd);
+			samd_set_sample_rate(amd, config->sample_rate);
+			samd_set_frame_ms(amd, config->frame_ms);
+			samd_set_event_handler(amd, unexpected_event_handler, &handler_calls);
+			for (pos = 0; pos < num_frames && !failure; pos += sizes[b]) {
+				uint32_t len = num_frames - pos < sizes[b] ? num_frames - pos : sizes[b];
+				size_t max_events = MAX_BUFFER_EVENTS - num_events;
+				size_t n, i;
+				records[max_events].event = SAMD_MACHINE_BEEP;
+				records[max_events].time_ms = UINT64_MAX;
+				n = samd_process_buffer_events(amd, samples + pos * config->channels, len * config->channels, config->channels, records, max_events);
+				if (records[max_events].time_ms != UINT64_MAX) {
+					failure = "overrun";
+				}
+				for (i = 0; i < n && !failure; i++, num_events++) {
+					const samd_event_info_t *info = &expected->events[num_events];
+					if (num_events >= expected->num_events || records[i].event != info->event || records[i].time_ms != info->time_ms ||
+							records[i].sample != info->sample || records[i].offset != (int64_t)info->sample - (int64_t)pos) {
+						failure = size_names[b];
+					}
+				}
+			}
+			if (!failure && num_events != expected->num_events) {
+				failure = size_names[b];
+			} else if (!failure && handler_calls) {
+				failure = "event handler";
+			}
+			samd_destroy(&amd);
+		}
+
+		/* only room for the first event, the rest are counted */
+		if (!failure) {
+			size_t n;
+			samd_init(&amd);
+			samd_set_sample_rate(amd, config->sample_rate);
+			samd_set_frame_ms(amd, config->frame_ms);
+			records[1].time_ms = UINT64_MAX;
+			n = samd_process_buffer_events(amd, samples, num_samples, config->channels, records, 1);
+			if (n != expected->num_events || records[0].event != expected->events[0].event || records[1].time_ms != UINT64_MAX) {
+				failure = "max events";
+			}
+			samd_destroy(&amd);
+		}
+		free(samples);
+		if (failure && verbose) {
+			printf("--- %u Hz %u channels %u ms\n", config->sample_rate, config->channels, config->frame_ms);
+		}
+	}
+
+	printf("%s buffer events %s%s%s\n", failure ? "FAIL" : "PASS", call->name, failure ? " " : "", failure ? failure : "");
+	free(expected);
+	return failure != NULL;
+}
+
+/**
+ * Run calls on one key, each starting from the prior of the calls before it
+ * @return failure, or NULL
+ */
+static const char *check_priors_learn(const char *path)
+{
+	struct run_options options = default_options;
+	samd_priors_t *priors = NULL;
+	const struct config *config = &configs[0];
+	uint32_t num_samples;
+	int16_t *samples = call_generate(&calls[0], config, &num_samples);
+	const char *failure = NULL;
+	double noise_floor, threshold;
+	uint32_t calls_learned = 0;
+	uint32_t i;
+
+	if (samd_priors_open(&priors, path, 4)) {
+		failure = "open to learn";
+	}
+	for (i = 1; i <= 2 && !failure; i++) {
+		samd_vad_t *vad = create_vad(NULL, config, &options);
+		/* voice raises the threshold, but the prior keeps the one of the noise floor */
+		samd_vad_set_voice_adjust_ms(vad, 300);
+		if (samd_priors_apply(priors, "learn", vad) != (i > 1)) {
+			failure = "apply learned";
+		}
+		feed(NULL, vad, NULL, NULL, samples, num_samples, config, &options);
+		if (!failure && samd_priors_update(priors, "learn", vad)) {
+			failure = "update";
+		} else if (!failure && (!samd_priors_get(priors, "learn", &noise_floor, &threshold, &calls_learned) || calls_learned != i)) {
+			failure = "update after prior";
+		} else if (!failure && threshold != 130.0) {
+			failure = "threshold after voice";
+		}
+		samd_vad_destroy(&vad);
+	}
+	samd_priors_close(&priors);
+	free(samples);
+	return failure;
+}
+
+/**
+ * Leave the slot of "learn" and a free slot as processes that died while writing would, then
+ * check readers give up instead of waiting forever and reopening repairs the slots
+ * @return failure, or NULL
+ */
+static const char *check_priors_recover(const char *path)
+{
+	samd_priors_t *priors = NULL;
+	samd_priors_header_t header;
+	samd_priors_slot_t slot;
+	const char *failure = NULL;
+	double noise_floor, threshold;
+	uint32_t calls_learned;
+	uint32_t i;
+	off_t learn = 0, free_slot = 0;
+	int fd;
+
+	if (samd_priors_open(&priors, path, 0)) {
+		return "open to recover";
+	}
+	fd = open(path, O_RDWR);
+	if (fd < 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+		failure = "read header";
+	}
+	for (i = 0; !failure && i < header.num_slots; i++) {
+		off_t offset = sizeof(header) + i * sizeof(slot);
+		if (pread(fd, &slot, sizeof(slot), offset) != sizeof(slot)) {
+			failure = "read slot";
+		} else if (!strcmp(slot.key, "learn")) {
+			learn = offset;
+		} else if (!slot.seq) {
+			free_slot = offset;
+		}
+	}
+	if (!failure && (!learn || !free_slot)) {
+		failure = "find slots";
+	}
+	if (!failure) {
+		uint32_t writing = 3, claiming = 1;
+		if (pwrite(fd, &writing, sizeof(writing), learn) != sizeof(writing) || pwrite(fd, &claiming, sizeof(claiming), free_slot) != sizeof(claiming)) {
+			failure = "write slots";
+		} else if (samd_priors_get(priors, "learn", &noise_floor, &threshold, &calls_learned) || !samd_priors_put(priors, "learn", 1.0, 1.0)) {
+			failure = "wait for dead writer";
+		}
+	}
+	samd_priors_close(&priors);
+
+	if (!failure && samd_priors_open(&priors, path, 0)) {
+		failure = "reopen to recover";
+	} else if (!failure && samd_priors_get(priors, "learn", &noise_floor, &threshold, &calls_learned)) {
+		failure = "values of dead writer";
+	} else if (!failure && (samd_priors_put(priors, "learn", 50.0, 150.0) || !samd_priors_get(priors, "learn", &noise_floor, &threshold, &calls_learned) || calls_learned != 1)) {
+		failure = "put after recover";
+	} else if (!failure && (pread(fd, &slot, sizeof(slot), free_slot) != sizeof(slot) || slot.seq != 2 || slot.key[0])) {
+		failure = "recover claim";
+	}
+	samd_priors_close(&priors);
+	if (fd >= 0) {
+		close(fd);
+	}
+	return failure;
+}
+
+/**
+ * @return 0 if priors are learned, persisted across opens and applied
+ */
+static int check_priors(void)
+{
+	char path[] = "/tmp/check_golden_priorsXXXXXX";
+	samd_priors_t *priors = NULL;
+	samd_vad_t *vad = NULL;
+	samd_stats_t stats;
+	double noise_floor = 0.0;
+	double threshold = 0.0;
+	uint32_t calls = 0;
+	const char *failure = NULL;
+	int fd = mkstemp(path);
+
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	if (samd_priors_open(&priors, path, 4)) {
+		failure = "open";
+	} else if (samd_priors_get(priors, "trunk1", &noise_floor, &threshold, &calls)) {
+		failure = "get of missing key";
+	} else if (samd_priors_put(priors, "trunk1", 50.0, 150.0) || samd_priors_put(priors, "trunk1", 70.0, 170.0)) {
+		failure = "put";
+	} else if (samd_priors_put(priors, "trunk2", 1.0, 1.0) || samd_priors_put(priors, "trunk3", 1.0, 1.0) || samd_priors_put(priors, "trunk4", 1.0, 1.0)) {
+		failure = "put to fill";
+	} else if (!samd_priors_put(priors, "trunk5", 1.0, 1.0)) {
+		failure = "put to full file";
+	}
+	samd_priors_close(&priors);
+
+	if (!failure && samd_priors_open(&priors, path, 0)) {
+		failure = "reopen";
+	} else if (!failure && (!samd_priors_get(priors, "trunk1", &noise_floor, &threshold, &calls) || noise_floor != 60.0 || threshold != 160.0 || calls != 2)) {
+		failure = "get after reopen";
+	} else if (!failure) {
+		samd_vad_init(&vad);
+		if (!samd_priors_apply(priors, "trunk1", vad)) {
+			failure = "apply";
+		} else {
+			samd_vad_get_stats(vad, &stats);
+			if (stats.energy_threshold != 160.0 || stats.noise_floor != 60.0) {
+				failure = "apply threshold";
+			}
+		}
+		samd_vad_destroy(&vad);
+	}
+	samd_priors_close(&priors);
+	unlink(path);
+
+	if (!failure) {
+		failure = check_priors_learn(path);
+	}
+	if (!failure) {
+		failure = check_priors_recover(path);
+	}
+	unlink(path);
+
+	printf("%s priors%s%s\n", failure ? "FAIL" : "PASS", failure ? " " : "", failure ? failure : "");
+	return failure != NULL;
+}
+
+static void fingerprint_event_handler(samd_event_t event, uint32_t time_ms, void *user_event_data)
+{
+	uint32_t *fingerprint_ms = (uint32_t *)user_event_data;
+	if (event == SAMD_MACHINE_FINGERPRINT && !*fingerprint_ms) {
+		*fingerprint_ms = time_ms;
+	}
+}
+
+/**
+ * @return time of the first SAMD_MACHINE_FINGERPRINT, 0 if none
+ */
+static uint32_t fingerprint_call(samd_fingerprint_index_t *index, int16_t *samples, uint32_t num_samples, const struct config *config, const char **match)
+{
+	struct run_options options = default_options;
+	samd_t *amd;
+	uint32_t fingerprint_ms = 0;
+
+	options.fingerprint_index = index;
+	amd = create_amd(NULL, config, &options);
+	samd_set_event_handler(amd, fingerprint_event_handler, &fingerprint_ms);
+	feed(amd, NULL, NULL, NULL, samples, num_samples, config, &options);
+	*match = samd_get_fingerprint_match(amd);
+	samd_destroy(&amd);
+	return fingerprint_ms;
+}
+
+static const uint32_t fingerprint_paces[FINGERPRINT_GREETINGS] = { 75, 125, 175 };
+
+/**
+ * @param pace of the speaker, percent of the golden calls' pitch and syllable rate
+ * @param seed of the speech
+ * @param lead_ms silence before it
+ * @param speech_ms
+ * @param divisor of the speech level
+ * @param num_samples (output)
+ * @return silence then speech, free() it
+ */
+static int16_t *fingerprint_samples(const struct config *config, uint32_t pace, uint32_t seed, uint32_t lead_ms, uint32_t speech_ms, int divisor, uint32_t *num_samples)
+{
+	uint32_t lead_samples = config->sample_rate * lead_ms / 1000;
+	uint32_t speech_samples = config->sample_rate * speech_ms / 1000;
+	int16_t *samples = (int16_t *)calloc(lead_samples + speech_samples, sizeof(int16_t));
+	uint32_t i;
+
+	synth_generate_mono(samples + lead_samples, SYNTH_SPEECH, config->sample_rate * 100 / pace, speech_samples, seed);
+	for (i = lead_samples; i < lead_samples + speech_samples; i++) {
+		samples[i] /= divisor;
+	}
+	*num_samples = lead_samples + speech_samples;
+	return samples;
+}
+
+/**
+ * @return 0 if each of several known greetings is matched to its name at a lower level soon after
+ * it starts, and no golden call, other speech, or greeting played after a human decision matches
+ */
+static int check_fingerprints(void)
+{
+	char path[] = "/tmp/check_golden_fingerprintsXXXXXX";
+	char name[32];
+	samd_fingerprint_builder_t *builder = NULL;
+	samd_fingerprint_index_t *index = NULL;
+	const struct config *config = &configs[0];
+	int16_t *samples;
+	uint32_t num_samples;
+	const char *failure = NULL;
+	const char *match = NULL;
+	uint32_t fingerprint_ms;
+	size_t i;
+	int fd = mkstemp(path);
+
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	/* index the greetings after 300 ms of silence */
+	samd_fingerprint_builder_init(&builder, config->sample_rate);
+	for (i = 0; i < FINGERPRINT_GREETINGS; i++) {
+		samples = fingerprint_samples(config, fingerprint_paces[i], FINGERPRINT_SEED + i, 300, FINGERPRINT_SPEECH_MS, 1, &num_samples);
+		snprintf(name, sizeof(name), "greeting%u", (unsigned)i);
+		samd_fingerprint_builder_add(builder, name, samples, num_samples, 1);
+		free(samples);
+	}
+	if (samd_fingerprint_builder_write(builder, path) || samd_fingerprint_index_open(&index, path) || samd_fingerprint_index_get_num_greetings(index) != FINGERPRINT_GREETINGS) {
+		failure = "build";
+	}
+	samd_fingerprint_builder_destroy(&builder);
+
+	/* the same greetings after 500 ms of silence, at half the level */
+	for (i = 0; !failure && i < FINGERPRINT_GREETINGS; i++) {
+		samples = fingerprint_samples(config, fingerprint_paces[i], FINGERPRINT_SEED + i, 500, FINGERPRINT_SPEECH_MS, 2, &num_samples);
+		snprintf(name, sizeof(name), "greeting%u", (unsigned)i);
+		fingerprint_ms = fingerprint_call(index, samples, num_samples, config, &match);
+		if (!fingerprint_ms || fingerprint_ms > 500 + FINGERPRINT_MAX_MS || !match || strcmp(match, name)) {
+			failure = "known greeting";
+		} else if (verbose) {
+			printf("%s matched at %u ms\n", name, fingerprint_ms);
+		}
+		free(samples);
+	}
+
+	/* someone else saying hello, at a pace between the greetings' */
+	if (!failure) {
+		samples = fingerprint_samples(config, FINGERPRINT_OTHER_PACE, FINGERPRINT_SEED + FINGERPRINT_GREETINGS, 600, 900, 1, &num_samples);
+		if (fingerprint_call(index, samples, num_samples, config, &match)) {
+			failure = "other hello";
+		}
+		free(samples);
+	}
+
+	/* a known greeting heard only after the AMD decided human */
+	if (!failure) {
+		uint32_t greeting_samples;
+		int16_t *greeting = fingerprint_samples(config, fingerprint_paces[0], FINGERPRINT_SEED, 0, FINGERPRINT_SPEECH_MS, 1, &greeting_samples);
+		int16_t *call_samples;
+		samples = fingerprint_samples(config, FINGERPRINT_OTHER_PACE, FINGERPRINT_SEED + FINGERPRINT_GREETINGS, 600, 900, 1, &num_samples);
+		call_samples = (int16_t *)calloc(num_samples + config->sample_rate * 3 + greeting_samples, sizeof(int16_t));
+		memcpy(call_samples, samples, sizeof(int16_t) * num_samples);
+		memcpy(call_samples + num_samples + config->sample_rate * 3, greeting, sizeof(int16_t) * greeting_samples);
+		if (fingerprint_call(index, call_samples, num_samples + config->sample_rate * 3 + greeting_samples, config, &match)) {
+			failure = "after decision";
+		}
+		free(call_samples);
+		free(greeting);
+		free(samples);
+	}
+
+	for (i = 0; !failure && i < sizeof(calls) / sizeof(calls[0]); i++) {
+		int16_t *call_samples = call_generate(&calls[i], config, &num_samples);
+		if (fingerprint_call(index, call_samples, num_samples, config, &match)) {
+			failure = calls[i].name;
+		}
+		free(call_samples);
+	}
+
+	samd_fingerprint_index_close(&index);
+	unlink(path);
+
+	printf("%s fingerprints%s%s\n", failure ? "FAIL" : "PASS", failure ? " " : "", failure ? failure : "");
+	return failure != NULL;
+}
+
+/**
+ * @return number of times text occurs in the trace
+ */
+static int trace_count(const struct trace *trace, const char *text)
+{
+	const char *found = trace->text;
+	int count = 0;
+	while ((found = strstr(found, text))) {
+		found += strlen(text);
+		count++;
+	}
+	return count;
+}
+
+/**
+ * @return 0 if provisional events come before the final decision and don't change it, are sent
+ * at most once each, and agree with the decision on the golden hello and greeting
+ */
+static int check_provisional(void)
+{
+	struct trace *expected = (struct trace *)calloc(1, sizeof(*expected));
+	struct trace *actual = (struct trace *)calloc(1, sizeof(*actual));
+	struct run_options options = default_options;
+	const char *failure = NULL;
+	size_t c, i;
+
+	options.provisional_confidence = PROVISIONAL_CONFIDENCE;
+	for (c = 0; c < sizeof(configs) / sizeof(configs[0]) && !failure; c++) {
+		for (i = 0; i < sizeof(calls) / sizeof(calls[0]) && !failure; i++) {
+			uint32_t num_samples;
+			int16_t *samples = call_generate(&calls[i], &configs[c], &num_samples);
+			samd_t *amd;
+			char *line;
+			int decided = 0;
+
+			expected->len = 0;
+			amd = create_amd(expected, &configs[c], &default_options);
+			feed(amd, NULL, NULL, NULL, samples, num_samples, &configs[c], &default_options);
+			samd_destroy(&amd);
+
+			actual->len = 0;
+			amd = create_amd(actual, &configs[c], &options);
+			feed(amd, NULL, NULL, NULL, samples, num_samples, &configs[c], &options);
+			samd_destroy(&amd);
+
+			if (trace_count(actual, "LIKELY MACHINE") > 1 || trace_count(actual, "LIKELY HUMAN") > 1) {
+				failure = "repeated";
+			} else if (!strcmp(calls[i].name, "human_hello") && (trace_count(actual, "LIKELY MACHINE") || !trace_count(actual, "LIKELY HUMAN"))) {
+				failure = calls[i].name;
+			} else if (!strcmp(calls[i].name, "machine_greeting") && (trace_count(actual, "LIKELY HUMAN") || !trace_count(actual, "LIKELY MACHINE"))) {
+				failure = calls[i].name;
+			}
+
+			/* remove provisional events, the rest must match */
+			for (line = actual->text; !failure && *line; ) {
+				char *end = strchr(line, '\n') + 1;
+				if (strncmp(line, "amd AMD LIKELY ", 15)) {
+					decided = 1;
+					line = end;
+				} else if (decided) {
+					failure = "after decision";
+				} else {
+					memmove(line, end, strlen(end) + 1);
+				}
+			}
+			if (!failure && strcmp(actual->text, expected->text)) {
+				failure = "changed decision";
+			}
+			if (failure && verbose) {
+				printf("--- %s %u Hz %u ms expected\n%s--- actual\n%s", calls[i].name, configs[c].sample_rate, configs[c].frame_ms, expected->text, actual->text);
+			}
+			free(samples);
+		}
+	}
+
+	printf("%s provisional%s%s\n", failure ? "FAIL" : "PASS", failure ? " " : "", failure ? failure : "");
+	free(expected);
+	free(actual);
+	return failure != NULL;
+}
+
+static void spectral_frame_handler(samd_frame_analyzer_t *analyzer, void *user_data, uint32_t time_ms, double energy, uint32_t zero_crossings)
+{
+	(void)time_ms;
+	(void)energy;
+	(void)zero_crossings;
+	samd_frame_analyzer_get_spectral_features(analyzer, (samd_spectral_features_t *)user_data);
+}
+
+/**
+ * @param silence_ms of silence that replaces the end of the signal
+ * @return spectral features of the last frame of 500 ms of a signal
+ */
+static void spectral_signal(synth_signal_t signal, const struct config *config, uint32_t silence_ms, samd_spectral_features_t *features)
+{
+	samd_frame_analyzer_t *analyzer = NULL;
+	uint32_t num_samples;
+	int16_t *samples = synth_generate(signal, config->sample_rate, config->channels, 500, SEED, &num_samples);
+	uint32_t silence_samples = config->sample_rate * config->channels * silence_ms / 1000;
+
+	memset(samples + num_samples - silence_samples, 0, sizeof(int16_t) * silence_samples);
+	memset(features, 0, sizeof(*features));
+	samd_frame_analyzer_init(&analyzer);
+	samd_frame_analyzer_set_sample_rate(analyzer, config->sample_rate);
+	samd_frame_analyzer_set_frame_ms(analyzer, config->frame_ms);
+	samd_frame_analyzer_set_spectral(analyzer, 1);
+	samd_frame_analyzer_subscribe(analyzer, spectral_frame_handler, features);
+	feed(NULL, NULL, NULL, analyzer, samples, num_samples, config, &default_options);
+	samd_frame_analyzer_destroy(&analyzer);
+	free(samples);
+}
+
+/**
+ * @return 0 if tones and noise have the spectral features expected of them at every rate, and a
+ * tone in only the first half of a 40 ms frame is still seen
+ */
+static int check_spectral(void)
+{
+	static const struct config long_frames = { 8000, 1, 40 };
+	samd_spectral_features_t half_tone;
+	const char *failure = NULL;
+	size_t c;
+
+	for (c = 0; c < sizeof(configs) / sizeof(configs[0]) && !failure; c++) {
+		samd_spectral_features_t tone440, tone1000, noise;
+		spectral_signal(SYNTH_BEEP_440, &configs[c], 0, &tone440);
+		spectral_signal(SYNTH_BEEP_1000, &configs[c], 0, &tone1000);
+		spectral_signal(SYNTH_NOISE, &configs[c], 0, &noise);
+		if (verbose) {
+			printf("spectral %u Hz %u ms: 440 Hz %.1f %.3f %.3f, 1000 Hz %.1f %.3f %.3f, noise %.1f %.3f\n", configs[c].sample_rate, configs[c].frame_ms,
+				tone440.centroid_hz, tone440.flatness, tone440.bands[0], tone1000.centroid_hz, tone1000.flatness, tone1000.bands[1] + tone1000.bands[2],
+				noise.centroid_hz, noise.flatness);
+		}
+		/* a quarter of the 440 Hz window leaks into the 500 Hz bin, and 1000 Hz is the edge of bands 1 and 2 */
+		if (tone440.bands[0] < 0.75 || tone440.centroid_hz < 400.0 || tone440.centroid_hz > 480.0) {
+			failure = "440 Hz";
+		} else if (tone1000.bands[1] + tone1000.bands[2] < 0.9 || tone1000.centroid_hz < 950.0 || tone1000.centroid_hz > 1050.0) {
+			failure = "1000 Hz";
+		} else if (noise.flatness < 10.0 * tone440.flatness || noise.flatness < 10.0 * tone1000.flatness) {
+			failure = "noise";
+		}
+	}
+
+	spectral_signal(SYNTH_BEEP_440, &long_frames, 20, &half_tone);
+	if (verbose) {
+		printf("spectral 440 Hz then 20 ms of silence in a 40 ms frame: %.1f %.3f %.3f\n", half_tone.centroid_hz, half_tone.flatness, half_tone.bands[0]);
+	}
+	if (!failure && (half_tone.bands[0] < 0.75 || half_tone.centroid_hz < 400.0 || half_tone.centroid_hz > 480.0)) {
+		failure = "whole frame";
+	}
+
+	printf("%s spectral%s%s\n", failure ? "FAIL" : "PASS", failure ? " " : "", failure ? failure : "");
+	return failure != NULL;
+}
+
+/**
+ * Train a classifier on two separable groups of calls and write it out
+ */
+static int check_classifier(void)
+{
+	char path[] = "/tmp/check_golden_classifierXXXXXX";
+	char header[4096];
+	samd_classifier_trainer_t *trainer = NULL;
+	samd_classifier_model_t model;
+	double features[SAMD_CLASSIFIER_FEATURES];
+	const char *failure = NULL;
+	FILE *file;
+	size_t len;
+	int i, f;
+	int fd = mkstemp(path);
+
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	samd_classifier_trainer_init(&trainer);
+	if (!samd_classifier_trainer_fit(trainer, &model)) {
+		failure = "fit without calls";
+	}
+	for (i = 0; i < 40 && !failure; i++) {
+		int machine = i & 1;
+		for (f = 0; f < SAMD_CLASSIFIER_FEATURES; f++) {
+			features[f] = (machine ? 2.0 : 1.0) + 0.1 * ((i * 7 + f * 3) % 5);
+		}
+		if (samd_classifier_trainer_add(trainer, features, machine)) {
+			failure = "add";
+		}
+	}
+	if (!failure && samd_classifier_trainer_fit(trainer, &model)) {
+		failure = "fit";
+	}
+	for (i = 0; i < 40 && !failure; i++) {
+		int machine = i & 1;
+		for (f = 0; f < SAMD_CLASSIFIER_FEATURES; f++) {
+			features[f] = (machine ? 2.0 : 1.0) + 0.1 * ((i * 7 + f * 3) % 5);
+		}
+		if ((samd_classifier_predict(&model, features) >= 0.5) != machine) {
+			failure = "predict";
+		}
+	}
+	samd_classifier_trainer_destroy(&trainer);
+
+	/* the default model decides the golden greetings and hellos like the duration rules */
+	for (i = 0; i < (int)(sizeof(calls) / sizeof(calls[0])) && !failure; i++) {
+		struct run_options options = default_options;
+		const char *expected = !strncmp(calls[i].name, "human", 5) ? "amd AMD HUMAN " : !strncmp(calls[i].name, "machine", 7) ? "amd AMD MACHINE " : NULL;
+		struct trace *trace;
+		uint32_t num_samples;
+		int16_t *samples;
+		samd_t *amd;
+		if (!expected) {
+			continue;
+		}
+		trace = (struct trace *)calloc(1, sizeof(*trace));
+		samples = call_generate(&calls[i], &configs[0], &num_samples);
+		options.classifier = samd_classifier_get_default_model();
+		amd = create_amd(trace, &configs[0], &options);
+		feed(amd, NULL, NULL, NULL, samples, num_samples, &configs[0], &options);
+		if (!samd_get_classifier_features(amd, features) || strncmp(trace->text, expected, strlen(expected))) {
+			failure = calls[i].name;
+		}
+		samd_destroy(&amd);
+		free(samples);
+		free(trace);
+	}
+
+	if (!failure && samd_classifier_write(&model, path, "golden_model")) {
+		failure = "write";
+	} else if (!failure) {
+		file = fopen(path, "r");
+		len = file ? fread(header, 1, sizeof(header) - 1, file) : 0;
+		header[len] = '\0';
+		if (file) {
+			fclose(file);
+		}
+		if (!strstr(header, "static const samd_classifier_model_t golden_model = {")) {
+			failure = "header";
+		}
+	}
+	unlink(path);
+
+	printf("%s classifier%s%s\n", failure ? "FAIL" : "PASS", failure ? " " : "", failure ? failure : "");
+	return failure != NULL;
+}
+
+/** positions of events fed in multi-frame buffers */
+struct event_positions {
+	/* sample index of the buffer being processed */
+	uint64_t buffer_start;
+	int mid_buffer;
+	int negative;
+	const char *failure;
+};
+
+static void event_position_handler(const samd_event_info_t *info, void *user_event_data)
+{
+	struct event_positions *positions = (struct event_positions *)user_event_data;
+	if ((int64_t)positions->buffer_start + info->offset != (int64_t)info->sample || info->time_ms != info->sample * 1000 / 8000) {
+		positions->failure = "sample";
+	} else if (info->event == SAMD_MACHINE_BEEP) {
+		/* the beep ends 1300 ms in, and is confirmed at least 200 ms later */
+		if (info->offset >= 0 || info->time_ms < 1290 || info->time_ms > 1330) {
+			positions->failure = "beep end";
+		}
+		positions->negative = 1;
+	} else if (info->event == SAMD_MACHINE_SILENCE) {
+		if (info->offset <= 0 || info->offset >= EVENT_BUFFER_SAMPLES) {
+			positions->failure = "silence";
+		}
+		positions->mid_buffer = 1;
+	}
+}
+
+/**
+ * @return 0 if events fed in buffers of several frames are placed inside the buffer they were
+ * detected in, and the end of a beep in an earlier one, both by the info handler and in the
+ * records of samd_process_buffer_events()
+ */
+static int check_event_positions(void)
+{
+	const struct config *config = &configs[0];
+	const struct call *call = &calls[0];
+	struct event_positions positions = { 0 };
+	struct event_positions records = { 0 };
+	samd_event_record_t events[8];
+	samd_event_info_t info;
+	uint32_t num_samples;
+	uint32_t len;
+	int16_t *samples;
+	samd_t *amd = NULL;
+	uint32_t pos;
+	size_t num_events;
+	size_t i;
+
+	for (; strcmp(call->name, "beep_only"); call++) {
+	}
+	samples = call_generate(call, config, &num_samples);
+	samd_init(&amd);
+	samd_set_sample_rate(amd, config->sample_rate);
+	samd_set_frame_ms(amd, config->frame_ms);
+	samd_set_event_info_handler(amd, event_position_handler, &positions);
+	for (pos = 0; pos < num_samples; pos += EVENT_BUFFER_SAMPLES) {
+		positions.buffer_start = pos;
+		samd_process_buffer(amd, samples + pos, num_samples - pos < EVENT_BUFFER_SAMPLES ? num_samples - pos : EVENT_BUFFER_SAMPLES, 1);
+	}
+	if (!positions.failure && (!positions.mid_buffer || !positions.negative)) {
+		positions.failure = "missing event";
+	}
+	samd_destroy(&amd);
+
+	/* records collected by samd_process_buffer_events() carry the same positions */
+	samd_init(&amd);
+	samd_set_sample_rate(amd, config->sample_rate);
+	samd_set_frame_ms(amd, config->frame_ms);
+	for (pos = 0; pos < num_samples; pos += EVENT_BUFFER_SAMPLES) {
+		len = num_samples - pos < EVENT_BUFFER_SAMPLES ? num_samples - pos : EVENT_BUFFER_SAMPLES;
+		records.buffer_start = pos;
+		num_events = samd_process_buffer_events(amd, samples + pos, len, 1, events, sizeof(events) / sizeof(events[0]));
+		for (i = 0; i < num_events && i < sizeof(events) / sizeof(events[0]); i++) {
+			info.event = events[i].event;
+			info.time_ms = events[i].time_ms;
+			info.sample = events[i].sample;
+			info.offset = events[i].offset;
+			event_position_handler(&info, &records);
+		}
+	}
+	if (!records.failure && (!records.mid_buffer || !records.negative)) {
+		records.failure = "missing record";
+	}
+	if (!positions.failure && records.failure) {
+		positions.failure = records.failure;
+	}
+	samd_destroy(&amd);
+	free(samples);
+
+	printf("%s event positions%s%s\n", positions.failure ? "FAIL" : "PASS", positions.failure ? " " : "", positions.failure ? positions.failure : "");
+	return positions.failure != NULL;
+}
+
+/** VAD events checked against the heartbeat as they arrive */
+struct heartbeat {
+	/* edges, traced as without a heartbeat */
+	struct trace *trace;
+	uint32_t last_event_ms;
+	samd_vad_event_t edge;
+	uint32_t edges;
+	uint32_t beats;
+	/* edges that came between heartbeats, restarting the interval */
+	uint32_t resets;
+	const char *failure;
+};
+
+static void heartbeat_handler(samd_vad_event_t event, uint32_t time_ms, uint32_t total_voice_ms, uint32_t transition_ms, void *user_event_data)
+{
+	struct heartbeat *heartbeat = (struct heartbeat *)user_event_data;
+	uint32_t interval = time_ms - heartbeat->last_event_ms;
+	if (heartbeat->failure) {
+		return;
+	}
+	if (event == SAMD_VAD_VOICE_BEGIN || event == SAMD_VAD_SILENCE_BEGIN) {
+		vad_event_handler(event, time_ms, total_voice_ms, transition_ms, heartbeat->trace);
+		/* the VAD has no state to beat before its first edge */
+		if (heartbeat->edges && interval > HEARTBEAT_MS) {
+			heartbeat->failure = "missed";
+		} else if (interval < HEARTBEAT_MS && heartbeat->beats) {
+			heartbeat->resets++;
+		}
+		heartbeat->edge = event;
+		heartbeat->edges++;
+	} else if (!heartbeat->edges || interval != HEARTBEAT_MS) {
+		heartbeat->failure = "interval";
+	} else if ((event == SAMD_VAD_VOICE) != (heartbeat->edge == SAMD_VAD_VOICE_BEGIN)) {
+		heartbeat->failure = "state";
+	} else {
+		heartbeat->beats++;
+	}
+	heartbeat->last_event_ms = time_ms;
+}
+
+/**
+ * @return 0 if a VAD in edge mode sends the same edges with a heartbeat, and SAMD_VAD_VOICE or
+ * SAMD_VAD_SILENCE exactly every heartbeat_ms since the last event of any kind
+ */
+static int check_heartbeat(void)
+{
+	static const char *heartbeat_calls[] = { "human_hello", "machine_greeting", "machine_beep440" };
+	struct trace *expected = (struct trace *)calloc(1, sizeof(*expected));
+	struct trace *actual = (struct trace *)calloc(1, sizeof(*actual));
+	struct heartbeat totals = { 0 };
+	const char *failure = NULL;
+	size_t c, i;
+
+	for (c = 0; c < 2 && !failure; c++) {
+		const struct config *config = &configs[c];
+		for (i = 0; i < sizeof(heartbeat_calls) / sizeof(heartbeat_calls[0]) && !failure; i++) {
+			const struct call *call = &calls[0];
+			struct heartbeat heartbeat = { 0 };
+			uint32_t num_samples;
+			int16_t *samples;
+			samd_vad_t *vad;
+
+			for (; strcmp(call->name, heartbeat_calls[i]); call++) {
+			}
+			samples = call_generate(call, config, &num_samples);
+			expected->len = 0;
+			vad = create_vad(expected, config, &default_options);
+			feed(NULL, vad, NULL, NULL, samples, num_samples, config, &default_options);
+			samd_vad_destroy(&vad);
+
+			actual->len = 0;
+			heartbeat.trace = actual;
+			vad = create_vad(NULL, config, &default_options);
+			samd_vad_set_heartbeat_ms(vad, HEARTBEAT_MS);
+			samd_vad_set_event_handler(vad, heartbeat_handler, &heartbeat);
+			feed(NULL, vad, NULL, NULL, samples, num_samples, config, &default_options);
+			samd_vad_destroy(&vad);
+			free(samples);
+			if (heartbeat.failure) {
+				failure = heartbeat.failure;
+			} else if (actual->len != expected->len || memcmp(actual->text, expected->text, actual->len)) {
+				failure = "edges";
+			} else if (num_samples / config->channels * 1000 / config->sample_rate - heartbeat.last_event_ms >= HEARTBEAT_MS) {
+				failure = "last";
+			}
+			totals.edges += heartbeat.edges;
+			totals.beats += heartbeat.beats;
+			totals.resets += heartbeat.resets;
+			if (failure && verbose) {
+				printf("--- %s %u Hz %u ms\n", call->name, config->sample_rate, config->frame_ms);
+			}
+		}
+	}
+	if (!failure && (!totals.edges || !totals.beats || !totals.resets)) {
+		failure = "missing event";
+	}
+	if (verbose) {
+		printf("heartbeat: %u edges, %u heartbeats, %u resets\n", totals.edges, totals.beats, totals.resets);
+	}
+
+	printf("%s heartbeat%s%s\n", failure ? "FAIL" : "PASS", failure ? " " : "", failure ? failure : "");
+	free(expected);
+	free(actual);
+	return failure != NULL;
+}
+
+/**
+ * @return 0 if a VAD tracking the noise floor raises its threshold after background noise steps up,
+ * and stops hearing the louder noise as voice once its window has filled with it
+ */
+static int check_noise_step(void)
+{
+	const struct config *config = &configs[0];
+	uint32_t quiet_samples = config->sample_rate * NOISE_STEP_QUIET_MS / 1000;
+	uint32_t num_samples;
+	int16_t *samples = synth_generate(SYNTH_NOISE, config->sample_rate, 1, NOISE_STEP_QUIET_MS + NOISE_STEP_LOUD_MS, SEED, &num_samples);
+	uint32_t chunk = config->sample_rate / 50;
+	uint64_t adapted_voice_frames = 0;
+	double quiet_threshold = 0.0;
+	const char *failure = NULL;
+	samd_vad_t *vad = NULL;
+	samd_stats_t stats;
+	uint32_t pos;
+
+	for (pos = 0; pos < quiet_samples; pos++) {
+		samples[pos] /= 10;
+	}
+	samd_vad_init(&vad);
+	samd_vad_set_sample_rate(vad, config->sample_rate);
+	samd_vad_set_noise_floor_window_ms(vad, NOISE_FLOOR_WINDOW_MS);
+	for (pos = 0; pos + chunk <= num_samples; pos += chunk) {
+		samd_vad_process_buffer(vad, samples + pos, chunk, 1);
+		samd_vad_get_stats(vad, &stats);
+		if (pos + chunk == quiet_samples) {
+			quiet_threshold = stats.energy_threshold;
+		} else if (pos + chunk == num_samples - config->sample_rate) {
+			/* the window is full of loud noise and the VAD has had time to end voice */
+			adapted_voice_frames = stats.voice_frames;
+		}
+	}
+	if (verbose) {
+		printf("noise step: threshold %.1f to %.1f, noise floor %.1f, %llu voice frames in the last second\n", quiet_threshold, stats.energy_threshold, stats.noise_floor,
+			(unsigned long long)(stats.voice_frames - adapted_voice_frames));
+	}
+	if (stats.energy_threshold < 3.0 * quiet_threshold) {
+		failure = "threshold";
+	} else if (stats.voice_frames != adapted_voice_frames) {
+		failure = "voice";
+	}
+	samd_vad_destroy(&vad);
+	free(samples);
+
+	printf("%s noise step%s%s\n", failure ? "FAIL" : "PASS", failure ? " " : "", failure ? failure : "");
+	return failure != NULL;
+}
+
+/**
+ * Count and run a VAD for a second in a thread that exits
+ */
+static void *metrics_thread(void *arg)
+{
+	int metric = *(int *)arg;
+	int16_t samples[8000] = { 0 };
+	samd_vad_t *vad = NULL;
+
+	samd_metrics_add(metric, 5);
+	samd_metrics_observe_decision_ms(1200);
+	samd_vad_init(&vad);
+	samd_vad_process_buffer(vad, samples, 8000, 1);
+	samd_vad_destroy(&vad);
+	return NULL;
+}
+
+/**
+ * @return 0 if metrics and global stats of exited threads remain, and decision times are rendered
+ * in seconds
+ */
+static int check_metrics(void)
+{
+	int metric = samd_metrics_register("golden_thread_total", "", "Counted by exited threads.", SAMD_METRIC_COUNTER);
+	const char *failure = NULL;
+	char buf[8192];
+	samd_stats_t before;
+	samd_stats_t after;
+	pthread_t thread;
+	int i;
+
+	samd_get_global_stats(&before);
+	for (i = 0; i < 2 && !failure; i++) {
+		if (pthread_create(&thread, NULL, metrics_thread, &metric)) {
+			failure = "thread";
+		} else {
+			pthread_join(thread, NULL);
+		}
+	}
+	samd_get_global_stats(&after);
+	if (!failure && (samd_metrics_get(metric) != 10.0 || after.samples - before.samples != 16000)) {
+		failure = "exited threads";
+	} else if (!failure && samd_metrics_render(buf, sizeof(buf)) >= sizeof(buf)) {
+		failure = "render";
+	} else if (!failure && (!strstr(buf, "golden_thread_total 10\n") || !strstr(buf, "simpleamd_decision_seconds_bucket{le=\"1.5\"} ") || strstr(buf, "simpleamd_decision_seconds_bucket{le=\"1.5\"} 0\n"))) {
+		failure = "seconds";
+	}
+
+	printf("%s metrics%s%s\n", failure ? "FAIL" : "PASS", failure ? " " : "", failure ? failure : "");
+	return failure != NULL;
+}
+
+int main(int argc, char **argv)
+{
+	const char *srcdir = getenv("srcdir");
+	char golden_dir[1024];
+	int equivalence_only = 0;
+	int update = 0;
+	int failed = 0;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "uev")) != -1) {
+		switch (opt) {
+			case 'u': update = 1; break;
+			case 'e': equivalence_only = 1; break;
+			case 'v': verbose = 1; break;
+			default:
+				fprintf(stderr, "check_golden [-u] [-e] [-v]\n");
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (snprintf(golden_dir, sizeof(golden_dir), "%s/golden", srcdir ? srcdir : ".") >= (int)sizeof(golden_dir)) {
+		fprintf(stderr, "srcdir too long\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < sizeof(calls) / sizeof(calls[0]); i++) {
+		if (!equivalence_only) {
+			failed |= check_golden(golden_dir, &calls[i], update);
+		}
+		if (!update) {
+			failed |= check_equivalence(&calls[i]);
+		}
+		if (!update && !equivalence_only) {
+			failed |= check_variants(&calls[i]);
+			failed |= check_buffer_events(&calls[i]);
+		}
+	}
+	if (!update) {
+		failed |= check_priors();
+		failed |= check_provisional();
+		failed |= check_spectral();
+		failed |= check_noise_step();
+		failed |= check_heartbeat();
+		failed |= check_event_positions();
+		failed |= check_fingerprints();
+		failed |= check_classifier();
+		failed |= check_metrics();
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}